@@ -0,0 +1,320 @@
+#include <errno.h>
+#include <float.h>
+#include <math.h>
+#include "td_decay.h"
+#include "td_internal.h"
+
+#ifndef TD_MALLOC_INCLUDE
+#define TD_MALLOC_INCLUDE "td_malloc.h"
+#endif
+
+#include TD_MALLOC_INCLUDE
+
+struct td_decay {
+    double compression;
+    double rate;
+    // weights are relative to the landmark: a sample of weight w taken at ts weighs
+    // w * exp(rate * (ts - landmark))
+    double landmark;
+    // latest timestamp seen, the time a sample of weight 1 counts as one sample
+    double newest;
+    double min;
+    double max;
+    int cap;
+    int merged_nodes;
+    int unmerged_nodes;
+    double merged_weight;
+    double unmerged_weight;
+    // the merged centroids, then the buffer, as in a histogram
+    double *mean;
+    double *weight;
+    // sort payload: td_sort_nodes() moves long long weights, so the nodes are sorted with their
+    // index and the weights gathered after
+    long long *order;
+};
+
+// A sample is weighed at most exp(TD_DECAY_MAX_EXPONENT) before the landmark is moved up to it,
+// which keeps the weights well inside the double range.
+#define TD_DECAY_MAX_EXPONENT 64.0
+
+int td_decay_init(double compression, double rate, double landmark, td_decay_t **result) {
+    size_t capacity = 0;
+    if (!isfinite(rate) || rate < 0 || !isfinite(landmark) ||
+        capacity_from_compression(compression, &capacity) != 0) {
+        return 1;
+    }
+    // one block: the header, then the three node arrays
+    const size_t header = (sizeof(td_decay_t) + 7) & ~(size_t)7;
+    const size_t node_size = 2 * sizeof(double) + sizeof(long long);
+    if (capacity > (SIZE_MAX - header) / node_size) {
+        return 1;
+    }
+    char *block = (char *)td_malloc_(header + capacity * node_size);
+    if (!block) {
+        return 1;
+    }
+    td_decay_t *d = (td_decay_t *)block;
+    d->compression = compression;
+    d->rate = rate;
+    d->landmark = landmark;
+    d->newest = landmark;
+    d->min = __DBL_MAX__;
+    d->max = -d->min;
+    d->cap = (int)capacity;
+    d->merged_nodes = 0;
+    d->unmerged_nodes = 0;
+    d->merged_weight = 0;
+    d->unmerged_weight = 0;
+    d->mean = (double *)(block + header);
+    d->weight = d->mean + capacity;
+    d->order = (long long *)(d->weight + capacity);
+    *result = d;
+    return 0;
+}
+
+td_decay_t *td_decay_new(double compression, double rate, double landmark) {
+    td_decay_t *d = NULL;
+    td_decay_init(compression, rate, landmark, &d);
+    return d;
+}
+
+void td_decay_free(td_decay_t *d) {
+    if (!d) {
+        return;
+    }
+    td_free_((void *)d);
+}
+
+// Moves the landmark up to `landmark`, rescaling every weight to it; no centroid is rebuilt.
+static void td_decay_renormalize(td_decay_t *d, double landmark) {
+    const double scale = exp(d->rate * (d->landmark - landmark));
+    const int n = d->merged_nodes + d->unmerged_nodes;
+    for (int i = 0; i < n; i++) {
+        d->weight[i] *= scale;
+    }
+    d->merged_weight *= scale;
+    d->unmerged_weight *= scale;
+    d->landmark = landmark;
+}
+
+// Sorts the first n nodes by mean: the means go through td_sort_nodes() with their index as
+// payload, then the weights follow the permutation in place, one cycle at a time.
+static void td_decay_sort(td_decay_t *d, int n) {
+    long long *order = d->order;
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    td_sort_nodes(&td_default_allocator, d->mean, order, 0, n - 1);
+    double *weight = d->weight;
+    for (int i = 0; i < n; i++) {
+        if (order[i] < 0) {
+            // already placed by an earlier cycle
+            continue;
+        }
+        // weight[j] takes weight[order[j]] along the cycle through i
+        const double first = weight[i];
+        int j = i;
+        for (;;) {
+            const int from = (int)order[j];
+            order[j] = -1;
+            if (from == i) {
+                weight[j] = first;
+                break;
+            }
+            weight[j] = weight[from];
+            j = from;
+        }
+    }
+}
+
+int td_decay_compress(td_decay_t *d) {
+    if (d->unmerged_nodes == 0) {
+        return 0;
+    }
+    double *mean = d->mean;
+    double *weight = d->weight;
+    const int N = d->merged_nodes + d->unmerged_nodes;
+    // drop what decayed below TD_DECAY_MIN_WEIGHT, then sort; the merged prefix is already
+    // sorted, and N is at most cap, so a full sort is cheap next to the queries it serves
+    // weight of one sample taken at the newest timestamp
+    const double unit = exp(d->rate * (d->newest - d->landmark));
+    const double floor_weight = __td_max(TD_DECAY_MIN_WEIGHT * unit, DBL_MIN);
+    int kept = 0;
+    double total_weight = 0;
+    for (int i = 0; i < N; i++) {
+        if (weight[i] >= floor_weight) {
+            total_weight += weight[i];
+            kept++;
+        }
+    }
+    // The k-scale pass of td_compress(), with the decayed sample count, the total weight as seen
+    // at the newest timestamp, in place of the sample count. Dropping what decayed below
+    // TD_DECAY_MIN_WEIGHT keeps the tails, and so the number of centroids, bounded. Checked
+    // before any node moves, so an overflow leaves the digest as it was.
+    const double count = total_weight / unit;
+    const double denom = 2 * MM_PI * total_weight * log(__td_max(count, 2.0));
+    const double normalizer = d->compression / denom;
+    if (total_weight == INFINITY || denom == INFINITY || normalizer == INFINITY) {
+        return EDOM;
+    }
+    if (kept < N) {
+        int pos = 0;
+        for (int i = 0; i < N; i++) {
+            if (weight[i] >= floor_weight) {
+                mean[pos] = mean[i];
+                weight[pos] = weight[i];
+                pos++;
+            }
+        }
+    }
+    if (kept > 1) {
+        td_decay_sort(d, kept);
+    }
+    if (kept == 0) {
+        // everything decayed away
+        d->min = __DBL_MAX__;
+        d->max = -d->min;
+    } else if (kept < N) {
+        // the extremes may have gone with the dropped nodes; the outermost kept ones stand in
+        d->min = mean[0];
+        d->max = mean[kept - 1];
+    }
+    int merged = kept;
+    if (kept > 1) {
+        struct td_kscale k;
+        td_kscale_init_f(&k, mean, weight, total_weight, normalizer);
+        for (int i = 0; i < kept; i++) {
+            td_kscale_push_f(&k, mean[i], weight[i]);
+        }
+        merged = k.cur + 1;
+    }
+    d->merged_nodes = merged;
+    d->merged_weight = total_weight;
+    d->unmerged_nodes = 0;
+    d->unmerged_weight = 0;
+    return 0;
+}
+
+int td_decay_add(td_decay_t *d, double ts, double value, double weight) {
+    if (!isfinite(ts) || !isfinite(value) || !isfinite(weight) || weight < TD_DECAY_MIN_WEIGHT) {
+        return EINVAL;
+    }
+    double exponent = d->rate * (ts - d->landmark);
+    if (exponent > TD_DECAY_MAX_EXPONENT) {
+        td_decay_renormalize(d, ts);
+        exponent = 0;
+    }
+    const double w = weight * exp(exponent);
+    if (w < DBL_MIN) {
+        return ERANGE;
+    }
+    if (w == INFINITY || d->unmerged_weight + w == INFINITY) {
+        return EDOM;
+    }
+    if (d->merged_nodes + d->unmerged_nodes >= d->cap - 1) {
+        const int res = td_decay_compress(d);
+        if (res != 0) {
+            return res;
+        }
+    }
+    const int pos = d->merged_nodes + d->unmerged_nodes;
+    if (pos >= d->cap) {
+        return EDOM;
+    }
+    if (ts > d->newest) {
+        d->newest = ts;
+    }
+    if (value < d->min) {
+        d->min = value;
+    }
+    if (value > d->max) {
+        d->max = value;
+    }
+    d->mean[pos] = value;
+    d->weight[pos] = w;
+    d->unmerged_nodes++;
+    d->unmerged_weight += w;
+    return 0;
+}
+
+// Centroid i holds its weight around its mean: the cumulative weight reaches the middle of it at
+// mean[i], and min and max close the first and last half centroid. The queries interpolate
+// linearly between these points; fractional weights leave no unit-weight singletons to pin down.
+double td_decay_quantile(td_decay_t *d, double q) {
+    if (q < 0.0 || q > 1.0 || td_decay_compress(d) != 0 || d->merged_nodes == 0) {
+        return NAN;
+    }
+    const double *mean = d->mean;
+    const double *weight = d->weight;
+    const double index = q * d->merged_weight;
+    double left_mean = d->min;
+    double left_weight = 0;
+    double weight_so_far = 0;
+    for (int i = 0; i < d->merged_nodes; i++) {
+        const double mid = weight_so_far + weight[i] / 2;
+        if (index <= mid) {
+            if (mid <= left_weight) {
+                return mean[i];
+            }
+            const double t = (index - left_weight) / (mid - left_weight);
+            return left_mean + t * (mean[i] - left_mean);
+        }
+        left_mean = mean[i];
+        left_weight = mid;
+        weight_so_far += weight[i];
+    }
+    if (d->merged_weight <= left_weight) {
+        return d->max;
+    }
+    const double t = (index - left_weight) / (d->merged_weight - left_weight);
+    return __td_min(left_mean + t * (d->max - left_mean), d->max);
+}
+
+double td_decay_cdf(td_decay_t *d, double val) {
+    if (td_decay_compress(d) != 0 || d->merged_nodes == 0) {
+        return NAN;
+    }
+    if (val < d->min) {
+        return 0;
+    }
+    if (val > d->max) {
+        return 1;
+    }
+    const double *mean = d->mean;
+    const double *weight = d->weight;
+    const int n = d->merged_nodes;
+    const double total_weight = d->merged_weight;
+    double left_mean = d->min;
+    double left_weight = 0;
+    double weight_so_far = 0;
+    for (int i = 0; i < n; i++) {
+        if (val == mean[i]) {
+            // one or more centroids at val, taken as one
+            double dw = 0;
+            for (int j = i; j < n && mean[j] == val; j++) {
+                dw += weight[j];
+            }
+            return (weight_so_far + dw / 2) / total_weight;
+        }
+        const double mid = weight_so_far + weight[i] / 2;
+        if (val < mean[i]) {
+            // left_mean <= val < mean[i]
+            const double t = (val - left_mean) / (mean[i] - left_mean);
+            return (left_weight + t * (mid - left_weight)) / total_weight;
+        }
+        left_mean = mean[i];
+        left_weight = mid;
+        weight_so_far += weight[i];
+    }
+    // left_mean < val <= max
+    const double t = (val - left_mean) / (d->max - left_mean);
+    return (left_weight + t * (total_weight - left_weight)) / total_weight;
+}
+
+double td_decay_size(const td_decay_t *d, double now) {
+    return (d->merged_weight + d->unmerged_weight) * exp(d->rate * (d->landmark - now));
+}
+
+double td_decay_landmark(const td_decay_t *d) { return d->landmark; }
+
+int td_decay_centroid_count(const td_decay_t *d) { return d->merged_nodes + d->unmerged_nodes; }
@@ -0,0 +1,107 @@
+#pragma once
+#include "tdigest.h"
+
+/**
+ * Exponentially decaying t-digest with fractional weights, for recent-biased quantiles.
+ *
+ * Copyright (c) 2021 Redis, All rights reserved.
+ *
+ * The centroids live in one block with the header, means and double weights in arrays of their
+ * own like those of a histogram, and go through the same node sort and k-scale pass. A decayed
+ * digest is not thread-safe, just like a td_histogram_t.
+ */
+
+// Smallest sample weight of a decayed digest, see td_decay_add().
+#define TD_DECAY_MIN_WEIGHT 1e-3
+
+typedef struct td_decay td_decay_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate and initialise a decayed digest, in which recent samples count more than old ones.
+ *
+ * It uses forward decay: a sample of weight w taken at time ts weighs w * exp(rate * (ts -
+ * landmark)), so queries answer as if every sample had decayed by exp(-rate * age), whatever the
+ * time of the query. Weights are doubles and growing ones are kept in range by moving the landmark
+ * forward now and then, which rescales every centroid in place instead of rebuilding them. The
+ * centroids are merged by the k-scale pass of td_compress(), so memory stays constant, like a
+ * histogram of the same compression.
+ *
+ * @param compression The compression parameter, see td_init().
+ * @param rate The decay rate per unit of time, >= 0. Weights halve every log(2) / rate; 0 gives
+ * a digest with fractional weights that does not decay.
+ * @param landmark The time weights are relative to, in the unit of the timestamps, e.g. the
+ * creation time.
+ * @param result Output parameter to capture the digest, left untouched on failure.
+ * @return 0 on success, 1 if `compression` is invalid (see td_init()), `rate` is negative or
+ * either is not finite, or if allocation failed.
+ */
+int td_decay_init(double compression, double rate, double landmark, td_decay_t **result);
+
+/**
+ * Allocate and initialise a decayed digest.
+ *
+ * @see td_decay_init()
+ * @return the digest on success, NULL on failure.
+ */
+td_decay_t *td_decay_new(double compression, double rate, double landmark);
+
+/**
+ * Frees a decayed digest. Passing NULL is allowed and is a no-op.
+ */
+void td_decay_free(td_decay_t *d);
+
+/**
+ * Adds a sample taken at `ts`. Timestamps need not be ordered.
+ *
+ * Weights count samples. Centroids that decay below TD_DECAY_MIN_WEIGHT samples as of the latest
+ * timestamp seen are dropped on the next compression.
+ *
+ * @return 0 on success, EINVAL if a value is not finite or `weight` is below TD_DECAY_MIN_WEIGHT,
+ * ERANGE if the sample is too old for its weight to be represented, EDOM if the weights
+ * overflowed.
+ */
+int td_decay_add(td_decay_t *d, double ts, double value, double weight);
+
+/**
+ * Merges the buffered samples into the centroids, see td_compress().
+ *
+ * @return 0 on success, EDOM if the weights overflowed.
+ */
+int td_decay_compress(td_decay_t *d);
+
+/**
+ * Returns the quantile of the decayed samples. NAN if the digest is empty or `q` is out of range.
+ *
+ * The ends are interpolated to the smallest and largest samples held, which are not decayed. Once
+ * centroids decay away they are recomputed from the centroids left, whose outermost means then
+ * stand in for the extremes.
+ */
+double td_decay_quantile(td_decay_t *d, double q);
+
+/**
+ * Returns the cdf of the decayed samples at `val`. NAN if the digest is empty.
+ */
+double td_decay_cdf(td_decay_t *d, double val);
+
+/**
+ * Returns the total weight of the samples as seen at time `now`, i.e. decayed up to then.
+ */
+double td_decay_size(const td_decay_t *d, double now);
+
+/**
+ * Returns the current landmark, which td_decay_add() moves forward as weights grow.
+ */
+double td_decay_landmark(const td_decay_t *d);
+
+/**
+ * Returns the number of centroids, buffered samples included.
+ */
+int td_decay_centroid_count(const td_decay_t *d);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,176 @@
+#pragma once
+#include <limits.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "tdigest.h"
+
+/**
+ * Internals of tdigest.c shared with the other modules of the library (td_decay.c). Not part of
+ * the public API: nothing here is stable across releases.
+ *
+ * Copyright (c) 2021 Redis, All rights reserved.
+ */
+
+#define __td_max(x, y) (((x) > (y)) ? (x) : (y))
+#define __td_min(x, y) (((x) < (y)) ? (x) : (y))
+
+// Node-array capacity: room for the merged centroids (compression + 10) plus `buffer_size` slots for
+// unmerged samples.
+static inline uint64_t cap_from_compression_and_buffer(uint64_t compression,
+                                                       uint64_t buffer_size) {
+    return compression + UINT64_C(10) + buffer_size;
+}
+
+// Default buffer of 5*compression slots, i.e. cap = 6*compression + 10.
+static inline uint64_t cap_from_compression(uint64_t compression) {
+    return cap_from_compression_and_buffer(compression, UINT64_C(5) * compression);
+}
+
+static inline int capacity_from_uint64(uint64_t capacity64, size_t *capacity) {
+    if (capacity64 > INT_MAX || capacity64 > SIZE_MAX / sizeof(double) ||
+        capacity64 > SIZE_MAX / sizeof(long long)) {
+        return 1;
+    }
+    *capacity = (size_t)capacity64;
+    return 0;
+}
+
+static inline int valid_compression(double compression) {
+    return isfinite(compression) && compression > 0 && compression <= INT_MAX;
+}
+
+// Validate `compression` and compute the node-array capacity (cap = 6*compression + 10)
+// entirely in 64-bit width, WITHOUT allocating. Factored out of td_init() so the
+// accepted/rejected boundary can be probed in a test without committing tens of GiB of
+// backing storage (at cap ~ INT_MAX the two 8-byte node arrays total ~34 GB / ~32 GiB).
+// Returns 0 and writes *capacity on success; returns 1 on rejection and leaves *capacity
+// untouched. Rejections: non-finite, <= 0, > INT_MAX, or a capacity that would overflow int
+// or a size_t element count for either node array.
+static inline int capacity_from_compression(double compression, size_t *capacity) {
+    if (!valid_compression(compression)) {
+        return 1;
+    }
+    return capacity_from_uint64(cap_from_compression((uint64_t)compression), capacity);
+}
+
+// As capacity_from_compression(), with an explicit unmerged buffer size. Additionally rejects
+// buffer_size <= 0.
+static inline int capacity_from_compression_and_buffer(double compression, int buffer_size,
+                                                       size_t *capacity) {
+    if (!valid_compression(compression) || buffer_size <= 0) {
+        return 1;
+    }
+    return capacity_from_uint64(
+        cap_from_compression_and_buffer((uint64_t)compression, (uint64_t)buffer_size), capacity);
+}
+
+// The compile-time allocator of td_malloc.h, used by histograms created without an allocator.
+extern const td_allocator_t td_default_allocator;
+
+// Sort the inclusive node range [lo, hi] by mean, moving the weights along. Builds with
+// TD_RADIX_SORT defined use the radix backend for large ranges, taking its scratch from `a`, and
+// fall back to the comparison sort if the scratch is unavailable.
+void td_sort_nodes(const td_allocator_t *a, double *means, long long *weights, int lo, int hi);
+
+// Streaming form of the k-scale merge pass: centroids are pushed in ascending mean order and are
+// either folded into the centroid being built or start a new one. Output is written to `mean` /
+// `weight` at index `cur`, which never runs ahead of the number of centroids pushed so far.
+// Weights are either integers (`weight`, histograms) or fractional (`weight_f`, td_decay_t);
+// the other array is NULL.
+struct td_kscale {
+    double *mean;
+    long long *weight;
+    double *weight_f;
+    int cur;
+    double weight_so_far;
+    double total_weight;
+    double normalizer;
+};
+
+static inline void td_kscale_init_layout(struct td_kscale *k, double *mean, long long *weight,
+                                         double *weight_f, double total_weight,
+                                         double normalizer) {
+    k->mean = mean;
+    k->weight = weight;
+    k->weight_f = weight_f;
+    k->cur = -1;
+    k->weight_so_far = 0;
+    k->total_weight = total_weight;
+    k->normalizer = normalizer;
+}
+
+static inline void td_kscale_init(struct td_kscale *k, double *mean, long long *weight,
+                                  double total_weight, double normalizer) {
+    td_kscale_init_layout(k, mean, weight, NULL, total_weight, normalizer);
+}
+
+static inline void td_kscale_init_f(struct td_kscale *k, double *mean, double *weight,
+                                    double total_weight, double normalizer) {
+    td_kscale_init_layout(k, mean, NULL, weight, total_weight, normalizer);
+}
+
+// Whether the centroid being built may grow to `proposed_weight` with `weight_so_far` before it.
+static inline bool td_kscale_fits(double proposed_weight, double weight_so_far,
+                                  double total_weight, double normalizer) {
+    const double z = proposed_weight * normalizer;
+    // quantile up to cur
+    const double q0 = weight_so_far / total_weight;
+    // quantile up to cur + i
+    const double q2 = (weight_so_far + proposed_weight) / total_weight;
+    // Convert  a quantile to the k-scale
+    return (z <= (q0 * (1 - q0))) && (z <= (q2 * (1 - q2)));
+}
+
+static inline double td_kscale_weight(const struct td_kscale *k, const bool fractional, int i) {
+    return fractional ? k->weight_f[i] : (double)k->weight[i];
+}
+
+// One body for both layouts; `fractional` is a constant at every call site, so each caller gets
+// the branch-free push of its own layout. `weight` is the pushed weight as a double and
+// `weight_i` the same weight for the integer layout.
+static inline void td_kscale_push_layout(struct td_kscale *k, const bool fractional, double mean,
+                                         double weight, long long weight_i) {
+    const int cur = k->cur;
+    if (cur < 0) {
+        k->cur = 0;
+        k->mean[0] = mean;
+        if (fractional) {
+            k->weight_f[0] = weight;
+        } else {
+            k->weight[0] = weight_i;
+        }
+        return;
+    }
+    const double proposed_weight = td_kscale_weight(k, fractional, cur) + weight;
+    // next point will fit
+    // so merge into existing centroid
+    if (td_kscale_fits(proposed_weight, k->weight_so_far, k->total_weight, k->normalizer)) {
+        if (fractional) {
+            k->weight_f[cur] = proposed_weight;
+        } else {
+            k->weight[cur] += weight_i;
+        }
+        const double delta = mean - k->mean[cur];
+        const double weighted_delta = (delta * weight) / td_kscale_weight(k, fractional, cur);
+        k->mean[cur] += weighted_delta;
+    } else {
+        k->weight_so_far += td_kscale_weight(k, fractional, cur);
+        k->cur = cur + 1;
+        if (fractional) {
+            k->weight_f[cur + 1] = weight;
+        } else {
+            k->weight[cur + 1] = weight_i;
+        }
+        k->mean[cur + 1] = mean;
+    }
+}
+
+static inline void td_kscale_push(struct td_kscale *k, double mean, long long weight) {
+    td_kscale_push_layout(k, false, mean, (double)weight, weight);
+}
+
+static inline void td_kscale_push_f(struct td_kscale *k, double mean, double weight) {
+    td_kscale_push_layout(k, true, mean, weight, 0);
+}
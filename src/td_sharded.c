@@ -0,0 +1,274 @@
+// pthread types are hidden by the top-level -std=c99 unless a POSIX level is requested
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include "td_sharded.h"
+
+#ifndef TD_MALLOC_INCLUDE
+#define TD_MALLOC_INCLUDE "td_malloc.h"
+#endif
+
+#include TD_MALLOC_INCLUDE
+
+#ifdef _WIN32
+#include <windows.h>
+typedef SRWLOCK td_lock_t;
+#define td_lock_init(l) (InitializeSRWLock(l), 0)
+#define td_lock_destroy(l) ((void)(l))
+#define td_lock_acquire(l) AcquireSRWLockExclusive(l)
+#define td_lock_release(l) ReleaseSRWLockExclusive(l)
+typedef HANDLE td_thread_t;
+#define TD_THREAD_FN(name) static DWORD WINAPI name(LPVOID arg)
+#define TD_THREAD_RETURN return 0
+#define td_thread_create(t, fn, arg) ((*(t) = CreateThread(NULL, 0, fn, arg, 0, NULL)) ? 0 : 1)
+#define td_thread_join(t) (WaitForSingleObject(t, INFINITE), CloseHandle(t))
+#else
+#include <pthread.h>
+typedef pthread_mutex_t td_lock_t;
+#define td_lock_init(l) pthread_mutex_init(l, NULL)
+#define td_lock_destroy(l) pthread_mutex_destroy(l)
+#define td_lock_acquire(l) pthread_mutex_lock(l)
+#define td_lock_release(l) pthread_mutex_unlock(l)
+typedef pthread_t td_thread_t;
+#define TD_THREAD_FN(name) static void *name(void *arg)
+#define TD_THREAD_RETURN return NULL
+#define td_thread_create(t, fn, arg) pthread_create(t, NULL, fn, arg)
+#define td_thread_join(t) pthread_join(t, NULL)
+#endif
+
+#define TD_CACHE_LINE 64
+
+struct td_shard {
+    // keeps the owner's fields off any cache line of the previous allocation
+    char pad[TD_CACHE_LINE];
+    // written by the owner only
+    int staged;
+    double values[TD_SHARD_STAGE];
+    long long weights[TD_SHARD_STAGE];
+    // guards h: taken by the owner when publishing and by readers when merging
+    td_lock_t lock;
+    td_histogram_t *h;
+};
+
+struct td_sharded {
+    int shards;
+    td_shard_t **shard;
+};
+
+static void td_shard_free(td_shard_t *shard) {
+    if (!shard) {
+        return;
+    }
+    td_lock_destroy(&shard->lock);
+    td_free(shard->h);
+    td_free_((void *)shard);
+}
+
+int td_sharded_init(double compression, int shards, td_sharded_t **result) {
+    if (shards <= 0) {
+        return 1;
+    }
+    td_sharded_t *s = (td_sharded_t *)td_malloc_(sizeof(td_sharded_t));
+    if (!s) {
+        return 1;
+    }
+    s->shards = 0;
+    s->shard = (td_shard_t **)td_calloc_((size_t)shards, sizeof(td_shard_t *));
+    if (!s->shard) {
+        td_sharded_free(s);
+        return 1;
+    }
+    for (int i = 0; i < shards; i++) {
+        // each shard is a separate allocation so owners never write to a shared cache line
+        td_shard_t *shard = (td_shard_t *)td_malloc_(sizeof(td_shard_t));
+        if (!shard) {
+            td_sharded_free(s);
+            return 1;
+        }
+        shard->staged = 0;
+        shard->h = NULL;
+        if (td_init(compression, &shard->h) != 0) {
+            td_free_((void *)shard);
+            td_sharded_free(s);
+            return 1;
+        }
+        if (td_lock_init(&shard->lock) != 0) {
+            td_free(shard->h);
+            td_free_((void *)shard);
+            td_sharded_free(s);
+            return 1;
+        }
+        s->shard[i] = shard;
+        s->shards++;
+    }
+    *result = s;
+    return 0;
+}
+
+td_sharded_t *td_sharded_new(double compression, int shards) {
+    td_sharded_t *s = NULL;
+    td_sharded_init(compression, shards, &s);
+    return s;
+}
+
+void td_sharded_free(td_sharded_t *s) {
+    if (!s) {
+        return;
+    }
+    if (s->shard) {
+        for (int i = 0; i < s->shards; i++) {
+            td_shard_free(s->shard[i]);
+        }
+        td_free_((void *)s->shard);
+    }
+    td_free_((void *)s);
+}
+
+int td_sharded_shard_count(const td_sharded_t *s) { return s->shards; }
+
+td_shard_t *td_sharded_shard(td_sharded_t *s, int index) {
+    if (index < 0 || index >= s->shards) {
+        return NULL;
+    }
+    return s->shard[index];
+}
+
+int td_shard_flush(td_shard_t *shard) {
+    if (shard->staged == 0) {
+        return 0;
+    }
+    td_lock_acquire(&shard->lock);
+    const int res = td_add_batch(shard->h, shard->values, shard->weights, (size_t)shard->staged,
+                                 NULL);
+    td_lock_release(&shard->lock);
+    shard->staged = 0;
+    return res;
+}
+
+int td_shard_add(td_shard_t *shard, double val, long long weight) {
+    // reject now rather than at publish time, so the error reaches the caller that caused it
+    if (!isfinite(val)) {
+        return EINVAL;
+    }
+    shard->values[shard->staged] = val;
+    shard->weights[shard->staged] = weight;
+    if (++shard->staged == TD_SHARD_STAGE) {
+        return td_shard_flush(shard);
+    }
+    return 0;
+}
+
+int td_sharded_merge_into(td_sharded_t *s, td_histogram_t *into) {
+    for (int i = 0; i < s->shards; i++) {
+        td_shard_t *shard = s->shard[i];
+        td_lock_acquire(&shard->lock);
+        const int res = td_merge(into, shard->h);
+        td_lock_release(&shard->lock);
+        if (res != 0) {
+            return res;
+        }
+    }
+    return 0;
+}
+
+int td_sharded_snapshot(td_sharded_t *s, td_histogram_t **result) {
+    td_histogram_t *h = NULL;
+    if (td_init(s->shard[0]->h->compression, &h) != 0) {
+        return ENOMEM;
+    }
+    const int res = td_sharded_merge_into(s, h);
+    if (res != 0) {
+        td_free(h);
+        return res;
+    }
+    *result = h;
+    return 0;
+}
+
+// Fewest samples worth a thread of their own in td_build_from_samples().
+#define TD_BUILD_MIN_SLICE 65536
+
+struct td_build_slice {
+    const double *values;
+    size_t n;
+    td_histogram_t *h;
+    int res;
+};
+
+static void td_build_slice_run(struct td_build_slice *slice) {
+    slice->res = td_add_batch_unweighted(slice->h, slice->values, slice->n, NULL);
+}
+
+TD_THREAD_FN(td_build_slice_thread) {
+    td_build_slice_run((struct td_build_slice *)arg);
+    TD_THREAD_RETURN;
+}
+
+// Declared in tdigest.h; lives here for the thread helpers.
+int td_build_from_samples(const double *values, size_t n, double compression, int nthreads,
+                          td_histogram_t **result) {
+    if ((n > 0 && !values) || nthreads <= 0 || !result || td_required_size(compression) == 0) {
+        return EINVAL;
+    }
+    // twice the compression, as long as that is still a valid one
+    const double slice_compression =
+        td_required_size(2 * compression) != 0 ? 2 * compression : compression;
+    size_t slices = (size_t)nthreads;
+    if (slices > n / TD_BUILD_MIN_SLICE) {
+        slices = n / TD_BUILD_MIN_SLICE > 0 ? n / TD_BUILD_MIN_SLICE : 1;
+    }
+    td_histogram_t *h = NULL;
+    if (td_init(compression, &h) != 0) {
+        return ENOMEM;
+    }
+    struct td_build_slice *slice =
+        (struct td_build_slice *)td_calloc_(slices, sizeof(struct td_build_slice));
+    td_histogram_t **locals = (td_histogram_t **)td_calloc_(slices, sizeof(td_histogram_t *));
+    td_thread_t *threads = (td_thread_t *)td_calloc_(slices, sizeof(td_thread_t));
+    int res = slice && locals && threads ? 0 : ENOMEM;
+    for (size_t i = 0; i < slices && res == 0; i++) {
+        const size_t begin = n / slices * i;
+        slice[i].values = values + begin;
+        slice[i].n = i + 1 == slices ? n - begin : n / slices;
+        if (td_init(slice_compression, &slice[i].h) != 0) {
+            res = ENOMEM;
+        }
+        locals[i] = slice[i].h;
+    }
+    // slice 0 runs on the calling thread
+    size_t started = 1;
+    for (; started < slices && res == 0; started++) {
+        if (td_thread_create(&threads[started], td_build_slice_thread, &slice[started]) != 0) {
+            res = ENOMEM;
+            break;
+        }
+    }
+    if (res == 0) {
+        td_build_slice_run(&slice[0]);
+    }
+    for (size_t i = 1; i < started; i++) {
+        td_thread_join(threads[i]);
+    }
+    for (size_t i = 0; i < slices && res == 0; i++) {
+        res = slice[i].res;
+    }
+    if (res == 0) {
+        res = td_merge_many(h, locals, slices);
+    }
+    for (size_t i = 0; slice && i < slices; i++) {
+        td_free(slice[i].h);
+    }
+    td_free_((void *)slice);
+    td_free_((void *)locals);
+    td_free_((void *)threads);
+    if (res != 0) {
+        td_free(h);
+        return res;
+    }
+    *result = h;
+    return 0;
+}
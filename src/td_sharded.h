@@ -0,0 +1,101 @@
+#pragma once
+#include "tdigest.h"
+
+/**
+ * Sharded t-digest for concurrent ingest.
+ *
+ * Copyright (c) 2021 Redis, All rights reserved.
+ *
+ * Each writer thread is handed its own shard once, up front, and adds samples to it without any
+ * shared writes: samples are staged in a per-shard buffer and only published to the shard's
+ * histogram (under a lock private to that shard) when the buffer fills or on td_shard_flush().
+ * Readers combine the published shards with td_merge() semantics.
+ *
+ * Samples still staged in a shard are not visible to readers until its owner publishes them.
+ */
+
+// Samples staged per shard before they are published to the shard's histogram.
+#define TD_SHARD_STAGE 256
+
+typedef struct td_sharded td_sharded_t;
+typedef struct td_shard td_shard_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate and initialise a sharded t-digest.
+ *
+ * @param compression The compression parameter of every shard, see td_init().
+ * @param shards The number of shards, usually the number of writer threads.
+ * @param result Output parameter to capture the sharded digest, left untouched on failure.
+ * @return 0 on success, 1 if `compression` is invalid (see td_init()), `shards` is <= 0, or if
+ * allocation failed.
+ */
+int td_sharded_init(double compression, int shards, td_sharded_t **result);
+
+/**
+ * Allocate and initialise a sharded t-digest.
+ *
+ * @see td_sharded_init()
+ * @return the sharded digest on success, NULL on failure.
+ */
+td_sharded_t *td_sharded_new(double compression, int shards);
+
+/**
+ * Frees a sharded t-digest and all of its shards. No thread may use any of its shards anymore.
+ * Passing NULL is allowed and is a no-op.
+ */
+void td_sharded_free(td_sharded_t *s);
+
+/**
+ * Returns the number of shards.
+ */
+int td_sharded_shard_count(const td_sharded_t *s);
+
+/**
+ * Returns shard `index`, or NULL if it is out of range. A shard must only be written by one
+ * thread at a time; look it up once per writer thread and keep the pointer.
+ */
+td_shard_t *td_sharded_shard(td_sharded_t *s, int index);
+
+/**
+ * Adds a sample to a shard. Only the thread owning the shard may call this.
+ *
+ * The sample is staged without any locking or atomic operation; every TD_SHARD_STAGE samples
+ * the stage is published with td_shard_flush().
+ *
+ * @return 0 on success, EINVAL if `val` is not finite, or the error of the publish it triggered
+ * (see td_shard_flush()).
+ */
+int td_shard_add(td_shard_t *shard, double val, long long weight);
+
+/**
+ * Publishes the staged samples of a shard to its histogram, making them visible to readers. Only
+ * the thread owning the shard may call this.
+ *
+ * @return 0 on success, EDOM if overflow was detected adding a staged weight; the staged samples
+ * from the offending one on are then dropped.
+ */
+int td_shard_flush(td_shard_t *shard);
+
+/**
+ * Merges the published samples of every shard into `into`. Safe to call while the owners keep
+ * adding; each shard is locked only while it is being merged.
+ *
+ * @return 0 on success, EDOM if overflow was detected while merging.
+ */
+int td_sharded_merge_into(td_sharded_t *s, td_histogram_t *into);
+
+/**
+ * Creates a new histogram holding the published samples of every shard.
+ *
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, ENOMEM if allocation failed, EDOM if overflow was detected while merging.
+ */
+int td_sharded_snapshot(td_sharded_t *s, td_histogram_t **result);
+
+#ifdef __cplusplus
+}
+#endif
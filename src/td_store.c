@@ -0,0 +1,515 @@
+// mmap() and posix_madvise() are hidden by the top-level -std=c99 unless a POSIX level is requested
+#ifndef _WIN32
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include "td_store.h"
+
+#ifndef TD_MALLOC_INCLUDE
+#define TD_MALLOC_INCLUDE "td_malloc.h"
+#endif
+
+#include TD_MALLOC_INCLUDE
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Store file layout, in host byte order with every section 8-byte aligned:
+//   header  (TD_STORE_HEADER bytes): uint32 TD_STORE_MAGIC, uint32 TD_STORE_VERSION, then uint64
+//           digest count, bucket count, and the offsets of the entries, buckets, keys and digests
+//   entries (32 bytes each): uint64 key offset, key length, digest offset, digest length
+//   buckets (8 bytes each): open-addressed hash index, the high 32 bits of the key hash in the
+//           upper half and the entry position + 1 in the lower half; 0 marks an empty bucket
+//   keys    all keys back to back, padded to 8 bytes
+//   digests each in the td_view_serialize() layout, whose size is a multiple of 8
+// Offsets are from the start of the file. There are at least twice as many buckets as digests,
+// a power of two, so probes stay short and always reach an empty bucket.
+#define TD_STORE_MAGIC 0x52545354u
+#define TD_STORE_VERSION 1u
+#define TD_STORE_HEADER 64
+
+struct td_store_header {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t count;
+    uint64_t buckets;
+    uint64_t entries_offset;
+    uint64_t buckets_offset;
+    uint64_t keys_offset;
+    uint64_t digests_offset;
+    uint64_t file_size;
+};
+
+struct td_store_entry {
+    uint64_t key_offset;
+    uint64_t key_len;
+    uint64_t digest_offset;
+    uint64_t digest_len;
+};
+
+struct td_store {
+    unsigned char *base;
+    size_t size;
+    size_t count;
+    uint64_t buckets;
+    const struct td_store_entry *entries;
+    const uint64_t *bucket;
+    // histograms of the digests written through td_store_histogram(), allocated on the first one
+    td_histogram_t **written;
+};
+
+// A digest to write: either a histogram, or a layout copied as is from an open store.
+struct td_store_source {
+    const char *key;
+    size_t key_len;
+    td_histogram_t *h;
+    const void *layout;
+    size_t layout_len;
+};
+
+// 64-bit FNV-1a, so the stored index does not depend on the platform.
+static uint64_t td_store_hash(const char *key, size_t key_len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < key_len; i++) {
+        hash ^= (unsigned char)key[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static inline uint64_t td_store_align(uint64_t offset) { return (offset + 7) & ~(uint64_t)7; }
+
+static int td_store_write_sources(const char *path, const struct td_store_source *sources,
+                                  size_t n) {
+    if (n >= UINT32_MAX) {
+        return EINVAL;
+    }
+    uint64_t buckets = 1;
+    while (buckets < 2 * (uint64_t)n) {
+        buckets <<= 1;
+    }
+    struct td_store_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TD_STORE_MAGIC;
+    header.version = TD_STORE_VERSION;
+    header.count = n;
+    header.buckets = buckets;
+    header.entries_offset = TD_STORE_HEADER;
+    header.buckets_offset = header.entries_offset + n * sizeof(struct td_store_entry);
+    header.keys_offset = header.buckets_offset + buckets * sizeof(uint64_t);
+    struct td_store_entry *entries =
+        (struct td_store_entry *)td_malloc_((n ? n : 1) * sizeof(struct td_store_entry));
+    uint64_t *bucket = (uint64_t *)td_calloc_((size_t)buckets, sizeof(uint64_t));
+    if (!entries || !bucket) {
+        td_free_((void *)entries);
+        td_free_((void *)bucket);
+        return ENOMEM;
+    }
+    int res = 0;
+    size_t max_layout = 0;
+    uint64_t offset = header.keys_offset;
+    for (size_t i = 0; i < n && res == 0; i++) {
+        entries[i].key_offset = offset;
+        entries[i].key_len = sources[i].key_len;
+        offset += sources[i].key_len;
+        const uint64_t hash = td_store_hash(sources[i].key, sources[i].key_len);
+        for (uint64_t slot = hash & (buckets - 1);; slot = (slot + 1) & (buckets - 1)) {
+            if (bucket[slot] == 0) {
+                bucket[slot] = (hash & 0xffffffff00000000ULL) | (uint64_t)(i + 1);
+                break;
+            }
+            const size_t other = (size_t)(bucket[slot] & 0xffffffffULL) - 1;
+            if ((bucket[slot] >> 32) == (hash >> 32) &&
+                sources[other].key_len == sources[i].key_len &&
+                (sources[i].key_len == 0 ||
+                 memcmp(sources[other].key, sources[i].key, sources[i].key_len) == 0)) {
+                res = EINVAL;
+                break;
+            }
+        }
+    }
+    const uint64_t keys_end = offset;
+    header.digests_offset = td_store_align(offset);
+    offset = header.digests_offset;
+    for (size_t i = 0; i < n && res == 0; i++) {
+        size_t len = sources[i].layout_len;
+        if (sources[i].h) {
+            len = td_view_serialized_size(sources[i].h);
+            if (len == 0) {
+                res = EDOM;
+            }
+        }
+        entries[i].digest_offset = offset;
+        entries[i].digest_len = len;
+        offset += len;
+        if (len > max_layout) {
+            max_layout = len;
+        }
+    }
+    header.file_size = offset;
+    void *scratch = NULL;
+    if (res == 0 && max_layout > 0) {
+        scratch = td_malloc_(max_layout);
+        if (!scratch) {
+            res = ENOMEM;
+        }
+    }
+    if (res != 0) {
+        td_free_((void *)entries);
+        td_free_((void *)bucket);
+        return res;
+    }
+
+    const size_t path_len = strlen(path);
+    char *tmp_path = (char *)td_malloc_(path_len + 5);
+    if (!tmp_path) {
+        td_free_(scratch);
+        td_free_((void *)entries);
+        td_free_((void *)bucket);
+        return ENOMEM;
+    }
+    memcpy(tmp_path, path, path_len);
+    memcpy(tmp_path + path_len, ".tmp", 5);
+    FILE *f = fopen(tmp_path, "wb");
+    if (!f) {
+        res = errno ? errno : EIO;
+    } else {
+        static const unsigned char padding[8] = {0};
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                  fwrite(padding, 1, TD_STORE_HEADER - sizeof(header), f) ==
+                      TD_STORE_HEADER - sizeof(header) &&
+                  fwrite(entries, sizeof(struct td_store_entry), n, f) == n &&
+                  fwrite(bucket, sizeof(uint64_t), (size_t)buckets, f) == (size_t)buckets;
+        for (size_t i = 0; i < n && ok; i++) {
+            ok = fwrite(sources[i].key, 1, sources[i].key_len, f) == sources[i].key_len;
+        }
+        if (ok) {
+            const size_t pad = (size_t)(header.digests_offset - keys_end);
+            ok = fwrite(padding, 1, pad, f) == pad;
+        }
+        for (size_t i = 0; i < n && ok; i++) {
+            const size_t len = (size_t)entries[i].digest_len;
+            const void *layout = sources[i].layout;
+            if (sources[i].h) {
+                ok = td_view_serialize(sources[i].h, scratch, len, NULL) == 0;
+                layout = scratch;
+            }
+            ok = ok && fwrite(layout, 1, len, f) == len;
+        }
+        if (!ok) {
+            res = ferror(f) && errno ? errno : EIO;
+        }
+        if (fclose(f) != 0 && res == 0) {
+            res = errno ? errno : EIO;
+        }
+        if (res == 0) {
+#ifdef _WIN32
+            // rename() does not replace an existing file on Windows
+            remove(path);
+#endif
+            if (rename(tmp_path, path) != 0) {
+                res = errno ? errno : EIO;
+            }
+        }
+        if (res != 0) {
+            remove(tmp_path);
+        }
+    }
+    td_free_((void *)tmp_path);
+    td_free_(scratch);
+    td_free_((void *)entries);
+    td_free_((void *)bucket);
+    return res;
+}
+
+int td_store_write(const char *path, const char *const *keys, const size_t *key_lens,
+                   td_histogram_t *const *digests, size_t n) {
+    if (!path || (n > 0 && (!keys || !digests))) {
+        return EINVAL;
+    }
+    struct td_store_source *sources =
+        (struct td_store_source *)td_malloc_((n ? n : 1) * sizeof(struct td_store_source));
+    if (!sources) {
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!keys[i] || !digests[i]) {
+            td_free_((void *)sources);
+            return EINVAL;
+        }
+        sources[i].key = keys[i];
+        sources[i].key_len = key_lens ? key_lens[i] : strlen(keys[i]);
+        sources[i].h = digests[i];
+        sources[i].layout = NULL;
+        sources[i].layout_len = 0;
+    }
+    const int res = td_store_write_sources(path, sources, n);
+    td_free_((void *)sources);
+    return res;
+}
+
+static void td_store_unmap(unsigned char *base, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    td_free_((void *)base);
+#else
+    if (size > 0) {
+        munmap(base, size);
+    }
+#endif
+}
+
+// Maps (or on Windows reads) the whole file.
+static int td_store_map(const char *path, unsigned char **base, size_t *size) {
+#ifdef _WIN32
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return errno ? errno : EIO;
+    }
+    long len = -1;
+    if (fseek(f, 0, SEEK_END) == 0) {
+        len = ftell(f);
+    }
+    if (len < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return EIO;
+    }
+    unsigned char *buf = (unsigned char *)td_malloc_(len > 0 ? (size_t)len : 1);
+    if (!buf) {
+        fclose(f);
+        return ENOMEM;
+    }
+    if (fread(buf, 1, (size_t)len, f) != (size_t)len) {
+        fclose(f);
+        td_free_((void *)buf);
+        return EIO;
+    }
+    fclose(f);
+    *base = buf;
+    *size = (size_t)len;
+    return 0;
+#else
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return errno;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int res = errno;
+        close(fd);
+        return res;
+    }
+    if (st.st_size < TD_STORE_HEADER || (uint64_t)st.st_size > SIZE_MAX) {
+        close(fd);
+        return EINVAL;
+    }
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    const int res = map == MAP_FAILED ? errno : 0;
+    // the mapping keeps the file alive
+    close(fd);
+    if (res != 0) {
+        return res;
+    }
+    // lookups touch a few scattered pages each, so read-ahead would only waste I/O
+    posix_madvise(map, (size_t)st.st_size, POSIX_MADV_RANDOM);
+    *base = (unsigned char *)map;
+    *size = (size_t)st.st_size;
+    return 0;
+#endif
+}
+
+int td_store_open(const char *path, td_store_t **result) {
+    if (!path || !result) {
+        return EINVAL;
+    }
+    unsigned char *base = NULL;
+    size_t size = 0;
+    const int map_res = td_store_map(path, &base, &size);
+    if (map_res != 0) {
+        return map_res;
+    }
+    struct td_store_header header;
+    if (size >= TD_STORE_HEADER) {
+        memcpy(&header, base, sizeof(header));
+    }
+    // only the header is checked here; entries are bounds-checked when they are looked up
+    if (size < TD_STORE_HEADER || header.magic != TD_STORE_MAGIC ||
+        header.version != TD_STORE_VERSION || header.file_size != size ||
+        header.count >= UINT32_MAX || header.buckets <= header.count ||
+        (header.buckets & (header.buckets - 1)) != 0 || header.entries_offset != TD_STORE_HEADER ||
+        header.buckets_offset !=
+            header.entries_offset + header.count * sizeof(struct td_store_entry) ||
+        header.buckets_offset > size ||
+        header.buckets > (size - header.buckets_offset) / sizeof(uint64_t) ||
+        header.keys_offset != header.buckets_offset + header.buckets * sizeof(uint64_t)) {
+        td_store_unmap(base, size);
+        return EINVAL;
+    }
+    td_store_t *s = (td_store_t *)td_malloc_(sizeof(td_store_t));
+    if (!s) {
+        td_store_unmap(base, size);
+        return ENOMEM;
+    }
+    s->base = base;
+    s->size = size;
+    s->count = (size_t)header.count;
+    s->buckets = header.buckets;
+    s->entries = (const struct td_store_entry *)(base + header.entries_offset);
+    s->bucket = (const uint64_t *)(base + header.buckets_offset);
+    s->written = NULL;
+    *result = s;
+    return 0;
+}
+
+void td_store_close(td_store_t *s) {
+    if (!s) {
+        return;
+    }
+    if (s->written) {
+        for (size_t i = 0; i < s->count; i++) {
+            td_free(s->written[i]);
+        }
+        td_free_((void *)s->written);
+    }
+    td_store_unmap(s->base, s->size);
+    td_free_((void *)s);
+}
+
+size_t td_store_count(const td_store_t *s) { return s->count; }
+
+int td_store_key(const td_store_t *s, size_t index, const char **key, size_t *key_len) {
+    if (index >= s->count) {
+        return EINVAL;
+    }
+    const struct td_store_entry *e = &s->entries[index];
+    if (e->key_offset > s->size || e->key_len > s->size - e->key_offset) {
+        return EINVAL;
+    }
+    *key = (const char *)(s->base + e->key_offset);
+    *key_len = (size_t)e->key_len;
+    return 0;
+}
+
+int td_store_find(const td_store_t *s, const char *key, size_t key_len, size_t *index) {
+    if (!s || (!key && key_len > 0) || !index) {
+        return EINVAL;
+    }
+    const uint64_t hash = td_store_hash(key, key_len);
+    const uint64_t mask = s->buckets - 1;
+    uint64_t slot = hash & mask;
+    // a corrupt index could be full, so give up after one lap
+    for (uint64_t probes = 0; probes < s->buckets; probes++, slot = (slot + 1) & mask) {
+        const uint64_t b = s->bucket[slot];
+        if (b == 0) {
+            return ENOENT;
+        }
+        if ((b >> 32) != (hash >> 32)) {
+            continue;
+        }
+        const size_t candidate = (size_t)(b & 0xffffffffULL) - 1;
+        const char *stored;
+        size_t stored_len;
+        if (td_store_key(s, candidate, &stored, &stored_len) != 0) {
+            return EINVAL;
+        }
+        if (stored_len == key_len && (key_len == 0 || memcmp(stored, key, key_len) == 0)) {
+            *index = candidate;
+            return 0;
+        }
+    }
+    return EINVAL;
+}
+
+int td_store_view(const td_store_t *s, size_t index, td_view_t *v) {
+    if (index >= s->count) {
+        return EINVAL;
+    }
+    const struct td_store_entry *e = &s->entries[index];
+    if (e->digest_offset > s->size || e->digest_len > s->size - e->digest_offset) {
+        return EINVAL;
+    }
+    return td_view_open(v, s->base + e->digest_offset, (size_t)e->digest_len);
+}
+
+int td_store_histogram(td_store_t *s, size_t index, td_histogram_t **result) {
+    if (index >= s->count || !result) {
+        return EINVAL;
+    }
+    if (s->written && s->written[index]) {
+        *result = s->written[index];
+        return 0;
+    }
+    td_view_t v;
+    const int view_res = td_store_view(s, index, &v);
+    if (view_res != 0) {
+        return view_res;
+    }
+    if (!s->written) {
+        s->written = (td_histogram_t **)td_calloc_(s->count, sizeof(td_histogram_t *));
+        if (!s->written) {
+            return ENOMEM;
+        }
+    }
+    const int res = td_view_expand(&v, &s->written[index]);
+    if (res != 0) {
+        return res;
+    }
+    *result = s->written[index];
+    return 0;
+}
+
+double td_store_quantile(td_store_t *s, size_t index, double q) {
+    if (index < s->count && s->written && s->written[index]) {
+        return td_quantile(s->written[index], q);
+    }
+    td_view_t v;
+    if (td_store_view(s, index, &v) != 0) {
+        return NAN;
+    }
+    return td_view_quantile(&v, q);
+}
+
+double td_store_cdf(td_store_t *s, size_t index, double x) {
+    if (index < s->count && s->written && s->written[index]) {
+        return td_cdf(s->written[index], x);
+    }
+    td_view_t v;
+    if (td_store_view(s, index, &v) != 0) {
+        return NAN;
+    }
+    return td_view_cdf(&v, x);
+}
+
+int td_store_save(td_store_t *s, const char *path) {
+    if (!s || !path) {
+        return EINVAL;
+    }
+    struct td_store_source *sources = (struct td_store_source *)td_malloc_(
+        (s->count ? s->count : 1) * sizeof(struct td_store_source));
+    if (!sources) {
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < s->count; i++) {
+        struct td_store_source *src = &sources[i];
+        td_view_t v;
+        if (td_store_key(s, i, &src->key, &src->key_len) != 0 || td_store_view(s, i, &v) != 0) {
+            td_free_((void *)sources);
+            return EINVAL;
+        }
+        src->h = s->written ? s->written[i] : NULL;
+        src->layout = s->base + s->entries[i].digest_offset;
+        src->layout_len = (size_t)s->entries[i].digest_len;
+    }
+    const int res = td_store_write_sources(path, sources, s->count);
+    td_free_((void *)sources);
+    return res;
+}
@@ -0,0 +1,132 @@
+#pragma once
+#include "tdigest.h"
+
+/**
+ * Digest store: a single file holding many compressed t-digests under byte-string keys.
+ *
+ * Copyright (c) 2021 Redis, All rights reserved.
+ *
+ * The file holds a hash index from key to digest, followed by every digest in the view layout of
+ * td_view_serialize(). td_store_open() maps the file and checks only its header, so opening
+ * takes constant time however many digests it holds. A lookup probes the stored index and a query
+ * runs on the mapped digest in place; only the pages touched are read from disk.
+ *
+ * A digest is copied into a full td_histogram_t the first time it is written (see
+ * td_store_histogram()); queries on it then see the writes, and td_store_save() writes them out.
+ *
+ * Like a td_view_t, a store file is trusted: opening it and querying its digests checks only the
+ * headers, and a digest's centroids are checked only once it is copied into a histogram. Do not
+ * open files that may have been tampered with.
+ *
+ * The file is in host byte order and is rejected on a host of the other byte order. Reads
+ * (td_store_find(), td_store_view(), queries on entries never written) may run from several threads
+ * at once; td_store_histogram() and td_store_save() need exclusive access to the store.
+ */
+
+typedef struct td_store td_store_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Writes a store file holding `n` digests.
+ *
+ * The file is written under a temporary name next to `path` and renamed over it once complete,
+ * so a store opened from `path` keeps reading the previous file.
+ *
+ * @param path Path of the store file.
+ * @param keys The keys, one per digest; all distinct.
+ * @param key_lens The key lengths, or NULL if the keys are NUL-terminated strings.
+ * @param digests The digests; each is compressed first but otherwise unchanged.
+ * @param n The number of digests.
+ * @return 0 on success, EINVAL if an array is NULL while `n` > 0, a key is repeated or there are
+ * UINT32_MAX or more digests, EDOM if compressing a digest overflowed, ENOMEM if allocation
+ * failed, or the errno of a failed file operation.
+ */
+int td_store_write(const char *path, const char *const *keys, const size_t *key_lens,
+                   td_histogram_t *const *digests, size_t n);
+
+/**
+ * Opens a store file written by td_store_write() or td_store_save(). The file is mapped
+ * read-only; nothing is read or decoded until a digest is looked up.
+ *
+ * @param path Path of the store file.
+ * @param result Output parameter to capture the store, left untouched on failure.
+ * @return 0 on success, EINVAL if an argument is NULL or the file is not a store of this format
+ * version, ENOMEM if allocation failed, or the errno of a failed file operation.
+ */
+int td_store_open(const char *path, td_store_t **result);
+
+/**
+ * Unmaps a store and frees the histograms of the digests written through it. Passing NULL is
+ * allowed and is a no-op.
+ */
+void td_store_close(td_store_t *s);
+
+/**
+ * Returns the number of digests in a store.
+ */
+size_t td_store_count(const td_store_t *s);
+
+/**
+ * Looks a key up in the stored index.
+ *
+ * @param index Output parameter for the position of the digest, in [0, td_store_count(s)).
+ * @return 0 on success, EINVAL if an argument is NULL or the index is corrupt, ENOENT if the key
+ * is not in the store.
+ */
+int td_store_find(const td_store_t *s, const char *key, size_t key_len, size_t *index);
+
+/**
+ * Returns the key of the digest at `index`. The key points into the mapped file and is not
+ * NUL-terminated.
+ *
+ * @return 0 on success, EINVAL if `index` is out of range or the entry is corrupt.
+ */
+int td_store_key(const td_store_t *s, size_t index, const char **key, size_t *key_len);
+
+/**
+ * Wraps the digest at `index`, as it is stored in the file, in a td_view_t. The view points into
+ * the mapped file and stays valid until the store is closed; it does not see writes made through
+ * td_store_histogram().
+ *
+ * @return 0 on success, EINVAL if `index` is out of range or the entry is corrupt.
+ */
+int td_store_view(const td_store_t *s, size_t index, td_view_t *v);
+
+/**
+ * Returns a writable histogram for the digest at `index`, copying it out of the file on the first
+ * call. Later calls return the same histogram, which the store owns and frees on td_store_close().
+ *
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, EINVAL if `index` is out of range or the entry is corrupt, ENOMEM if
+ * allocation failed.
+ */
+int td_store_histogram(td_store_t *s, size_t index, td_histogram_t **result);
+
+/**
+ * td_quantile() of the digest at `index`, including any writes made through
+ * td_store_histogram(). Returns NAN if `index` is out of range or the entry is corrupt.
+ */
+double td_store_quantile(td_store_t *s, size_t index, double q);
+
+/**
+ * td_cdf() of the digest at `index`, including any writes made through td_store_histogram().
+ * Returns NAN if `index` is out of range or the entry is corrupt.
+ */
+double td_store_cdf(td_store_t *s, size_t index, double x);
+
+/**
+ * Writes every digest of a store, including the writes made through td_store_histogram(), to a
+ * new store file. Digests never written are copied from the mapped file as they are. `path` may
+ * be the path the store was opened from.
+ *
+ * @return 0 on success, EINVAL if an entry is corrupt, EDOM if compressing a digest overflowed,
+ * ENOMEM if allocation failed, or the errno of a failed file operation.
+ */
+int td_store_save(td_store_t *s, const char *path);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,197 @@
+#include <errno.h>
+#include <math.h>
+#include <stdbool.h>
+#include "td_window.h"
+
+#ifndef TD_MALLOC_INCLUDE
+#define TD_MALLOC_INCLUDE "td_malloc.h"
+#endif
+
+#include TD_MALLOC_INCLUDE
+
+struct td_window {
+    int intervals;
+    long long width;
+    // number of the current interval, floor(ts / width); set by the first timestamp seen
+    long long current;
+    bool started;
+    // interval k lives in slot[k mod intervals]
+    td_histogram_t **slot;
+    // the closed intervals, oldest first, handed to td_merge_many()
+    td_histogram_t **closed_list;
+    // merge of the closed intervals, up to date while closed_valid
+    td_histogram_t *closed;
+    bool closed_valid;
+    // merge of closed and the current interval, up to date while merged_valid
+    td_histogram_t *merged;
+    bool merged_valid;
+};
+
+static inline long long td_window_interval(const td_window_t *w, long long ts) {
+    long long interval = ts / w->width;
+    // rounds towards minus infinity, also for negative timestamps
+    if (ts % w->width != 0 && ts < 0) {
+        interval--;
+    }
+    return interval;
+}
+
+static inline td_histogram_t *td_window_slot(const td_window_t *w, long long interval) {
+    long long pos = interval % w->intervals;
+    if (pos < 0) {
+        pos += w->intervals;
+    }
+    return w->slot[pos];
+}
+
+int td_window_init(double compression, int intervals, long long interval_width,
+                   td_window_t **result) {
+    if (intervals <= 0 || interval_width <= 0) {
+        return 1;
+    }
+    td_window_t *w = (td_window_t *)td_malloc_(sizeof(td_window_t));
+    if (!w) {
+        return 1;
+    }
+    w->intervals = 0;
+    w->width = interval_width;
+    w->current = 0;
+    w->started = false;
+    w->closed = NULL;
+    w->closed_valid = false;
+    w->merged = NULL;
+    w->merged_valid = false;
+    w->closed_list = NULL;
+    w->slot = (td_histogram_t **)td_calloc_((size_t)intervals, sizeof(td_histogram_t *));
+    if (!w->slot) {
+        td_window_free(w);
+        return 1;
+    }
+    w->closed_list = (td_histogram_t **)td_calloc_((size_t)intervals, sizeof(td_histogram_t *));
+    if (!w->closed_list || td_init(compression, &w->closed) != 0 ||
+        td_init(compression, &w->merged) != 0) {
+        td_window_free(w);
+        return 1;
+    }
+    for (int i = 0; i < intervals; i++) {
+        if (td_init(compression, &w->slot[i]) != 0) {
+            td_window_free(w);
+            return 1;
+        }
+        w->intervals++;
+    }
+    *result = w;
+    return 0;
+}
+
+td_window_t *td_window_new(double compression, int intervals, long long interval_width) {
+    td_window_t *w = NULL;
+    td_window_init(compression, intervals, interval_width, &w);
+    return w;
+}
+
+void td_window_free(td_window_t *w) {
+    if (!w) {
+        return;
+    }
+    if (w->slot) {
+        for (int i = 0; i < w->intervals; i++) {
+            td_free(w->slot[i]);
+        }
+        td_free_((void *)w->slot);
+    }
+    td_free_((void *)w->closed_list);
+    td_free(w->closed);
+    td_free(w->merged);
+    td_free_((void *)w);
+}
+
+void td_window_advance(td_window_t *w, long long ts) {
+    const long long interval = td_window_interval(w, ts);
+    if (!w->started) {
+        w->started = true;
+        w->current = interval;
+        return;
+    }
+    if (interval <= w->current) {
+        return;
+    }
+    // the intervals entering the window take the slots of the ones falling out of it; past a
+    // whole window's worth every slot is recycled once
+    const unsigned long long steps = (unsigned long long)interval - (unsigned long long)w->current;
+    const int recycled = steps < (unsigned long long)w->intervals ? (int)steps : w->intervals;
+    for (int i = 1; i <= recycled; i++) {
+        td_reset(td_window_slot(w, interval - recycled + i));
+    }
+    w->current = interval;
+    w->closed_valid = false;
+    w->merged_valid = false;
+}
+
+int td_window_add(td_window_t *w, long long ts, double value) {
+    // an invalid sample does not move the window
+    if (!isfinite(value)) {
+        return EINVAL;
+    }
+    td_window_advance(w, ts);
+    const long long interval = td_window_interval(w, ts);
+    if ((unsigned long long)w->current - (unsigned long long)interval >=
+        (unsigned long long)w->intervals) {
+        return ERANGE;
+    }
+    const int res = td_add(td_window_slot(w, interval), value, 1);
+    if (res != 0) {
+        return res;
+    }
+    w->merged_valid = false;
+    if (interval != w->current) {
+        w->closed_valid = false;
+    }
+    return 0;
+}
+
+// Brings the merge of the live intervals up to date; NULL if merging overflowed.
+static td_histogram_t *td_window_merge(td_window_t *w) {
+    if (!w->closed_valid) {
+        td_reset(w->closed);
+        const int n = w->intervals - 1;
+        for (int i = 0; i < n; i++) {
+            w->closed_list[i] = td_window_slot(w, w->current - n + i);
+        }
+        if (td_merge_many(w->closed, w->closed_list, (size_t)n) != 0) {
+            return NULL;
+        }
+        w->closed_valid = true;
+        w->merged_valid = false;
+    }
+    td_histogram_t *current = td_window_slot(w, w->current);
+    if (td_size(current) == 0) {
+        return w->closed;
+    }
+    if (!w->merged_valid) {
+        td_reset(w->merged);
+        if (td_merge(w->merged, w->closed) != 0 || td_merge(w->merged, current) != 0) {
+            return NULL;
+        }
+        w->merged_valid = true;
+    }
+    return w->merged;
+}
+
+double td_window_quantile(td_window_t *w, double q) {
+    td_histogram_t *h = td_window_merge(w);
+    return h ? td_quantile(h, q) : NAN;
+}
+
+double td_window_cdf(td_window_t *w, double val) {
+    td_histogram_t *h = td_window_merge(w);
+    return h ? td_cdf(h, val) : NAN;
+}
+
+long long td_window_size(const td_window_t *w) {
+    long long size = 0;
+    for (int i = 0; i < w->intervals; i++) {
+        size += td_size(w->slot[i]);
+    }
+    return size;
+}
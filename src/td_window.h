@@ -0,0 +1,88 @@
+#pragma once
+#include "tdigest.h"
+
+/**
+ * Sliding time-window t-digest, e.g. "p99 over the last 60 seconds".
+ *
+ * Copyright (c) 2021 Redis, All rights reserved.
+ *
+ * Time is cut into intervals of a fixed width and the window is a ring of one histogram per
+ * interval: the current interval, which takes the new samples, and the closed ones before it.
+ * When time moves past the current interval the oldest intervals are recycled with td_reset(),
+ * so once created a window never allocates. Queries merge the live intervals; the merge of the
+ * closed ones is cached until an interval closes or a late sample lands in a closed one, so a
+ * query usually merges only the current interval on top of the cache.
+ *
+ * Timestamps are plain integers in any unit (seconds, milliseconds, ...) shared with the interval
+ * width. A window is not thread-safe, just like a td_histogram_t.
+ */
+
+typedef struct td_window td_window_t;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate and initialise a sliding window.
+ *
+ * @param compression The compression parameter of every interval and of the merges, see
+ * td_init().
+ * @param intervals The number of intervals in the window, current one included.
+ * @param interval_width The width of an interval, in the unit of the timestamps. A window of 60
+ * seconds in 1-second steps is 60 intervals of width 1000 with millisecond timestamps.
+ * @param result Output parameter to capture the window, left untouched on failure.
+ * @return 0 on success, 1 if `compression` is invalid (see td_init()), `intervals` or
+ * `interval_width` is <= 0, or if allocation failed.
+ */
+int td_window_init(double compression, int intervals, long long interval_width,
+                   td_window_t **result);
+
+/**
+ * Allocate and initialise a sliding window.
+ *
+ * @see td_window_init()
+ * @return the window on success, NULL on failure.
+ */
+td_window_t *td_window_new(double compression, int intervals, long long interval_width);
+
+/**
+ * Frees a window and its histograms. Passing NULL is allowed and is a no-op.
+ */
+void td_window_free(td_window_t *w);
+
+/**
+ * Moves the window forward to the interval holding `ts`, dropping the intervals that fall out of
+ * it. Earlier timestamps leave the window where it is. td_window_add() does this on its own; call
+ * it to expire old samples while no new ones arrive.
+ */
+void td_window_advance(td_window_t *w, long long ts);
+
+/**
+ * Adds a sample taken at `ts` to the window, first moving the window forward if `ts` is past the
+ * current interval. A late sample goes to the closed interval holding it.
+ *
+ * @return 0 on success, ERANGE if `ts` is older than the window, or the error of td_add().
+ */
+int td_window_add(td_window_t *w, long long ts, double value);
+
+/**
+ * Returns the quantile of the samples in the window, see td_quantile(). NAN if the window is
+ * empty or `q` is out of range.
+ */
+double td_window_quantile(td_window_t *w, double q);
+
+/**
+ * Returns the cdf of the samples in the window at `val`, see td_cdf(). NAN if the window is
+ * empty.
+ */
+double td_window_cdf(td_window_t *w, double val);
+
+/**
+ * Returns the total weight of the samples in the window.
+ */
+long long td_window_size(const td_window_t *w);
+
+#ifdef __cplusplus
+}
+#endif
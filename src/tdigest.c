@@ -3,9 +3,11 @@
 #include <string.h>
 #include <math.h>
 #include "tdigest.h"
+#include "td_internal.h"
 #include <errno.h>
 #include <limits.h>
 #include <stdint.h>
+#include <float.h>
 
 #ifndef TD_MALLOC_INCLUDE
 #define TD_MALLOC_INCLUDE "td_malloc.h"
@@ -13,8 +15,28 @@
 
 #include TD_MALLOC_INCLUDE
 
-#define __td_max(x, y) (((x) > (y)) ? (x) : (y))
-#define __td_min(x, y) (((x) < (y)) ? (x) : (y))
+static void *td_default_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    return td_malloc_(size);
+}
+
+static void td_default_release(void *ctx, void *ptr) {
+    (void)ctx;
+    td_free_(ptr);
+}
+
+const td_allocator_t td_default_allocator = {td_default_alloc, td_default_release, NULL};
+
+static inline void *td_alloc(const td_allocator_t *a, size_t size) {
+    return a->alloc(a->ctx, size);
+}
+
+// NULL-safe; a NULL release hook leaves the memory to the allocator (an arena reset as a whole).
+static inline void td_release(const td_allocator_t *a, void *ptr) {
+    if (ptr && a->release) {
+        a->release(a->ctx, ptr);
+    }
+}
 
 static inline double weighted_average_sorted(double x1, double w1, double x2, double w2) {
     const double x = (x1 * w1 + x2 * w2) / (w1 + w2);
@@ -54,11 +76,14 @@ static void inline swap_l(long long *arr, int i, int j) {
 #ifdef TD_INSTRUMENT_SORT
 unsigned long long td_sort_comparisons = 0;
 unsigned long long td_sort_heap_fallbacks = 0;
+unsigned long long td_sort_radix_moves = 0;
 #define TD_SORT_CMP() (++td_sort_comparisons)
 #define TD_SORT_FALLBACK() (++td_sort_heap_fallbacks)
+#define TD_SORT_RADIX_MOVES(n) (td_sort_radix_moves += (n))
 #else
 #define TD_SORT_CMP() ((void)0)
 #define TD_SORT_FALLBACK() ((void)0)
+#define TD_SORT_RADIX_MOVES(n) ((void)0)
 #endif
 
 // Counted key comparison `a < b`. Keeping the counter inside a dedicated helper (instead of a
@@ -220,35 +245,134 @@ static void td_qsort(double *means, long long *weights, unsigned int lo_u, unsig
     td_introsort(means, weights, lo, hi, depth_limit);
 }
 
-static inline uint64_t cap_from_compression(uint64_t compression) {
-    return (UINT64_C(6) * compression) + UINT64_C(10);
+// Order-preserving map from a double's bit pattern to uint64: flipping the sign bit of
+// non-negative values and all bits of negative ones makes unsigned integer order match numeric
+// order (-0.0 sorts just before +0.0). Its inverse is td_key_to_double().
+static inline uint64_t td_double_to_key(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return (bits & UINT64_C(0x8000000000000000)) ? ~bits : bits | UINT64_C(0x8000000000000000);
 }
 
-// Validate `compression` and compute the node-array capacity (cap = 6*compression + 10)
-// entirely in 64-bit width, WITHOUT allocating. Factored out of td_init() so the
-// accepted/rejected boundary can be probed in a test without committing tens of GiB of
-// backing storage (at cap ~ INT_MAX the two 8-byte node arrays total ~34 GB / ~32 GiB).
-// Returns 0 and writes *capacity on success; returns 1 on rejection and leaves *capacity
-// untouched. Rejections: non-finite, <= 0, > INT_MAX, or a capacity that would overflow int
-// or a size_t element count for either node array.
-static inline int capacity_from_compression(double compression, size_t *capacity) {
-    if (!isfinite(compression) || compression <= 0 || compression > INT_MAX) {
-        return 1;
+static inline double td_key_to_double(uint64_t key) {
+    const uint64_t bits =
+        (key & UINT64_C(0x8000000000000000)) ? key & ~UINT64_C(0x8000000000000000) : ~key;
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+#define TD_RADIX_BITS 8
+#define TD_RADIX_BUCKETS (1 << TD_RADIX_BITS)
+#define TD_RADIX_PASSES (64 / TD_RADIX_BITS)
+
+/**
+ * LSD radix sort of the inclusive range [lo, hi] over two parallel arrays keyed on `means`
+ * (weights permuted in lock-step), using the order-preserving uint64 image of each mean as the
+ * key. O(n) and branch-free per element: one pass builds all digit histograms, then each 8-bit
+ * digit is scattered in turn. Digits shared by every key (common for clustered samples, and all
+ * of them for an all-duplicates buffer) are skipped. Stable, so equal means keep their buffer
+ * order.
+ *
+ * Needs an n-element scratch copy of both arrays; returns 1 without touching the input if it
+ * cannot be allocated, so the caller can fall back to td_qsort().
+ */
+static int td_radix_sort(const td_allocator_t *a, double *means, long long *weights, int lo,
+                         int hi) {
+    const size_t n = (size_t)(hi - lo + 1);
+    if (n < 2) {
+        return 0;
     }
-    const uint64_t capacity64 = cap_from_compression((uint64_t)compression);
-    if (capacity64 > INT_MAX || capacity64 > SIZE_MAX / sizeof(double) ||
-        capacity64 > SIZE_MAX / sizeof(long long)) {
+    uint64_t *keys = (uint64_t *)td_alloc(a, n * sizeof(uint64_t));
+    uint64_t *keys_tmp = (uint64_t *)td_alloc(a, n * sizeof(uint64_t));
+    long long *weights_tmp = (long long *)td_alloc(a, n * sizeof(long long));
+    if (!keys || !keys_tmp || !weights_tmp) {
+        td_release(a, keys);
+        td_release(a, keys_tmp);
+        td_release(a, weights_tmp);
         return 1;
     }
-    *capacity = (size_t)capacity64;
+    size_t counts[TD_RADIX_PASSES][TD_RADIX_BUCKETS];
+    memset(counts, 0, sizeof(counts));
+    for (size_t i = 0; i < n; i++) {
+        const uint64_t key = td_double_to_key(means[lo + i]);
+        keys[i] = key;
+        for (int p = 0; p < TD_RADIX_PASSES; p++) {
+            counts[p][(key >> (p * TD_RADIX_BITS)) & (TD_RADIX_BUCKETS - 1)]++;
+        }
+    }
+    uint64_t *src_k = keys;
+    uint64_t *dst_k = keys_tmp;
+    long long *src_w = weights + lo;
+    long long *dst_w = weights_tmp;
+    for (int p = 0; p < TD_RADIX_PASSES; p++) {
+        const int shift = p * TD_RADIX_BITS;
+        if (counts[p][(src_k[0] >> shift) & (TD_RADIX_BUCKETS - 1)] == n) {
+            continue; // every key shares this digit
+        }
+        size_t offsets[TD_RADIX_BUCKETS];
+        size_t sum = 0;
+        for (int d = 0; d < TD_RADIX_BUCKETS; d++) {
+            offsets[d] = sum;
+            sum += counts[p][d];
+        }
+        for (size_t i = 0; i < n; i++) {
+            const size_t slot = offsets[(src_k[i] >> shift) & (TD_RADIX_BUCKETS - 1)]++;
+            dst_k[slot] = src_k[i];
+            dst_w[slot] = src_w[i];
+        }
+        TD_SORT_RADIX_MOVES(n);
+        uint64_t *const tk = src_k;
+        src_k = dst_k;
+        dst_k = tk;
+        long long *const tw = src_w;
+        src_w = dst_w;
+        dst_w = tw;
+    }
+    for (size_t i = 0; i < n; i++) {
+        means[lo + i] = td_key_to_double(src_k[i]);
+    }
+    if (src_w != weights + lo) {
+        memcpy(weights + lo, src_w, n * sizeof(long long));
+    }
+    td_release(a, keys);
+    td_release(a, keys_tmp);
+    td_release(a, weights_tmp);
     return 0;
 }
 
+// Smallest range handed to td_radix_sort(); below it the fixed per-pass cost outweighs the
+// O(n log n) comparison sort.
+#ifndef TD_RADIX_THRESHOLD
+#define TD_RADIX_THRESHOLD 256
+#endif
+
+#ifdef TD_RADIX_SORT
+#define TD_USE_RADIX_SORT 1
+#else
+#define TD_USE_RADIX_SORT 0
+#endif
+
+void td_sort_nodes(const td_allocator_t *a, double *means, long long *weights, int lo, int hi) {
+    if (TD_USE_RADIX_SORT && hi - lo + 1 >= TD_RADIX_THRESHOLD &&
+        td_radix_sort(a, means, weights, lo, hi) == 0) {
+        return;
+    }
+    td_qsort(means, weights, (unsigned int)lo, (unsigned int)hi);
+}
+
+// Free slots td_compress() needs past the buffer to park a copy of the merged prefix, so that it
+// only has to sort the buffer and can then merge the two sorted runs linearly. Only reserved while
+// the prefix is small relative to cap; otherwise td_compress() sorts the whole range instead.
+static inline int merge_reserve(const td_histogram_t *h) {
+    return h->merged_nodes <= h->cap / 4 ? h->merged_nodes : 0;
+}
+
 static inline bool should_td_compress(td_histogram_t *h) {
-    return ((h->merged_nodes + h->unmerged_nodes) >= (h->cap - 1));
+    return ((h->merged_nodes + h->unmerged_nodes + merge_reserve(h)) >= (h->cap - 1));
 }
 
-static inline int next_node(td_histogram_t *h) { return h->merged_nodes + h->unmerged_nodes; }
+static inline int next_node(const td_histogram_t *h) { return h->merged_nodes + h->unmerged_nodes; }
 
 int td_compress(td_histogram_t *h);
 
@@ -277,6 +401,26 @@ static inline int _check_td_overflow(const double new_unmerged_weight,
     return 0;
 }
 
+// Probes per lookup in the TD_COLLAPSE_DUPLICATES table before a sample is buffered unrecorded.
+#define TD_RECENT_PROBES 8
+
+// log2 of the slot count of the TD_COLLAPSE_DUPLICATES table: the smallest power of two >= cap,
+// so the load factor stays below one even when every buffered node is distinct.
+static inline int td_recent_bits(const td_histogram_t *h) {
+    int bits = 4;
+    while (bits < 30 && (1 << bits) < h->cap) {
+        bits++;
+    }
+    return bits;
+}
+
+// Forget every recorded node; called whenever the buffer is emptied.
+static inline void td_recent_clear(td_histogram_t *h) {
+    if (h->recent_nodes) {
+        memset(h->recent_nodes, 0xff, ((size_t)1 << h->recent_bits) * sizeof(int));
+    }
+}
+
 int td_centroid_count(td_histogram_t *h) { return next_node(h); }
 
 void td_reset(td_histogram_t *h) {
@@ -290,6 +434,189 @@ void td_reset(td_histogram_t *h) {
     h->unmerged_nodes = 0;
     h->unmerged_weight = 0;
     h->total_compressions = 0;
+    h->exact = h->exact_threshold > 0;
+    td_recent_clear(h);
+}
+
+#define TD_CACHE_LINE 64
+
+static inline uintptr_t td_align_cache_line(uintptr_t v) {
+    return (v + TD_CACHE_LINE - 1) & ~(uintptr_t)(TD_CACHE_LINE - 1);
+}
+
+// A histogram lives in one block: the header, then the means and the weights, each array starting
+// on a cache line of its own. The header needs only 8-byte alignment, so the size allows for the
+// worst-case padding after it. Returns 1 if the size would overflow.
+static inline int td_block_size(size_t capacity, size_t *size) {
+    const size_t fixed = sizeof(td_histogram_t) + 2 * TD_CACHE_LINE;
+    if (capacity > (SIZE_MAX - fixed) / (sizeof(double) + sizeof(long long))) {
+        return 1;
+    }
+    *size = fixed + capacity * (sizeof(double) + sizeof(long long));
+    return 0;
+}
+
+// Sets up the header of a histogram of `capacity` nodes whose node arrays are already in place.
+static void td_init_header(td_histogram_t *h, double compression, size_t capacity, bool owns_block,
+                           const td_allocator_t *allocator) {
+    h->cap = (int)capacity;
+    h->compression = compression;
+    h->ingest_flags = 0;
+    h->recent_nodes = NULL;
+    h->recent_bits = 0;
+    h->owns_block = owns_block;
+    h->allocator = *allocator;
+    h->exact_threshold = 0;
+    td_reset(h);
+}
+
+// Lays a histogram of `capacity` nodes out in the block starting at h, with zeroed nodes.
+static void td_init_block(td_histogram_t *h, double compression, size_t capacity, bool owns_block,
+                          const td_allocator_t *allocator) {
+    const uintptr_t mean = td_align_cache_line((uintptr_t)(h + 1));
+    const uintptr_t weight = td_align_cache_line(mean + capacity * sizeof(double));
+    h->nodes_mean = (double *)mean;
+    h->nodes_weight = (long long *)weight;
+    memset(h->nodes_mean, 0, capacity * sizeof(double));
+    memset(h->nodes_weight, 0, capacity * sizeof(long long));
+    h->nodes_cap = (int)capacity;
+    h->nodes_in_block = true;
+    td_init_header(h, compression, capacity, owns_block, allocator);
+}
+
+// Initial node slots of a histogram from td_init_lazy().
+#ifndef TD_LAZY_MIN_NODES
+#define TD_LAZY_MIN_NODES 16
+#endif
+
+// Moves the nodes of a lazily allocated histogram to new arrays of `size` slots, in one
+// allocation holding the means then the weights. The first `size` slots are kept (all of them when
+// growing), so the caller makes sure every live node and the cumulative index fit.
+static int td_resize_nodes(td_histogram_t *h, int size) {
+    double *mean = (double *)td_alloc(&h->allocator,
+                                      (size_t)size * (sizeof(double) + sizeof(long long)));
+    if (!mean) {
+        return ENOMEM;
+    }
+    long long *weight = (long long *)(mean + size);
+    const int kept = __td_min(size, h->nodes_cap);
+    memcpy(mean, h->nodes_mean, (size_t)kept * sizeof(double));
+    memcpy(weight, h->nodes_weight, (size_t)kept * sizeof(long long));
+    memset(mean + kept, 0, (size_t)(size - kept) * sizeof(double));
+    memset(weight + kept, 0, (size_t)(size - kept) * sizeof(long long));
+    td_release(&h->allocator, (void *)h->nodes_mean);
+    h->nodes_mean = mean;
+    h->nodes_weight = weight;
+    h->nodes_cap = size;
+    return 0;
+}
+
+// Makes room for `n` node slots, n <= cap. Histograms with their nodes in the block always have
+// cap slots; lazily allocated ones double their arrays, up to cap. Returns 0 or ENOMEM, leaving
+// the histogram as it was.
+static inline int td_reserve_nodes(td_histogram_t *h, int n) {
+    if (n <= h->nodes_cap) {
+        return 0;
+    }
+    const long long doubled = 2 * (long long)h->nodes_cap;
+    return td_resize_nodes(h, (int)__td_min(__td_max(doubled, (long long)n), (long long)h->cap));
+}
+
+static int td_init_capacity_allocator(double compression, size_t capacity,
+                                     const td_allocator_t *allocator, td_histogram_t **result) {
+    size_t size;
+    if (td_block_size(capacity, &size) != 0) {
+        return 1;
+    }
+    td_histogram_t *histogram = (td_histogram_t *)td_alloc(allocator, size);
+    if (!histogram) {
+        return 1;
+    }
+    td_init_block(histogram, compression, capacity, true, allocator);
+    *result = histogram;
+
+    return 0;
+}
+
+static int td_init_capacity(double compression, size_t capacity, td_histogram_t **result) {
+    return td_init_capacity_allocator(compression, capacity, &td_default_allocator, result);
+}
+
+int td_init_lazy(double compression, td_histogram_t **result) {
+    size_t capacity;
+    if (!result || capacity_from_compression(compression, &capacity) != 0) {
+        return 1;
+    }
+    const td_allocator_t *allocator = &td_default_allocator;
+    td_histogram_t *histogram = (td_histogram_t *)td_alloc(allocator, sizeof(td_histogram_t));
+    if (!histogram) {
+        return 1;
+    }
+    const int size = (int)__td_min(capacity, (size_t)TD_LAZY_MIN_NODES);
+    double *mean =
+        (double *)td_alloc(allocator, (size_t)size * (sizeof(double) + sizeof(long long)));
+    if (!mean) {
+        td_release(allocator, (void *)histogram);
+        return 1;
+    }
+    histogram->nodes_mean = mean;
+    histogram->nodes_weight = (long long *)(mean + size);
+    memset(mean, 0, (size_t)size * (sizeof(double) + sizeof(long long)));
+    histogram->nodes_cap = size;
+    histogram->nodes_in_block = false;
+    td_init_header(histogram, compression, capacity, true, allocator);
+    *result = histogram;
+    return 0;
+}
+
+int td_shrink_to_fit(td_histogram_t *h) {
+    const int res = td_compress(h);
+    if (res != 0 || h->nodes_in_block) {
+        return res;
+    }
+    // keeps the merged centroids and their cumulative index
+    const int size = __td_min(__td_max(2 * h->merged_nodes + 1, TD_LAZY_MIN_NODES), h->cap);
+    if (size >= h->nodes_cap) {
+        return 0;
+    }
+    return td_resize_nodes(h, size);
+}
+
+size_t td_memory_usage(const td_histogram_t *h) {
+    size_t size = sizeof(td_histogram_t);
+    if (h->nodes_in_block) {
+        td_block_size((size_t)h->cap, &size);
+    } else {
+        size += (size_t)h->nodes_cap * (sizeof(double) + sizeof(long long));
+    }
+    if (h->recent_nodes) {
+        size += ((size_t)1 << h->recent_bits) * sizeof(int);
+    }
+    return size;
+}
+
+size_t td_required_size(double compression) {
+    size_t capacity;
+    size_t size;
+    if (capacity_from_compression(compression, &capacity) != 0 ||
+        td_block_size(capacity, &size) != 0) {
+        return 0;
+    }
+    return size;
+}
+
+int td_init_in_place(void *mem, size_t size, double compression, td_histogram_t **result) {
+    size_t capacity;
+    size_t required;
+    if (!mem || ((uintptr_t)mem & 7) != 0 || !result ||
+        capacity_from_compression(compression, &capacity) != 0 ||
+        td_block_size(capacity, &required) != 0 || size < required) {
+        return 1;
+    }
+    td_histogram_t *histogram = (td_histogram_t *)mem;
+    td_init_block(histogram, compression, capacity, false, &td_default_allocator);
+    *result = histogram;
+    return 0;
 }
 
 int td_init(double compression, td_histogram_t **result) {
@@ -300,29 +627,29 @@ int td_init(double compression, td_histogram_t **result) {
     if (capacity_from_compression(compression, &capacity) != 0) {
         return 1;
     }
-    td_histogram_t *histogram;
-    histogram = (td_histogram_t *)td_malloc_(sizeof(td_histogram_t));
-    if (!histogram) {
+    return td_init_capacity(compression, capacity, result);
+}
+
+int td_init_ex(double compression, int buffer_size, td_histogram_t **result) {
+    size_t capacity;
+    if (capacity_from_compression_and_buffer(compression, buffer_size, &capacity) != 0) {
         return 1;
     }
-    histogram->nodes_mean = NULL;
-    histogram->nodes_weight = NULL;
-    histogram->cap = (int)capacity;
-    histogram->compression = (double)compression;
-    td_reset(histogram);
-    histogram->nodes_mean = (double *)td_calloc_(capacity, sizeof(double));
-    if (!histogram->nodes_mean) {
-        td_free(histogram);
+    return td_init_capacity(compression, capacity, result);
+}
+
+int td_init_with_allocator(double compression, int buffer_size, const td_allocator_t *allocator,
+                           td_histogram_t **result) {
+    size_t capacity;
+    if (!allocator || !allocator->alloc || !result) {
         return 1;
     }
-    histogram->nodes_weight = (long long *)td_calloc_(capacity, sizeof(long long));
-    if (!histogram->nodes_weight) {
-        td_free(histogram);
+    if (buffer_size == 0 ? capacity_from_compression(compression, &capacity) != 0
+                         : capacity_from_compression_and_buffer(compression, buffer_size,
+                                                                &capacity) != 0) {
         return 1;
     }
-    *result = histogram;
-
-    return 0;
+    return td_init_capacity_allocator(compression, capacity, allocator, result);
 }
 
 td_histogram_t *td_new(double compression) {
@@ -331,6 +658,12 @@ td_histogram_t *td_new(double compression) {
     return mdigest;
 }
 
+td_histogram_t *td_new_ex(double compression, int buffer_size) {
+    td_histogram_t *mdigest = NULL;
+    td_init_ex(compression, buffer_size, &mdigest);
+    return mdigest;
+}
+
 void td_free(td_histogram_t *histogram) {
     // NULL guard: td_new() returns NULL for invalid compression (non-finite / <= 0 /
     // cap > INT_MAX) or allocation failure, so the idiomatic td_free(td_new(bad)) cleanup
@@ -338,91 +671,223 @@ void td_free(td_histogram_t *histogram) {
     if (!histogram) {
         return;
     }
-    if (histogram->nodes_mean) {
-        td_free_((void *)(histogram->nodes_mean));
+    // copied out first: the allocator lives in the block it releases
+    const td_allocator_t allocator = histogram->allocator;
+    td_release(&allocator, (void *)histogram->recent_nodes);
+    if (!histogram->nodes_in_block) {
+        td_release(&allocator, (void *)histogram->nodes_mean);
     }
-    if (histogram->nodes_weight) {
-        td_free_((void *)(histogram->nodes_weight));
+    // the node arrays live in the histogram's own block
+    if (histogram->owns_block) {
+        td_release(&allocator, (void *)histogram);
     }
-    td_free_((void *)(histogram));
 }
 
-int td_merge(td_histogram_t *into, td_histogram_t *from) {
-    if (td_compress(into) != 0)
-        return EDOM;
-    if (td_compress(from) != 0)
-        return EDOM;
-    const int pos = from->merged_nodes + from->unmerged_nodes;
-    for (int i = 0; i < pos; i++) {
-        const double mean = from->nodes_mean[i];
-        const long long weight = from->nodes_weight[i];
-        if (td_add(into, mean, weight) != 0) {
-            return EDOM;
+long long td_size(td_histogram_t *h) { return h->merged_weight + h->unmerged_weight; }
+
+// Read-only view of a sorted run of centroids, shared by the histogram and td_compact_t queries.
+// A narrow span stores float means and uint32_t weights, a wide one double and long long. The
+// query bodies below take `narrow` as a separate constant argument and are instantiated once per
+// layout, so the hot loops do not branch on the layout per centroid.
+struct td_span {
+    const double *mean;
+    const long long *weight;
+    const float *mean_f;
+    const uint32_t *weight_u32;
+    // cumulative[i] is the total weight of centroids [0, i), or NULL to scan linearly
+    const double *cumulative;
+    bool narrow;
+    // raw samples of an exact-phase histogram, see td_set_exact_threshold(); always wide
+    bool exact;
+    int n;
+    long long total_weight;
+    double min;
+    double max;
+};
+
+static inline double td_span_mean(const struct td_span *s, const bool narrow, int i) {
+    return narrow ? (double)s->mean_f[i] : s->mean[i];
+}
+
+static inline double td_span_weight(const struct td_span *s, const bool narrow, int i) {
+    return narrow ? (double)s->weight_u32[i] : (double)s->weight[i];
+}
+
+// The prefix sums of the merged weights live in the free slots right after the merged centroids,
+// nodes_mean[merged_nodes + i] being the total weight of centroids [0, i). They are rebuilt by
+// every path that rewrites the merged centroids, and td_add() writes over them, so they are only
+// valid while the buffer is empty and only kept when merged_nodes + 1 more slots fit in cap.
+static inline const double *td_cumulative(const td_histogram_t *h) {
+    if (h->unmerged_nodes != 0 || 2 * h->merged_nodes + 1 > h->nodes_cap) {
+        return NULL;
+    }
+    return h->nodes_mean + h->merged_nodes;
+}
+
+static void td_cumulative_build(td_histogram_t *h) {
+    const int M = h->merged_nodes;
+    if (2 * M + 1 > h->cap || td_reserve_nodes(h, 2 * M + 1) != 0) {
+        return;
+    }
+    // summed in the same order as the linear scans, so both give bit-identical answers
+    double *cumulative = h->nodes_mean + M;
+    cumulative[0] = 0;
+    for (int i = 0; i < M; i++) {
+        cumulative[i + 1] = cumulative[i] + (double)h->nodes_weight[i];
+    }
+}
+
+// Span over the merged centroids of h; callers compress first.
+static inline void td_span_from_histogram(struct td_span *s, const td_histogram_t *h) {
+    s->mean = h->nodes_mean;
+    s->weight = h->nodes_weight;
+    s->mean_f = NULL;
+    s->weight_u32 = NULL;
+    s->cumulative = td_cumulative(h);
+    s->narrow = false;
+    s->exact = h->exact;
+    s->n = h->merged_nodes;
+    s->total_weight = h->merged_weight;
+    s->min = h->min;
+    s->max = h->max;
+}
+
+// Index of the first of the sorted raw samples of an exact span that is >= val, or n.
+static inline int td_span_exact_lower_bound(const struct td_span *s, double val) {
+    int lo = 0;
+    int hi = s->n;
+    while (lo < hi) {
+        const int mid = lo + (hi - lo) / 2;
+        if (s->mean[mid] < val) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
         }
     }
-    return 0;
+    return lo;
 }
 
-long long td_size(td_histogram_t *h) { return h->merged_weight + h->unmerged_weight; }
+// Total weight of the samples [0, i) of an exact span.
+static inline double td_span_exact_weight_before(const struct td_span *s, int i) {
+    if (s->cumulative) {
+        return s->cumulative[i];
+    }
+    double weight = 0;
+    for (int j = 0; j < i; j++) {
+        weight += (double)s->weight[j];
+    }
+    return weight;
+}
 
-double td_cdf(td_histogram_t *h, double val) {
-    td_compress(h);
+// Exact cdf over raw samples: the weight below val plus half the weight at val, which is what the
+// centroid scan gives for singletons. Equal samples are folded into one node.
+static double td_span_exact_cdf(const struct td_span *s, double val) {
+    if (s->n == 0) {
+        return NAN;
+    }
+    if (val < s->min) {
+        return 0;
+    }
+    if (val > s->max) {
+        return 1;
+    }
+    const int i = td_span_exact_lower_bound(s, val);
+    const double at = i < s->n && s->mean[i] == val ? (double)s->weight[i] : 0;
+    return (td_span_exact_weight_before(s, i) + at / 2) / (double)s->total_weight;
+}
+
+// Exact quantile over raw samples: the sample holding rank q * total weight, counting from 0,
+// which is what the centroid scan gives for singletons.
+static double td_span_exact_quantile(const struct td_span *s, double q) {
+    if (q < 0.0 || q > 1.0 || s->n == 0) {
+        return NAN;
+    }
+    const double index = q * (double)s->total_weight;
+    int lo = 0;
+    int hi = s->n - 1;
+    if (s->cumulative) {
+        // the first sample whose cumulative weight exceeds index
+        while (lo < hi) {
+            const int mid = lo + (hi - lo) / 2;
+            if (s->cumulative[mid + 1] > index) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+    } else {
+        double weight = (double)s->weight[0];
+        while (lo < hi && weight <= index) {
+            weight += (double)s->weight[++lo];
+        }
+    }
+    return s->mean[lo];
+}
+
+// cdf of val, scanning the centroids from *cursor on, *cursor_weight being the weight of the ones
+// before it. Moves the cursor to where the scan stopped, so a run of ascending values is answered
+// in one pass over the centroids.
+static inline double td_span_cdf_from(const struct td_span *s, const bool narrow, double val,
+                                      int *cursor, double *cursor_weight) {
+    if (s->exact) {
+        return td_span_exact_cdf(s, val);
+    }
     // no data to examine
-    if (h->merged_nodes == 0) {
+    if (s->n == 0) {
         return NAN;
     }
     // bellow lower bound
-    if (val < h->min) {
+    if (val < s->min) {
         return 0;
     }
     // above upper bound
-    if (val > h->max) {
+    if (val > s->max) {
         return 1;
     }
-    if (h->merged_nodes == 1) {
+    if (s->n == 1) {
         // exactly one centroid, should have max==min
-        const double width = h->max - h->min;
-        if (val - h->min <= width) {
+        const double width = s->max - s->min;
+        if (val - s->min <= width) {
             // min and max are too close together to do any viable interpolation
             return 0.5;
         } else {
             // interpolate if somehow we have weight > 0 and max != min
-            return (val - h->min) / width;
+            return (val - s->min) / width;
         }
     }
-    const int n = h->merged_nodes;
+    const int n = s->n;
     // check for the left tail
-    const double left_centroid_mean = h->nodes_mean[0];
-    const double left_centroid_weight = (double)h->nodes_weight[0];
-    const double merged_weight_d = (double)h->merged_weight;
+    const double left_centroid_mean = td_span_mean(s, narrow, 0);
+    const double left_centroid_weight = td_span_weight(s, narrow, 0);
+    const double merged_weight_d = (double)s->total_weight;
     if (val < left_centroid_mean) {
-        // note that this is different than h->nodes_mean[0] > min
+        // note that this is different than mean[0] > min
         // ... this guarantees we divide by non-zero number and interpolation works
-        const double width = left_centroid_mean - h->min;
+        const double width = left_centroid_mean - s->min;
         if (width > 0) {
             // must be a sample exactly at min
-            if (val == h->min) {
+            if (val == s->min) {
                 return 0.5 / merged_weight_d;
             } else {
-                return (1 + (val - h->min) / width * (left_centroid_weight / 2 - 1)) /
+                return (1 + (val - s->min) / width * (left_centroid_weight / 2 - 1)) /
                        merged_weight_d;
             }
         } else {
-            // this should be redundant with the check val < h->min
+            // this should be redundant with the check val < min
             return 0;
         }
     }
     // and the right tail
-    const double right_centroid_mean = h->nodes_mean[n - 1];
-    const double right_centroid_weight = (double)h->nodes_weight[n - 1];
+    const double right_centroid_mean = td_span_mean(s, narrow, n - 1);
+    const double right_centroid_weight = td_span_weight(s, narrow, n - 1);
     if (val > right_centroid_mean) {
-        const double width = h->max - right_centroid_mean;
+        const double width = s->max - right_centroid_mean;
         if (width > 0) {
-            if (val == h->max) {
+            if (val == s->max) {
                 return 1 - 0.5 / merged_weight_d;
             } else {
                 // there has to be a single sample exactly at max
-                const double dq = (1 + (h->max - val) / width * (right_centroid_weight / 2 - 1)) /
+                const double dq = (1 + (s->max - val) / width * (right_centroid_weight / 2 - 1)) /
                                   merged_weight_d;
                 return 1 - dq;
             }
@@ -433,94 +898,223 @@ double td_cdf(td_histogram_t *h, double val) {
     // we know that there are at least two centroids and mean[0] < x < mean[n-1]
     // that means that there are either one or more consecutive centroids all at exactly x
     // or there are consecutive centroids, c0 < x < c1
-    double weightSoFar = 0;
-    for (int it = 0; it < n - 1; it++) {
+    double weightSoFar = *cursor_weight;
+    int it = *cursor;
+    if (s->cumulative) {
+        // jump straight to the first centroid the scan below would stop at: the first one at x,
+        // or else the last one below x
+        int lo = it;
+        int hi = n - 1;
+        while (lo < hi) {
+            const int mid = lo + (hi - lo) / 2;
+            if (td_span_mean(s, narrow, mid) < val) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        it = td_span_mean(s, narrow, lo) == val ? lo : lo - 1;
+        if (it < *cursor) {
+            // only for NaN, which the scan never matches either
+            it = n - 1;
+        }
+        weightSoFar = s->cumulative[it];
+    }
+    for (; it < n - 1; it++) {
         // weightSoFar does not include weight[it] yet
-        if (h->nodes_mean[it] == val) {
-            // we have one or more centroids == x, treat them as one
-            // dw will accumulate the weight of all of the centroids at x
-            double dw = 0;
-            while (it < n && h->nodes_mean[it] == val) {
-                dw += (double)h->nodes_weight[it];
-                it++;
+        if (td_span_mean(s, narrow, it) == val ||
+            (td_span_mean(s, narrow, it) <= val && val < td_span_mean(s, narrow, it + 1))) {
+            break;
+        }
+        weightSoFar += td_span_weight(s, narrow, it);
+    }
+    // a larger x will stop no earlier than here
+    *cursor = it;
+    *cursor_weight = weightSoFar;
+    if (it == n - 1) {
+        return 1 - 0.5 / merged_weight_d;
+    }
+    if (td_span_mean(s, narrow, it) == val) {
+        // we have one or more centroids == x, treat them as one
+        // dw will accumulate the weight of all of the centroids at x
+        double dw = 0;
+        for (int i = it; i < n && td_span_mean(s, narrow, i) == val; i++) {
+            dw += td_span_weight(s, narrow, i);
+        }
+        return (weightSoFar + dw / 2) / merged_weight_d;
+    }
+    const double node_weight = td_span_weight(s, narrow, it);
+    const double node_weight_next = td_span_weight(s, narrow, it + 1);
+    const double node_mean = td_span_mean(s, narrow, it);
+    const double node_mean_next = td_span_mean(s, narrow, it + 1);
+    // landed between centroids ... check for floating point madness
+    if (node_mean_next - node_mean > 0) {
+        // note how we handle singleton centroids here
+        // the point is that for singleton centroids, we know that their entire
+        // weight is exactly at the centroid and thus shouldn't be involved in
+        // interpolation
+        double leftExcludedW = 0;
+        double rightExcludedW = 0;
+        if (node_weight == 1) {
+            if (node_weight_next == 1) {
+                // two singletons means no interpolation
+                // left singleton is in, right is out
+                return (weightSoFar + 1) / merged_weight_d;
+            } else {
+                leftExcludedW = 0.5;
             }
-            return (weightSoFar + dw / 2) / (double)h->merged_weight;
-        } else if (h->nodes_mean[it] <= val && val < h->nodes_mean[it + 1]) {
-            const double node_weight = (double)h->nodes_weight[it];
-            const double node_weight_next = (double)h->nodes_weight[it + 1];
-            const double node_mean = h->nodes_mean[it];
-            const double node_mean_next = h->nodes_mean[it + 1];
-            // landed between centroids ... check for floating point madness
-            if (node_mean_next - node_mean > 0) {
-                // note how we handle singleton centroids here
-                // the point is that for singleton centroids, we know that their entire
-                // weight is exactly at the centroid and thus shouldn't be involved in
-                // interpolation
-                double leftExcludedW = 0;
-                double rightExcludedW = 0;
-                if (node_weight == 1) {
-                    if (node_weight_next == 1) {
-                        // two singletons means no interpolation
-                        // left singleton is in, right is out
-                        return (weightSoFar + 1) / merged_weight_d;
-                    } else {
-                        leftExcludedW = 0.5;
-                    }
-                } else if (node_weight_next == 1) {
-                    rightExcludedW = 0.5;
-                }
-                double dw = (node_weight + node_weight_next) / 2;
+        } else if (node_weight_next == 1) {
+            rightExcludedW = 0.5;
+        }
+        double dw = (node_weight + node_weight_next) / 2;
 
-                // adjust endpoints for any singleton
-                double dwNoSingleton = dw - leftExcludedW - rightExcludedW;
+        // adjust endpoints for any singleton
+        double dwNoSingleton = dw - leftExcludedW - rightExcludedW;
 
-                double base = weightSoFar + node_weight / 2 + leftExcludedW;
-                return (base + dwNoSingleton * (val - node_mean) / (node_mean_next - node_mean)) /
-                       merged_weight_d;
-            } else {
-                // this is simply caution against floating point madness
-                // it is conceivable that the centroids will be different
-                // but too near to allow safe interpolation
-                double dw = (node_weight + node_weight_next) / 2;
-                return (weightSoFar + dw) / merged_weight_d;
-            }
-        } else {
-            weightSoFar += (double)h->nodes_weight[it];
+        double base = weightSoFar + node_weight / 2 + leftExcludedW;
+        return (base + dwNoSingleton * (val - node_mean) / (node_mean_next - node_mean)) /
+               merged_weight_d;
+    } else {
+        // this is simply caution against floating point madness
+        // it is conceivable that the centroids will be different
+        // but too near to allow safe interpolation
+        double dw = (node_weight + node_weight_next) / 2;
+        return (weightSoFar + dw) / merged_weight_d;
+    }
+}
+
+static inline double td_span_cdf_layout(const struct td_span *s, const bool narrow, double val) {
+    int cursor = 0;
+    double cursor_weight = 0;
+    return td_span_cdf_from(s, narrow, val, &cursor, &cursor_weight);
+}
+
+static double td_span_cdf(const struct td_span *s, double val) {
+    return s->narrow ? td_span_cdf_layout(s, true, val) : td_span_cdf_layout(s, false, val);
+}
+
+double td_cdf(td_histogram_t *h, double val) {
+    td_compress(h);
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_cdf_layout(&s, false, val);
+}
+
+struct td_threshold {
+    double x;
+    size_t pos;
+};
+
+static int td_threshold_cmp(const void *a, const void *b) {
+    const double x = ((const struct td_threshold *)a)->x;
+    const double y = ((const struct td_threshold *)b)->x;
+    // NaN last, so it cannot hold the cursor back
+    if (isnan(x) || isnan(y)) {
+        return isnan(x) - isnan(y);
+    }
+    return (x > y) - (x < y);
+}
+
+static inline int td_span_cdfs_layout(const td_allocator_t *a, const struct td_span *s,
+                                      const bool narrow, const double *xs,
+                                      double *out, size_t length, const double scale) {
+    if (NULL == xs || NULL == out) {
+        return EINVAL;
+    }
+    int cursor = 0;
+    double cursor_weight = 0;
+    size_t sorted = 1;
+    while (sorted < length && xs[sorted - 1] <= xs[sorted]) {
+        sorted++;
+    }
+    if (length == 0 || sorted == length) {
+        for (size_t i = 0; i < length; i++) {
+            out[i] = td_span_cdf_from(s, narrow, xs[i], &cursor, &cursor_weight) * scale;
         }
+        return 0;
+    }
+    struct td_threshold *order =
+        (struct td_threshold *)td_alloc(a, length * sizeof(struct td_threshold));
+    if (!order) {
+        return ENOMEM;
+    }
+    for (size_t i = 0; i < length; i++) {
+        order[i].x = xs[i];
+        order[i].pos = i;
+    }
+    qsort(order, length, sizeof(struct td_threshold), td_threshold_cmp);
+    for (size_t i = 0; i < length; i++) {
+        out[order[i].pos] = td_span_cdf_from(s, narrow, order[i].x, &cursor, &cursor_weight) * scale;
     }
-    return 1 - 0.5 / merged_weight_d;
+    td_release(a, (void *)order);
+    return 0;
+}
+
+int td_cdfs(td_histogram_t *h, const double *xs, double *out, size_t length) {
+    td_compress(h);
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_cdfs_layout(&h->allocator, &s, false, xs, out, length, 1);
 }
 
-static double td_internal_iterate_centroids_to_index(const td_histogram_t *h, const double index,
-                                                     const double left_centroid_weight,
-                                                     const int total_centroids, double *weightSoFar,
-                                                     int *node_pos) {
+int td_ranks(td_histogram_t *h, const double *xs, double *out, size_t length) {
+    td_compress(h);
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_cdfs_layout(&h->allocator, &s, false, xs, out, length,
+                               (double)s.total_weight);
+}
+
+static inline double
+td_internal_iterate_centroids_to_index(const struct td_span *s, const bool narrow,
+                                       const double index, const double left_centroid_weight,
+                                       const int total_centroids, double *weightSoFar,
+                                       int *node_pos) {
     if (left_centroid_weight > 1 && index < left_centroid_weight / 2) {
         // there is a single sample at min so we interpolate with less weight
-        return h->min + (index - 1) / (left_centroid_weight / 2 - 1) * (h->nodes_mean[0] - h->min);
+        return s->min + (index - 1) / (left_centroid_weight / 2 - 1) * (td_span_mean(s, narrow, 0) - s->min);
     }
 
     // usually the last centroid will have unit weight so this test will make it moot
-    if (index > h->merged_weight - 1) {
-        return h->max;
+    if (index > s->total_weight - 1) {
+        return s->max;
     }
 
     // if the right-most centroid has more than one sample, we still know
     // that one sample occurred at max so we can do some interpolation
-    const double right_centroid_weight = (double)h->nodes_weight[total_centroids - 1];
-    const double right_centroid_mean = h->nodes_mean[total_centroids - 1];
+    const double right_centroid_weight = td_span_weight(s, narrow, total_centroids - 1);
+    const double right_centroid_mean = td_span_mean(s, narrow, total_centroids - 1);
     if (right_centroid_weight > 1 &&
-        (double)h->merged_weight - index <= right_centroid_weight / 2) {
-        return h->max - ((double)h->merged_weight - index - 1) / (right_centroid_weight / 2 - 1) *
-                            (h->max - right_centroid_mean);
+        (double)s->total_weight - index <= right_centroid_weight / 2) {
+        return s->max - ((double)s->total_weight - index - 1) / (right_centroid_weight / 2 - 1) *
+                            (s->max - right_centroid_mean);
     }
 
+    if (s->cumulative) {
+        // The scan below stops at the first i whose midpoint weight plus dw, i.e. the midpoint
+        // weight of i + 1, exceeds index. Midpoint weights are exact for integer weights, so
+        // jumping there gives the same weightSoFar the scan would have accumulated.
+        int lo = *node_pos;
+        int hi = total_centroids - 1;
+        while (lo < hi) {
+            const int mid = lo + (hi - lo) / 2;
+            if (s->cumulative[mid + 1] + td_span_weight(s, narrow, mid + 1) / 2 > index) {
+                hi = mid;
+            } else {
+                lo = mid + 1;
+            }
+        }
+        if (lo > *node_pos) {
+            *node_pos = lo;
+            *weightSoFar = s->cumulative[lo] + td_span_weight(s, narrow, lo) / 2;
+        }
+    }
     for (; *node_pos < total_centroids - 1; (*node_pos)++) {
         const int i = *node_pos;
-        const double node_weight = (double)h->nodes_weight[i];
-        const double node_weight_next = (double)h->nodes_weight[i + 1];
-        const double node_mean = h->nodes_mean[i];
-        const double node_mean_next = h->nodes_mean[i + 1];
+        const double node_weight = td_span_weight(s, narrow, i);
+        const double node_weight_next = td_span_weight(s, narrow, i + 1);
+        const double node_mean = td_span_mean(s, narrow, i);
+        const double node_mean_next = td_span_mean(s, narrow, i + 1);
         const double dw = (node_weight + node_weight_next) / 2;
         if (*weightSoFar + dw > index) {
             // centroids i and i+1 bracket our current point
@@ -551,53 +1145,73 @@ static double td_internal_iterate_centroids_to_index(const td_histogram_t *h, co
 
     // weightSoFar = totalWeight - weight[total_centroids-1]/2 (very nearly)
     // so we interpolate out to max value ever seen
-    const double z1 = index - h->merged_weight - right_centroid_weight / 2.0;
+    const double z1 = index - s->total_weight - right_centroid_weight / 2.0;
     const double z2 = right_centroid_weight / 2 - z1;
-    return weighted_average(right_centroid_mean, z1, h->max, z2);
+    return weighted_average(right_centroid_mean, z1, s->max, z2);
 }
 
-double td_quantile(td_histogram_t *h, double q) {
-    td_compress(h);
+static inline double td_span_quantile_layout(const struct td_span *s, const bool narrow,
+                                             double q) {
+    if (s->exact) {
+        return td_span_exact_quantile(s, q);
+    }
     // q should be in [0,1]
-    if (q < 0.0 || q > 1.0 || h->merged_nodes == 0) {
+    if (q < 0.0 || q > 1.0 || s->n == 0) {
         return NAN;
     }
     // with one data point, all quantiles lead to Rome
-    if (h->merged_nodes == 1) {
-        return h->nodes_mean[0];
+    if (s->n == 1) {
+        return td_span_mean(s, narrow, 0);
     }
 
     // if values were stored in a sorted array, index would be the offset we are interested in
-    const double index = q * (double)h->merged_weight;
+    const double index = q * (double)s->total_weight;
 
     // beyond the boundaries, we return min or max
     // usually, the first centroid will have unit weight so this will make it moot
     if (index < 1) {
-        return h->min;
+        return s->min;
     }
 
     // we know that there are at least two centroids now
-    const int n = h->merged_nodes;
+    const int n = s->n;
 
     // if the left centroid has more than one sample, we still know
     // that one sample occurred at min so we can do some interpolation
-    const double left_centroid_weight = (double)h->nodes_weight[0];
+    const double left_centroid_weight = td_span_weight(s, narrow, 0);
 
     // in between extremes we interpolate between centroids
     double weightSoFar = left_centroid_weight / 2;
     int i = 0;
-    return td_internal_iterate_centroids_to_index(h, index, left_centroid_weight, n, &weightSoFar,
+    return td_internal_iterate_centroids_to_index(s, narrow, index, left_centroid_weight, n, &weightSoFar,
                                                   &i);
 }
 
-int td_quantiles(td_histogram_t *h, const double *quantiles, double *values, size_t length) {
+static double td_span_quantile(const struct td_span *s, double q) {
+    return s->narrow ? td_span_quantile_layout(s, true, q) : td_span_quantile_layout(s, false, q);
+}
+
+double td_quantile(td_histogram_t *h, double q) {
     td_compress(h);
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_quantile_layout(&s, false, q);
+}
 
+static inline int td_span_quantiles_layout(const struct td_span *s, const bool narrow,
+                                           const double *quantiles, double *values,
+                                           size_t length) {
     if (NULL == quantiles || NULL == values) {
         return EINVAL;
     }
+    if (s->exact) {
+        for (size_t i = 0; i < length; i++) {
+            values[i] = td_span_exact_quantile(s, quantiles[i]);
+        }
+        return 0;
+    }
 
-    const int n = h->merged_nodes;
+    const int n = s->n;
     if (n == 0) {
         for (size_t i = 0; i < length; i++) {
             values[i] = NAN;
@@ -613,7 +1227,7 @@ int td_quantiles(td_histogram_t *h, const double *quantiles, double *values, siz
                 values[i] = NAN;
             } else {
                 // with one data point, all quantiles lead to Rome
-                values[i] = h->nodes_mean[0];
+                values[i] = td_span_mean(s, narrow, 0);
             }
         }
         return 0;
@@ -622,7 +1236,7 @@ int td_quantiles(td_histogram_t *h, const double *quantiles, double *values, siz
     // we know that there are at least two centroids now
     // if the left centroid has more than one sample, we still know
     // that one sample occurred at min so we can do some interpolation
-    const double left_centroid_weight = (double)h->nodes_weight[0];
+    const double left_centroid_weight = td_span_weight(s, narrow, 0);
 
     // in between extremes we interpolate between centroids
     double weightSoFar = left_centroid_weight / 2;
@@ -631,21 +1245,34 @@ int td_quantiles(td_histogram_t *h, const double *quantiles, double *values, siz
     // to avoid allocations we use the values array for intermediate computation
     // i.e. to store the expected cumulative count at each percentile
     for (size_t qpos = 0; qpos < length; qpos++) {
-        const double index = quantiles[qpos] * (double)h->merged_weight;
-        values[qpos] = td_internal_iterate_centroids_to_index(h, index, left_centroid_weight, n,
+        const double index = quantiles[qpos] * (double)s->total_weight;
+        values[qpos] = td_internal_iterate_centroids_to_index(s, narrow, index, left_centroid_weight, n,
                                                               &weightSoFar, &node_pos);
     }
     return 0;
 }
 
-static double td_internal_trimmed_mean(const td_histogram_t *h, const double leftmost_weight,
+static int td_span_quantiles(const struct td_span *s, const double *quantiles, double *values,
+                             size_t length) {
+    return s->narrow ? td_span_quantiles_layout(s, true, quantiles, values, length)
+                     : td_span_quantiles_layout(s, false, quantiles, values, length);
+}
+
+int td_quantiles(td_histogram_t *h, const double *quantiles, double *values, size_t length) {
+    td_compress(h);
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_quantiles_layout(&s, false, quantiles, values, length);
+}
+
+static double td_internal_trimmed_mean(const struct td_span *s, const double leftmost_weight,
                                        const double rightmost_weight) {
     double count_done = 0;
     double trimmed_sum = 0;
     double trimmed_count = 0;
-    for (int i = 0; i < h->merged_nodes; i++) {
+    for (int i = 0; i < s->n; i++) {
 
-        const double n_weight = (double)h->nodes_weight[i];
+        const double n_weight = (double)s->weight[i];
         // Assume the whole centroid falls into the range
         double count_add = n_weight;
 
@@ -660,7 +1287,7 @@ static double td_internal_trimmed_mean(const td_histogram_t *h, const double lef
         count_done += n_weight;
 
         // increment the sum / count
-        trimmed_sum += h->nodes_mean[i] * count_add;
+        trimmed_sum += s->mean[i] * count_add;
         trimmed_count += count_add;
 
         // break once we cross the high threshold
@@ -671,41 +1298,141 @@ static double td_internal_trimmed_mean(const td_histogram_t *h, const double lef
     return trimmed_sum / trimmed_count;
 }
 
-double td_trimmed_mean_symmetric(td_histogram_t *h, double proportion_to_cut) {
-    td_compress(h);
-    // proportion_to_cut should be in [0,1]
-    if (h->merged_nodes == 0 || proportion_to_cut < 0.0 || proportion_to_cut > 1.0) {
-        return NAN;
+// Trimmed mean over a wide span; the symmetric variant passes rightmost_cut = 1 - proportion.
+static double td_span_trimmed_mean(const struct td_span *s, double leftmost_cut,
+                                   double rightmost_cut) {
+    // leftmost_cut and rightmost_cut should be in [0,1]
+    if (s->n == 0 || leftmost_cut < 0.0 || leftmost_cut > 1.0 || rightmost_cut < 0.0 ||
+        rightmost_cut > 1.0) {
+        return NAN;
     }
     // with one data point, all values lead to Rome
-    if (h->merged_nodes == 1) {
-        return h->nodes_mean[0];
+    if (s->n == 1) {
+        return s->mean[0];
     }
 
     /* translate the percentiles to counts */
-    const double leftmost_weight = floor((double)h->merged_weight * proportion_to_cut);
-    const double rightmost_weight = ceil((double)h->merged_weight * (1.0 - proportion_to_cut));
+    const double leftmost_weight = floor((double)s->total_weight * leftmost_cut);
+    const double rightmost_weight = ceil((double)s->total_weight * rightmost_cut);
 
-    return td_internal_trimmed_mean(h, leftmost_weight, rightmost_weight);
+    return td_internal_trimmed_mean(s, leftmost_weight, rightmost_weight);
+}
+
+double td_trimmed_mean_symmetric(td_histogram_t *h, double proportion_to_cut) {
+    td_compress(h);
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_trimmed_mean(&s, proportion_to_cut, 1.0 - proportion_to_cut);
 }
 
 double td_trimmed_mean(td_histogram_t *h, double leftmost_cut, double rightmost_cut) {
     td_compress(h);
-    // leftmost_cut and rightmost_cut should be in [0,1]
-    if (h->merged_nodes == 0 || leftmost_cut < 0.0 || leftmost_cut > 1.0 || rightmost_cut < 0.0 ||
-        rightmost_cut > 1.0) {
-        return NAN;
+    struct td_span s;
+    td_span_from_histogram(&s, h);
+    return td_span_trimmed_mean(&s, leftmost_cut, rightmost_cut);
+}
+
+// Folds each run of equal means of the sorted nodes [0, n) into one node; returns the node count.
+static int td_fold_equal(double *mean, long long *weight, int n) {
+    int out = 0;
+    for (int i = 1; i < n; i++) {
+        if (mean[i] == mean[out]) {
+            weight[out] += weight[i];
+        } else {
+            out++;
+            mean[out] = mean[i];
+            weight[out] = weight[i];
+        }
     }
-    // with one data point, all values lead to Rome
-    if (h->merged_nodes == 1) {
-        return h->nodes_mean[0];
+    return n > 0 ? out + 1 : 0;
+}
+
+// Ends the exact phase. The stored samples go back to the buffer, where they already are in order,
+// for the next td_compress() to fold into centroids.
+static void td_exact_leave(td_histogram_t *h) {
+    h->exact = false;
+    h->unmerged_nodes += h->merged_nodes;
+    h->unmerged_weight += h->merged_weight;
+    h->merged_nodes = 0;
+    h->merged_weight = 0;
+}
+
+int td_set_ingest_flags(td_histogram_t *h, int flags) {
+    if ((flags & TD_COLLAPSE_DUPLICATES) && !h->recent_nodes) {
+        const int bits = td_recent_bits(h);
+        h->recent_nodes = (int *)td_alloc(&h->allocator, ((size_t)1 << bits) * sizeof(int));
+        if (!h->recent_nodes) {
+            return ENOMEM;
+        }
+        h->recent_bits = bits;
+        td_recent_clear(h);
+        // nodes buffered before the flag was set are simply not collapsed into
+    } else if (!(flags & TD_COLLAPSE_DUPLICATES) && h->recent_nodes) {
+        td_release(&h->allocator, (void *)h->recent_nodes);
+        h->recent_nodes = NULL;
     }
+    h->ingest_flags = flags;
+    return 0;
+}
 
-    /* translate the percentiles to counts */
-    const double leftmost_weight = floor((double)h->merged_weight * leftmost_cut);
-    const double rightmost_weight = ceil((double)h->merged_weight * rightmost_cut);
+int td_ingest_flags(td_histogram_t *h) { return h->ingest_flags; }
 
-    return td_internal_trimmed_mean(h, leftmost_weight, rightmost_weight);
+int td_set_exact_threshold(td_histogram_t *h, int threshold) {
+    // the samples and their cumulative index have to fit in the node arrays
+    if (threshold < 0 || threshold > (h->cap - 1) / 2) {
+        return EINVAL;
+    }
+    if (threshold > 0 && !h->exact && td_size(h) > 0) {
+        return EINVAL;
+    }
+    h->exact_threshold = threshold;
+    if (h->exact && (threshold == 0 || h->merged_nodes > threshold)) {
+        td_exact_leave(h);
+    } else if (td_size(h) == 0) {
+        h->exact = threshold > 0;
+    }
+    return 0;
+}
+
+bool td_is_exact(const td_histogram_t *h) { return h->exact; }
+
+static inline uint64_t td_recent_hash(double mean) {
+    uint64_t bits;
+    memcpy(&bits, &mean, sizeof(bits));
+    // Fibonacci hashing; only the top bits of the product depend on every bit of the value, and
+    // small integers leave the low mantissa bits zero, so callers shift the result down.
+    return bits * UINT64_C(0x9E3779B97F4A7C15);
+}
+
+// Buffer a validated sample under TD_COLLAPSE_DUPLICATES; the caller accounts for the weight.
+// The sample is folded into the last buffered node or into one recorded in the open-addressed
+// table of buffered means, otherwise it takes a new node.
+static inline void td_buffer_collapsing(td_histogram_t *h, double mean, long long weight) {
+    const int pos = next_node(h);
+    if (h->unmerged_nodes > 0 && h->nodes_mean[pos - 1] == mean) {
+        h->nodes_weight[pos - 1] += weight;
+        return;
+    }
+    const size_t mask = ((size_t)1 << h->recent_bits) - 1;
+    size_t slot = (size_t)(td_recent_hash(mean) >> (64 - h->recent_bits));
+    for (int probe = 0; probe < TD_RECENT_PROBES; probe++, slot = (slot + 1) & mask) {
+        const int recent = h->recent_nodes[slot];
+        if (recent < 0) {
+            h->recent_nodes[slot] = pos;
+            break;
+        }
+        if (recent < h->merged_nodes) {
+            // stale: only buffered nodes may be folded into, never a merged centroid
+            continue;
+        }
+        if (h->nodes_mean[recent] == mean) {
+            h->nodes_weight[recent] += weight;
+            return;
+        }
+    }
+    h->nodes_mean[pos] = mean;
+    h->nodes_weight[pos] = weight;
+    h->unmerged_nodes++;
 }
 
 int td_add(td_histogram_t *h, double mean, long long weight) {
@@ -737,6 +1464,8 @@ int td_add(td_histogram_t *h, double mean, long long weight) {
         _check_td_overflow((double)new_unmerged_weight, (double)new_total_weight);
     if (overflow_res != 0)
         return overflow_res;
+    if (td_reserve_nodes(h, pos + 1) != 0)
+        return ENOMEM;
 
     if (mean < h->min) {
         h->min = mean;
@@ -744,6 +1473,11 @@ int td_add(td_histogram_t *h, double mean, long long weight) {
     if (mean > h->max) {
         h->max = mean;
     }
+    if (h->ingest_flags & TD_COLLAPSE_DUPLICATES) {
+        td_buffer_collapsing(h, mean, weight);
+        h->unmerged_weight = new_unmerged_weight;
+        return 0;
+    }
     h->nodes_mean[pos] = mean;
     h->nodes_weight[pos] = weight;
     h->unmerged_nodes++;
@@ -751,26 +1485,228 @@ int td_add(td_histogram_t *h, double mean, long long weight) {
     return 0;
 }
 
+// Index of the first non-finite value in values[0, n), or n if all are finite. The first pass is
+// a branch-free OR over the exponent bits (a double is NaN/Inf iff all 11 exponent bits are set),
+// which the compiler can vectorize; the exact position is only searched for when it trips.
+static size_t td_first_nonfinite(const double *values, size_t n) {
+    const uint64_t exp_mask = UINT64_C(0x7ff0000000000000);
+    uint64_t any = 0;
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bits;
+        memcpy(&bits, &values[i], sizeof(bits));
+        any |= (uint64_t)((bits & exp_mask) == exp_mask);
+    }
+    if (!any) {
+        return n;
+    }
+    size_t i = 0;
+    while (isfinite(values[i])) {
+        i++;
+    }
+    return i;
+}
+
+// Shared body of td_add_batch()/td_add_batch_unweighted(); `weights == NULL` means unit weights.
+static int td_add_batch_internal(td_histogram_t *h, const double *values, const long long *weights,
+                                 size_t n, size_t *rejected) {
+    size_t done = 0;
+    int res = 0;
+    while (done < n) {
+        if (should_td_compress(h)) {
+            res = td_compress(h);
+            if (res != 0) {
+                break;
+            }
+        }
+        const int pos = next_node(h);
+        const double *v = values + done;
+        // Fill exactly up to the point where td_add() would trigger the next compression, so the
+        // compression boundaries (and therefore the digest) match the one-by-one path.
+        const int room = h->cap - 1 - merge_reserve(h) - pos;
+        if (room <= 0) {
+            // A compression that could not free any room: let td_add() handle the next slot.
+            res = td_add(h, v[0], weights ? weights[done] : 1);
+            if (res != 0) {
+                break;
+            }
+            done++;
+            continue;
+        }
+        const size_t chunk = __td_min((size_t)room, n - done);
+        if (td_reserve_nodes(h, pos + (int)chunk) != 0) {
+            res = ENOMEM;
+            break;
+        }
+
+        size_t accepted = td_first_nonfinite(v, chunk);
+        int chunk_res = accepted < chunk ? EINVAL : 0;
+
+        long long new_unmerged_weight = h->unmerged_weight;
+        if (weights) {
+            const long long *w = weights + done;
+            for (size_t i = 0; i < accepted; i++) {
+                if (!_tdigest_long_long_add_safe(new_unmerged_weight, w[i]) ||
+                    !_tdigest_long_long_add_safe(new_unmerged_weight + w[i], h->merged_weight)) {
+                    accepted = i;
+                    chunk_res = EDOM;
+                    break;
+                }
+                new_unmerged_weight += w[i];
+            }
+        } else {
+            // With unit weights the largest acceptable count can be computed up front.
+            const long long limit = __LONG_LONG_MAX__ - __td_max(h->merged_weight, 0) -
+                                    __td_max(h->unmerged_weight, 0);
+            if ((unsigned long long)accepted > (unsigned long long)limit) {
+                accepted = (size_t)limit;
+                chunk_res = EDOM;
+            }
+            new_unmerged_weight += (long long)accepted;
+        }
+        if (accepted > 0 && _check_td_overflow((double)new_unmerged_weight,
+                                               (double)new_unmerged_weight +
+                                                   (double)h->merged_weight) != 0) {
+            // The double-precision bound is monotonic in the weight, so only the block total
+            // needs checking; locate the offending element the slow way if it trips.
+            for (size_t i = 0; i < accepted; i++) {
+                res = td_add(h, v[i], weights ? weights[done + i] : 1);
+                if (res != 0) {
+                    done += i;
+                    break;
+                }
+            }
+            if (res != 0) {
+                break;
+            }
+            done += accepted;
+            continue;
+        }
+
+        double min = h->min;
+        double max = h->max;
+        for (size_t i = 0; i < accepted; i++) {
+            min = v[i] < min ? v[i] : min;
+            max = v[i] > max ? v[i] : max;
+        }
+        if (h->ingest_flags & TD_COLLAPSE_DUPLICATES) {
+            // at most one node per sample, so the chunk still fits in `room`
+            for (size_t i = 0; i < accepted; i++) {
+                td_buffer_collapsing(h, v[i], weights ? weights[done + i] : 1);
+            }
+        } else {
+            memcpy(h->nodes_mean + pos, v, accepted * sizeof(double));
+            if (weights) {
+                memcpy(h->nodes_weight + pos, weights + done, accepted * sizeof(long long));
+            } else {
+                long long *w = h->nodes_weight + pos;
+                for (size_t i = 0; i < accepted; i++) {
+                    w[i] = 1;
+                }
+            }
+            h->unmerged_nodes += (int)accepted;
+        }
+        h->min = min;
+        h->max = max;
+        h->unmerged_weight = new_unmerged_weight;
+        done += accepted;
+        if (chunk_res != 0) {
+            res = chunk_res;
+            break;
+        }
+    }
+    if (rejected) {
+        *rejected = done;
+    }
+    return res;
+}
+
+int td_add_batch(td_histogram_t *h, const double *values, const long long *weights, size_t n,
+                 size_t *rejected) {
+    if (n > 0 && (values == NULL || weights == NULL)) {
+        if (rejected) {
+            *rejected = 0;
+        }
+        return EINVAL;
+    }
+    return td_add_batch_internal(h, values, weights, n, rejected);
+}
+
+int td_add_batch_unweighted(td_histogram_t *h, const double *values, size_t n, size_t *rejected) {
+    if (n > 0 && values == NULL) {
+        if (rejected) {
+            *rejected = 0;
+        }
+        return EINVAL;
+    }
+    return td_add_batch_internal(h, values, NULL, n, rejected);
+}
+
+// Feed the k-scale pass from a linear two-way merge of the sorted merged run (a) and the sorted
+// buffer run (b); on equal means the merged centroid goes first. The runs may live in the output
+// arrays as long as each stays ahead of the output index.
+static inline void td_kscale_push_merged(struct td_kscale *k, const double *a_mean,
+                                         const long long *a_weight, int a_len,
+                                         const double *b_mean, const long long *b_weight,
+                                         int b_len) {
+    int a = 0;
+    int b = 0;
+    while (a < a_len && b < b_len) {
+        if (b_mean[b] < a_mean[a]) {
+            td_kscale_push(k, b_mean[b], b_weight[b]);
+            b++;
+        } else {
+            td_kscale_push(k, a_mean[a], a_weight[a]);
+            a++;
+        }
+    }
+    for (; a < a_len; a++) {
+        td_kscale_push(k, a_mean[a], a_weight[a]);
+    }
+    for (; b < b_len; b++) {
+        td_kscale_push(k, b_mean[b], b_weight[b]);
+    }
+}
+
 int td_compress(td_histogram_t *h) {
     if (h->unmerged_nodes == 0) {
         return 0;
     }
-    int N = h->merged_nodes + h->unmerged_nodes;
-    td_qsort(h->nodes_mean, h->nodes_weight, 0, N - 1);
+    const int M = h->merged_nodes;
+    const int N = M + h->unmerged_nodes;
     const double total_weight = (double)h->merged_weight + (double)h->unmerged_weight;
     // double-precision overflow detected
     const int overflow_res = _check_td_overflow((double)h->unmerged_weight, (double)total_weight);
     if (overflow_res != 0)
         return overflow_res;
-    if (total_weight <= 1) {
-        // Only move data if there are unmerged nodes to move
-        if (h->unmerged_nodes > 0) {
-            h->merged_nodes = h->merged_nodes + h->unmerged_nodes;
-            h->merged_weight = total_weight;
-            h->unmerged_nodes = 0;
-            h->unmerged_weight = 0;
-            h->total_compressions++;
+    if (h->exact) {
+        // raw samples: sorted and equal ones folded, but never merged by the k-scale pass
+        td_sort_nodes(&h->allocator, h->nodes_mean, h->nodes_weight, 0, N - 1);
+        const int distinct = td_fold_equal(h->nodes_mean, h->nodes_weight, N);
+        memset(h->nodes_mean + distinct, 0, (size_t)(N - distinct) * sizeof(double));
+        memset(h->nodes_weight + distinct, 0, (size_t)(N - distinct) * sizeof(long long));
+        h->merged_nodes = distinct;
+        h->merged_weight += h->unmerged_weight;
+        h->unmerged_nodes = 0;
+        h->unmerged_weight = 0;
+        td_recent_clear(h);
+        if (distinct > h->exact_threshold) {
+            // past the threshold the samples become centroids for good
+            td_exact_leave(h);
+            return td_compress(h);
         }
+        h->total_compressions++;
+        td_cumulative_build(h);
+        return 0;
+    }
+    if (total_weight <= 1) {
+        td_sort_nodes(&h->allocator, h->nodes_mean, h->nodes_weight, 0, N - 1);
+        h->merged_nodes = N;
+        h->merged_weight = total_weight;
+        h->unmerged_nodes = 0;
+        h->unmerged_weight = 0;
+        h->total_compressions++;
+        td_cumulative_build(h);
+        td_recent_clear(h);
         return 0;
     }
     const double denom = 2 * MM_PI * total_weight * log(total_weight);
@@ -781,44 +1717,500 @@ int td_compress(td_histogram_t *h) {
     const double normalizer = h->compression / denom;
     if (_check_overflow(normalizer) != 0)
         return EDOM;
-    int cur = 0;
-    double weight_so_far = 0;
-
-    for (int i = 1; i < N; i++) {
-        const double proposed_weight = (double)h->nodes_weight[cur] + (double)h->nodes_weight[i];
-        const double z = proposed_weight * normalizer;
-        // quantile up to cur
-        const double q0 = weight_so_far / total_weight;
-        // quantile up to cur + i
-        const double q2 = (weight_so_far + proposed_weight) / total_weight;
-        // Convert  a quantile to the k-scale
-        const bool should_add = (z <= (q0 * (1 - q0))) && (z <= (q2 * (1 - q2)));
-        // next point will fit
-        // so merge into existing centroid
-        if (should_add) {
-            h->nodes_weight[cur] += h->nodes_weight[i];
-            const double delta = h->nodes_mean[i] - h->nodes_mean[cur];
-            const double weighted_delta = (delta * h->nodes_weight[i]) / h->nodes_weight[cur];
-            h->nodes_mean[cur] += weighted_delta;
-        } else {
-            weight_so_far += h->nodes_weight[cur];
-            cur++;
-            h->nodes_weight[cur] = h->nodes_weight[i];
-            h->nodes_mean[cur] = h->nodes_mean[i];
-        }
-        if (cur != i) {
-            h->nodes_weight[i] = 0;
-            h->nodes_mean[i] = 0.0;
+
+    // the linear merge parks a copy of the prefix past the buffer; grown into first, if lazily
+    // allocated, as growing moves the arrays
+    const bool linear = M > 0 && N + M <= h->cap && td_reserve_nodes(h, N + M) == 0;
+    double *mean = h->nodes_mean;
+    long long *weight = h->nodes_weight;
+    struct td_kscale k;
+    td_kscale_init(&k, mean, weight, total_weight, normalizer);
+    // Slots past N that may hold stale data once the pass is done.
+    int dirty_end = N;
+    if (linear) {
+        // The merged prefix is already sorted: sort only the buffer, park a copy of the prefix
+        // past it and feed the k-scale pass from a linear two-way merge of the two runs. The
+        // output index never exceeds (centroids consumed - 1), so it stays behind both read
+        // positions (M + buffered consumed, and N + prefix consumed).
+        td_sort_nodes(&h->allocator, mean, weight, M, N - 1);
+        memcpy(mean + N, mean, (size_t)M * sizeof(double));
+        memcpy(weight + N, weight, (size_t)M * sizeof(long long));
+        td_kscale_push_merged(&k, mean + N, weight + N, M, mean + M, weight + M, N - M);
+        dirty_end = N + M;
+    } else {
+        td_sort_nodes(&h->allocator, mean, weight, 0, N - 1);
+        for (int i = 0; i < N; i++) {
+            td_kscale_push(&k, mean[i], weight[i]);
         }
     }
-    h->merged_nodes = cur + 1;
+    const int merged = k.cur + 1;
+    memset(mean + merged, 0, (size_t)(dirty_end - merged) * sizeof(double));
+    memset(weight + merged, 0, (size_t)(dirty_end - merged) * sizeof(long long));
+    h->merged_nodes = merged;
     h->merged_weight = total_weight;
     h->unmerged_nodes = 0;
     h->unmerged_weight = 0;
     h->total_compressions++;
+    td_cumulative_build(h);
+    td_recent_clear(h);
+    return 0;
+}
+
+// Replays the centroids of a span through td_add().
+static int td_merge_replay(td_histogram_t *into, const struct td_span *from) {
+    const int pos = from->n;
+    for (int i = 0; i < pos; i++) {
+        const double mean = from->mean[i];
+        const long long weight = from->weight[i];
+        if (td_add(into, mean, weight) != 0) {
+            return EDOM;
+        }
+    }
+    return 0;
+}
+
+// Merges the sorted centroids of a wide span into a compressed histogram.
+static int td_merge_span(td_histogram_t *into, const struct td_span *from) {
+    if (into->exact) {
+        // raw samples stay exact; centroids end the exact phase
+        if (from->exact) {
+            return td_merge_replay(into, from);
+        }
+        td_exact_leave(into);
+        const int res = td_compress(into);
+        if (res != 0) {
+            return res;
+        }
+    }
+    const int M = into->merged_nodes;
+    const int F = from->n;
+    if (F == 0) {
+        return 0;
+    }
+    // merging a histogram into itself reads the centroids being rewritten
+    if (from->mean == into->nodes_mean || M + F > into->cap) {
+        return td_merge_replay(into, from);
+    }
+    if (td_reserve_nodes(into, M + F) != 0) {
+        return ENOMEM;
+    }
+    if (_tdigest_long_long_add_safe(into->merged_weight, from->total_weight) == false)
+        return EDOM;
+    const long long merged_weight = into->merged_weight + from->total_weight;
+    const double total_weight = (double)merged_weight;
+    if (_check_td_overflow((double)from->total_weight, total_weight) != 0)
+        return EDOM;
+    if (total_weight <= 1) {
+        return td_merge_replay(into, from);
+    }
+    const double denom = 2 * MM_PI * total_weight * log(total_weight);
+    if (_check_overflow(denom) != 0)
+        return EDOM;
+    const double normalizer = into->compression / denom;
+    if (_check_overflow(normalizer) != 0)
+        return EDOM;
+
+    // Both runs are sorted, so they feed the k-scale pass through one linear two-way merge, like
+    // the fast path of td_compress(): into's centroids are moved up by F so the output index
+    // stays behind them, and from's are read in place.
+    double *mean = into->nodes_mean;
+    long long *weight = into->nodes_weight;
+    memmove(mean + F, mean, (size_t)M * sizeof(double));
+    memmove(weight + F, weight, (size_t)M * sizeof(long long));
+    struct td_kscale k;
+    td_kscale_init(&k, mean, weight, total_weight, normalizer);
+    td_kscale_push_merged(&k, mean + F, weight + F, M, from->mean, from->weight, F);
+    const int merged = k.cur + 1;
+    memset(mean + merged, 0, (size_t)(M + F - merged) * sizeof(double));
+    memset(weight + merged, 0, (size_t)(M + F - merged) * sizeof(long long));
+    into->merged_nodes = merged;
+    into->merged_weight = merged_weight;
+    if (from->min < into->min) {
+        into->min = from->min;
+    }
+    if (from->max > into->max) {
+        into->max = from->max;
+    }
+    into->total_compressions++;
+    td_cumulative_build(into);
+    td_recent_clear(into);
+    return 0;
+}
+
+int td_merge(td_histogram_t *into, td_histogram_t *from) {
+    if (td_compress(into) != 0)
+        return EDOM;
+    if (td_compress(from) != 0)
+        return EDOM;
+    struct td_span s;
+    td_span_from_histogram(&s, from);
+    return td_merge_span(into, &s);
+}
+
+int td_merge_many(td_histogram_t *into, td_histogram_t **froms, size_t n) {
+    if (n > 0 && NULL == froms) {
+        return EINVAL;
+    }
+    if (td_compress(into) != 0)
+        return EDOM;
+    // check the combined weight up front, so an overflow leaves into as it was
+    long long merged_weight = into->merged_weight;
+    for (size_t i = 0; i < n; i++) {
+        if (td_compress(froms[i]) != 0)
+            return EDOM;
+        if (_tdigest_long_long_add_safe(merged_weight, froms[i]->merged_weight) == false)
+            return EDOM;
+        merged_weight += froms[i]->merged_weight;
+    }
+    if (_check_td_overflow((double)(merged_weight - into->merged_weight), (double)merged_weight) !=
+        0)
+        return EDOM;
+    // grow lazily allocated nodes to cap up front, so no merge down the chain can run out of
+    // memory with into half merged
+    if (merged_weight != into->merged_weight && td_reserve_nodes(into, into->cap) != 0)
+        return ENOMEM;
+    // Each td_merge() is one linear pass over into's and from's sorted centroids, so the chain
+    // costs O(total centroids + n * compression). A single k-way merge of all runs would cost
+    // O(total centroids * log n) and is slower in practice.
+    for (size_t i = 0; i < n; i++) {
+        const int res = td_merge(into, froms[i]);
+        if (res != 0)
+            return res;
+    }
+    return 0;
+}
+
+int td_recompress(td_histogram_t **hp, double compression) {
+    td_histogram_t *h = hp ? *hp : NULL;
+    size_t capacity;
+    if (!h || !(compression <= h->compression) ||
+        capacity_from_compression(compression, &capacity) != 0) {
+        return EINVAL;
+    }
+    const int res = td_compress(h);
+    if (res != 0) {
+        return res;
+    }
+    const int M = h->merged_nodes;
+    const double total_weight = (double)h->merged_weight;
+    double normalizer = 0;
+    if (total_weight > 1) {
+        const double denom = 2 * MM_PI * total_weight * log(total_weight);
+        if (_check_overflow(denom) != 0)
+            return EDOM;
+        normalizer = compression / denom;
+        if (_check_overflow(normalizer) != 0)
+            return EDOM;
+    }
+    // Nodes in a block of the histogram's own move to a smaller block, allocated up front so that a
+    // failure leaves the histogram as it was. Caller-provided blocks keep their size.
+    td_histogram_t *moved = NULL;
+    if (h->nodes_in_block && h->owns_block && capacity < (size_t)h->cap &&
+        td_init_capacity_allocator(compression, capacity, &h->allocator, &moved) != 0) {
+        return ENOMEM;
+    }
+    td_histogram_t *out = moved ? moved : h;
+    // One k-scale pass over the sorted centroids under the new normalizer. In place, the output
+    // index never overtakes the input.
+    int merged = M;
+    if (total_weight > 1) {
+        struct td_kscale k;
+        td_kscale_init(&k, out->nodes_mean, out->nodes_weight, total_weight, normalizer);
+        for (int i = 0; i < M; i++) {
+            td_kscale_push(&k, h->nodes_mean[i], h->nodes_weight[i]);
+        }
+        merged = k.cur + 1;
+    } else if (moved) {
+        memcpy(moved->nodes_mean, h->nodes_mean, (size_t)M * sizeof(double));
+        memcpy(moved->nodes_weight, h->nodes_weight, (size_t)M * sizeof(long long));
+    }
+    if (!moved) {
+        memset(h->nodes_mean + merged, 0, (size_t)(M - merged) * sizeof(double));
+        memset(h->nodes_weight + merged, 0, (size_t)(M - merged) * sizeof(long long));
+    }
+    out->merged_nodes = merged;
+    out->merged_weight = h->merged_weight;
+    out->total_compressions = h->total_compressions + 1;
+    // the pass folded any raw samples into centroids
+    out->exact = false;
+    out->exact_threshold = __td_min(h->exact_threshold, ((int)capacity - 1) / 2);
+    if (moved) {
+        moved->min = h->min;
+        moved->max = h->max;
+        moved->ingest_flags = h->ingest_flags;
+        // sized for the larger cap, which is still enough
+        moved->recent_nodes = h->recent_nodes;
+        moved->recent_bits = h->recent_bits;
+        td_release(&h->allocator, (void *)h);
+        *hp = moved;
+    } else {
+        h->compression = compression;
+        // a caller-provided block, or a small one from td_init_ex(), only ever shrinks cap
+        h->cap = h->nodes_in_block ? __td_min((int)capacity, h->nodes_cap) : (int)capacity;
+        if (h->nodes_in_block) {
+            h->nodes_cap = h->cap;
+        }
+    }
+    td_cumulative_build(out);
+    // separately allocated nodes are shrunk to fit, as td_shrink_to_fit() does
+    return td_shrink_to_fit(out);
+}
+
+int td_init_from_centroids(double compression, const double *means, const long long *weights,
+                           size_t n, double min, double max, td_histogram_t **result) {
+    if (!result || (n > 0 && (!means || !weights)) || n > INT_MAX) {
+        return EINVAL;
+    }
+    size_t capacity;
+    if (capacity_from_compression(compression, &capacity) != 0) {
+        return EINVAL;
+    }
+    long long total_weight = 0;
+    bool sorted = true;
+    for (size_t i = 0; i < n; i++) {
+        // also rejects NaN means and bounds
+        if (!(means[i] >= min && means[i] <= max) || weights[i] <= 0) {
+            return EINVAL;
+        }
+        if (_tdigest_long_long_add_safe(total_weight, weights[i]) == false) {
+            return EDOM;
+        }
+        total_weight += weights[i];
+        sorted &= i == 0 || means[i - 1] <= means[i];
+    }
+    if (_check_td_overflow((double)total_weight, (double)total_weight) != 0) {
+        return EDOM;
+    }
+    const double denom = 2 * MM_PI * (double)total_weight * log((double)total_weight);
+    const double normalizer = compression / denom;
+    if (n > 1 && (_check_overflow(denom) != 0 || _check_overflow(normalizer) != 0)) {
+        return EDOM;
+    }
+    td_histogram_t *h = NULL;
+    if (td_init_capacity(compression, capacity, &h) != 0) {
+        return ENOMEM;
+    }
+    if (n == 0) {
+        *result = h;
+        return 0;
+    }
+    h->min = min;
+    h->max = max;
+    h->merged_weight = total_weight;
+    // Sorted centroids that leave room for the buffer and the cumulative index are loaded as they
+    // are, so a digest restored from its own centroids answers exactly as before.
+    if (sorted && 2 * n + 1 <= capacity) {
+        memcpy(h->nodes_mean, means, n * sizeof(double));
+        memcpy(h->nodes_weight, weights, n * sizeof(long long));
+        h->merged_nodes = (int)n;
+        td_cumulative_build(h);
+        *result = h;
+        return 0;
+    }
+    // Otherwise one sort (skipped for sorted input) and one k-scale pass, in place. Input larger
+    // than the node arrays, say from a digest of higher compression, goes through scratch arrays.
+    double *mean = h->nodes_mean;
+    long long *weight = h->nodes_weight;
+    if (n > capacity) {
+        mean = (double *)td_alloc(&h->allocator, n * sizeof(double));
+        weight = (long long *)td_alloc(&h->allocator, n * sizeof(long long));
+        if (!mean || !weight) {
+            td_release(&h->allocator, (void *)mean);
+            td_release(&h->allocator, (void *)weight);
+            td_free(h);
+            return ENOMEM;
+        }
+    }
+    memcpy(mean, means, n * sizeof(double));
+    memcpy(weight, weights, n * sizeof(long long));
+    if (!sorted) {
+        td_sort_nodes(&h->allocator, mean, weight, 0, (int)n - 1);
+    }
+    struct td_kscale k;
+    td_kscale_init(&k, mean, weight, (double)total_weight, normalizer);
+    for (size_t i = 0; i < n; i++) {
+        td_kscale_push(&k, mean[i], weight[i]);
+    }
+    const size_t merged = (size_t)k.cur + 1;
+    if (mean != h->nodes_mean) {
+        // the k-scale bound keeps the result far below the node capacity; checked all the same
+        if (merged <= capacity) {
+            memcpy(h->nodes_mean, mean, merged * sizeof(double));
+            memcpy(h->nodes_weight, weight, merged * sizeof(long long));
+        }
+        td_release(&h->allocator, (void *)mean);
+        td_release(&h->allocator, (void *)weight);
+        if (merged > capacity) {
+            td_free(h);
+            return EDOM;
+        }
+    } else {
+        memset(mean + merged, 0, (n - merged) * sizeof(double));
+        memset(weight + merged, 0, (n - merged) * sizeof(long long));
+    }
+    h->merged_nodes = (int)merged;
+    td_cumulative_build(h);
+    *result = h;
     return 0;
 }
 
+// Read-only merged view of a histogram for the const queries. With an empty buffer the span points
+// straight at the merged centroids; otherwise the buffer is sorted in scratch arrays and merged
+// with the centroids exactly like td_compress() does, leaving the histogram untouched.
+struct td_merged_view {
+    struct td_span span;
+    double *mean;
+    long long *weight;
+    const td_allocator_t *allocator;
+};
+
+static void td_merged_view_release(struct td_merged_view *v) {
+    td_release(v->allocator, (void *)v->mean);
+    td_release(v->allocator, (void *)v->weight);
+}
+
+static int td_merged_view_init(struct td_merged_view *v, const td_histogram_t *h) {
+    v->mean = NULL;
+    v->weight = NULL;
+    v->allocator = &h->allocator;
+    td_span_from_histogram(&v->span, h);
+    if (h->unmerged_nodes == 0) {
+        return 0;
+    }
+    const int M = h->merged_nodes;
+    const int N = M + h->unmerged_nodes;
+    const double total_weight = (double)h->merged_weight + (double)h->unmerged_weight;
+    if (_check_td_overflow((double)h->unmerged_weight, total_weight) != 0) {
+        return EDOM;
+    }
+    v->mean = (double *)td_alloc(v->allocator, (size_t)N * sizeof(double));
+    v->weight = (long long *)td_alloc(v->allocator, (size_t)N * sizeof(long long));
+    if (!v->mean || !v->weight) {
+        td_merged_view_release(v);
+        return ENOMEM;
+    }
+    // The buffer goes to the top of the scratch arrays, so the output written from index 0 stays
+    // behind it (see td_compress()); the merged run is read from the histogram itself.
+    memcpy(v->mean + M, h->nodes_mean + M, (size_t)(N - M) * sizeof(double));
+    memcpy(v->weight + M, h->nodes_weight + M, (size_t)(N - M) * sizeof(long long));
+    int merged = N;
+    if (h->exact) {
+        // folded like td_compress() does, and through the k-scale pass only past the threshold
+        memcpy(v->mean, h->nodes_mean, (size_t)M * sizeof(double));
+        memcpy(v->weight, h->nodes_weight, (size_t)M * sizeof(long long));
+        td_sort_nodes(v->allocator, v->mean, v->weight, 0, N - 1);
+        merged = td_fold_equal(v->mean, v->weight, N);
+        if (merged > h->exact_threshold && total_weight > 1) {
+            const double denom = 2 * MM_PI * total_weight * log(total_weight);
+            const double normalizer = h->compression / denom;
+            if (_check_overflow(denom) != 0 || _check_overflow(normalizer) != 0) {
+                td_merged_view_release(v);
+                return EDOM;
+            }
+            struct td_kscale k;
+            td_kscale_init(&k, v->mean, v->weight, total_weight, normalizer);
+            for (int i = 0; i < merged; i++) {
+                td_kscale_push(&k, v->mean[i], v->weight[i]);
+            }
+            merged = k.cur + 1;
+            v->span.exact = false;
+        }
+    } else if (total_weight <= 1) {
+        memcpy(v->mean, h->nodes_mean, (size_t)M * sizeof(double));
+        memcpy(v->weight, h->nodes_weight, (size_t)M * sizeof(long long));
+        td_sort_nodes(v->allocator, v->mean, v->weight, 0, N - 1);
+    } else {
+        const double denom = 2 * MM_PI * total_weight * log(total_weight);
+        const double normalizer = h->compression / denom;
+        if (_check_overflow(denom) != 0 || _check_overflow(normalizer) != 0) {
+            td_merged_view_release(v);
+            return EDOM;
+        }
+        struct td_kscale k;
+        td_kscale_init(&k, v->mean, v->weight, total_weight, normalizer);
+        // the path td_compress() takes, so that tied means end up in the same centroids: the
+        // linear merge when it has room to park the prefix, otherwise one sort of the whole range
+        if (M > 0 && N + M <= h->cap) {
+            td_sort_nodes(v->allocator, v->mean, v->weight, M, N - 1);
+            td_kscale_push_merged(&k, h->nodes_mean, h->nodes_weight, M, v->mean + M,
+                                  v->weight + M, N - M);
+        } else {
+            memcpy(v->mean, h->nodes_mean, (size_t)M * sizeof(double));
+            memcpy(v->weight, h->nodes_weight, (size_t)M * sizeof(long long));
+            td_sort_nodes(v->allocator, v->mean, v->weight, 0, N - 1);
+            for (int i = 0; i < N; i++) {
+                td_kscale_push(&k, v->mean[i], v->weight[i]);
+            }
+        }
+        merged = k.cur + 1;
+    }
+    v->span.mean = v->mean;
+    v->span.weight = v->weight;
+    v->span.cumulative = NULL;
+    v->span.n = merged;
+    v->span.total_weight = h->merged_weight + h->unmerged_weight;
+    return 0;
+}
+
+double td_cdf_const(const td_histogram_t *h, double val) {
+    struct td_merged_view v;
+    if (td_merged_view_init(&v, h) != 0) {
+        return NAN;
+    }
+    const double res = td_span_cdf(&v.span, val);
+    td_merged_view_release(&v);
+    return res;
+}
+
+double td_quantile_const(const td_histogram_t *h, double q) {
+    struct td_merged_view v;
+    if (td_merged_view_init(&v, h) != 0) {
+        return NAN;
+    }
+    const double res = td_span_quantile(&v.span, q);
+    td_merged_view_release(&v);
+    return res;
+}
+
+int td_quantiles_const(const td_histogram_t *h, const double *quantiles, double *values,
+                       size_t length) {
+    struct td_merged_view v;
+    const int view_res = td_merged_view_init(&v, h);
+    if (view_res != 0) {
+        return view_res;
+    }
+    const int res = td_span_quantiles(&v.span, quantiles, values, length);
+    td_merged_view_release(&v);
+    return res;
+}
+
+int td_merge_const(td_histogram_t *into, const td_histogram_t *from) {
+    if (td_compress(into) != 0)
+        return EDOM;
+    struct td_merged_view v;
+    const int view_res = td_merged_view_init(&v, from);
+    if (view_res != 0) {
+        return view_res;
+    }
+    const int res = td_merge_span(into, &v.span);
+    td_merged_view_release(&v);
+    return res;
+}
+
+double td_trimmed_mean_const(const td_histogram_t *h, double leftmost_cut, double rightmost_cut) {
+    struct td_merged_view v;
+    if (td_merged_view_init(&v, h) != 0) {
+        return NAN;
+    }
+    const double res = td_span_trimmed_mean(&v.span, leftmost_cut, rightmost_cut);
+    td_merged_view_release(&v);
+    return res;
+}
+
+double td_trimmed_mean_symmetric_const(const td_histogram_t *h, double proportion_to_cut) {
+    return td_trimmed_mean_const(h, proportion_to_cut, 1.0 - proportion_to_cut);
+}
+
 double td_min(td_histogram_t *h) { return h->min; }
 
 double td_max(td_histogram_t *h) { return h->max; }
@@ -832,8 +2224,584 @@ const double *td_centroids_mean(td_histogram_t *h) { return h->nodes_mean; }
 long long td_centroids_weight_at(td_histogram_t *h, int pos) { return h->nodes_weight[pos]; }
 
 double td_centroids_mean_at(td_histogram_t *h, int pos) {
-    if (pos < 0 || pos > h->merged_nodes) {
+    // the slots past the centroids hold the cumulative index, not means
+    if (pos < 0 || pos >= next_node(h)) {
         return NAN;
     }
     return h->nodes_mean[pos];
 }
+
+struct td_compact {
+    double compression;
+    double min;
+    double max;
+    long long total_weight;
+    // node capacity of the source histogram, restored by td_expand()
+    int cap;
+    int centroids;
+    // narrow snapshots set mean_f/weight_u32, wide ones mean/weight; all point into the same
+    // allocation
+    const double *mean;
+    const long long *weight;
+    const float *mean_f;
+    const uint32_t *weight_u32;
+};
+
+static inline void td_span_from_compact(struct td_span *s, const td_compact_t *c) {
+    s->mean = c->mean;
+    s->weight = c->weight;
+    s->mean_f = c->mean_f;
+    s->weight_u32 = c->weight_u32;
+    s->cumulative = NULL;
+    s->narrow = c->mean_f != NULL;
+    s->exact = false;
+    s->n = c->centroids;
+    s->total_weight = c->total_weight;
+    s->min = c->min;
+    s->max = c->max;
+}
+
+// Round a centroid mean to float, nudging it by one ulp if rounding pushed it outside [min, max].
+// Rounding is monotonic, and so is the nudge, so the centroid order is preserved.
+static inline float td_mean_to_float(double mean, double min, double max) {
+    float f = (float)mean;
+    if ((double)f < min) {
+        const float up = nextafterf(f, INFINITY);
+        if ((double)up <= max) {
+            f = up;
+        }
+    } else if ((double)f > max) {
+        const float down = nextafterf(f, -INFINITY);
+        if ((double)down >= min) {
+            f = down;
+        }
+    }
+    return f;
+}
+
+int td_compact(td_histogram_t *h, td_compact_t **result) {
+    if (!h || !result) {
+        return EINVAL;
+    }
+    if (td_compress(h) != 0) {
+        return EDOM;
+    }
+    const int n = h->merged_nodes;
+    // a single mean outside the normal float range or weight beyond 32 bits keeps the whole
+    // snapshot wide; below FLT_MIN floats lose precision, down to flushing means to zero
+    bool wide = false;
+    for (int i = 0; i < n; i++) {
+        const double magnitude = fabs(h->nodes_mean[i]);
+        wide |= magnitude > FLT_MAX || (magnitude != 0 && magnitude < FLT_MIN);
+        wide |= h->nodes_weight[i] > (long long)UINT32_MAX;
+    }
+    // one block: the header, then the weights, then the means
+    const size_t header = (sizeof(td_compact_t) + 7) & ~(size_t)7;
+    const size_t weight_size = (size_t)n * (wide ? sizeof(long long) : sizeof(uint32_t));
+    const size_t mean_size = (size_t)n * (wide ? sizeof(double) : sizeof(float));
+    char *block = (char *)td_malloc_(header + weight_size + mean_size);
+    if (!block) {
+        return ENOMEM;
+    }
+    td_compact_t *c = (td_compact_t *)block;
+    c->compression = h->compression;
+    c->min = h->min;
+    c->max = h->max;
+    c->total_weight = h->merged_weight;
+    c->cap = h->cap;
+    c->centroids = n;
+    c->mean = NULL;
+    c->weight = NULL;
+    c->mean_f = NULL;
+    c->weight_u32 = NULL;
+    if (wide) {
+        long long *weight = (long long *)(block + header);
+        double *mean = (double *)(block + header + weight_size);
+        memcpy(weight, h->nodes_weight, weight_size);
+        memcpy(mean, h->nodes_mean, mean_size);
+        c->weight = weight;
+        c->mean = mean;
+    } else {
+        uint32_t *weight_u32 = (uint32_t *)(block + header);
+        float *mean_f = (float *)(block + header + weight_size);
+        for (int i = 0; i < n; i++) {
+            weight_u32[i] = (uint32_t)h->nodes_weight[i];
+            mean_f[i] = td_mean_to_float(h->nodes_mean[i], h->min, h->max);
+        }
+        c->weight_u32 = weight_u32;
+        c->mean_f = mean_f;
+    }
+    *result = c;
+    return 0;
+}
+
+int td_expand(const td_compact_t *c, td_histogram_t **result) {
+    if (!c || !result) {
+        return EINVAL;
+    }
+    td_histogram_t *h = NULL;
+    if (td_init_capacity(c->compression, (size_t)c->cap, &h) != 0) {
+        return ENOMEM;
+    }
+    struct td_span s;
+    td_span_from_compact(&s, c);
+    for (int i = 0; i < c->centroids; i++) {
+        h->nodes_mean[i] = td_span_mean(&s, s.narrow, i);
+        h->nodes_weight[i] = s.narrow ? (long long)c->weight_u32[i] : c->weight[i];
+    }
+    h->min = c->min;
+    h->max = c->max;
+    h->merged_nodes = c->centroids;
+    h->merged_weight = c->total_weight;
+    td_cumulative_build(h);
+    *result = h;
+    return 0;
+}
+
+void td_compact_free(td_compact_t *c) {
+    if (!c) {
+        return;
+    }
+    td_free_((void *)c);
+}
+
+double td_compact_cdf(const td_compact_t *c, double val) {
+    struct td_span s;
+    td_span_from_compact(&s, c);
+    return td_span_cdf(&s, val);
+}
+
+double td_compact_quantile(const td_compact_t *c, double q) {
+    struct td_span s;
+    td_span_from_compact(&s, c);
+    return td_span_quantile(&s, q);
+}
+
+int td_compact_quantiles(const td_compact_t *c, const double *quantiles, double *values,
+                         size_t length) {
+    struct td_span s;
+    td_span_from_compact(&s, c);
+    return td_span_quantiles(&s, quantiles, values, length);
+}
+
+long long td_compact_size(const td_compact_t *c) { return c->total_weight; }
+
+int td_compact_centroid_count(const td_compact_t *c) { return c->centroids; }
+
+size_t td_compact_bytes(const td_compact_t *c) {
+    const size_t header = (sizeof(td_compact_t) + 7) & ~(size_t)7;
+    const size_t n = (size_t)c->centroids;
+    return header + n * (c->mean_f ? sizeof(float) + sizeof(uint32_t)
+                                   : sizeof(double) + sizeof(long long));
+}
+
+// Serialized form, all integers little-endian:
+//   "TD" and a format version byte
+//   compression, min and max as 8-byte IEEE doubles
+//   varint node capacity and varint centroid count
+//   per centroid: varint mean and varint weight
+// A mean is stored as the difference between its order-preserving key (td_double_to_key()) and the
+// previous centroid's, the first one as its full key; the means are sorted, so the differences are
+// non-negative and the small ones between close centroids take few bytes. Weights are stored as
+// their unsigned 64-bit image.
+#define TD_SERIAL_MAGIC_0 'T'
+#define TD_SERIAL_MAGIC_1 'D'
+#define TD_SERIAL_VERSION 1
+#define TD_SERIAL_HEADER 27
+
+static inline size_t td_varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
+    }
+    return n;
+}
+
+static inline unsigned char *td_varint_put(unsigned char *p, uint64_t v) {
+    while (v >= 0x80) {
+        *p++ = (unsigned char)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (unsigned char)v;
+    return p;
+}
+
+// Returns NULL on a truncated or over-long varint.
+static inline const unsigned char *td_varint_get(const unsigned char *p, const unsigned char *end,
+                                                 uint64_t *v) {
+    uint64_t result = 0;
+    for (int shift = 0; shift < 64 && p < end; shift += 7) {
+        const unsigned char byte = *p++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            *v = result;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline unsigned char *td_double_put(unsigned char *p, double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    for (int i = 0; i < 8; i++) {
+        *p++ = (unsigned char)(bits >> (8 * i));
+    }
+    return p;
+}
+
+static inline double td_double_get(const unsigned char *p) {
+    uint64_t bits = 0;
+    for (int i = 0; i < 8; i++) {
+        bits |= (uint64_t)p[i] << (8 * i);
+    }
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Size of the serialized form of a compressed histogram.
+static size_t td_serialized_size_compressed(const td_histogram_t *h) {
+    size_t size = TD_SERIAL_HEADER + td_varint_size((uint64_t)h->cap) +
+                  td_varint_size((uint64_t)h->merged_nodes);
+    uint64_t prev = 0;
+    for (int i = 0; i < h->merged_nodes; i++) {
+        const uint64_t key = td_double_to_key(h->nodes_mean[i]);
+        size += td_varint_size(key - prev) + td_varint_size((uint64_t)h->nodes_weight[i]);
+        prev = key;
+    }
+    return size;
+}
+
+size_t td_serialized_size(td_histogram_t *h) {
+    if (td_compress(h) != 0) {
+        return 0;
+    }
+    return td_serialized_size_compressed(h);
+}
+
+int td_serialize(td_histogram_t *h, void *buf, size_t buf_len, size_t *written) {
+    if (!buf) {
+        return EINVAL;
+    }
+    if (td_compress(h) != 0) {
+        return EDOM;
+    }
+    const size_t size = td_serialized_size_compressed(h);
+    if (buf_len < size) {
+        return EINVAL;
+    }
+    unsigned char *p = (unsigned char *)buf;
+    *p++ = TD_SERIAL_MAGIC_0;
+    *p++ = TD_SERIAL_MAGIC_1;
+    *p++ = TD_SERIAL_VERSION;
+    p = td_double_put(p, h->compression);
+    p = td_double_put(p, h->min);
+    p = td_double_put(p, h->max);
+    p = td_varint_put(p, (uint64_t)h->cap);
+    p = td_varint_put(p, (uint64_t)h->merged_nodes);
+    uint64_t prev = 0;
+    for (int i = 0; i < h->merged_nodes; i++) {
+        const uint64_t key = td_double_to_key(h->nodes_mean[i]);
+        p = td_varint_put(p, key - prev);
+        p = td_varint_put(p, (uint64_t)h->nodes_weight[i]);
+        prev = key;
+    }
+    if (written) {
+        *written = size;
+    }
+    return 0;
+}
+
+int td_deserialize(const void *buf, size_t buf_len, td_histogram_t **result) {
+    if (!buf || !result) {
+        return EINVAL;
+    }
+    const unsigned char *p = (const unsigned char *)buf;
+    const unsigned char *end = p + buf_len;
+    if (buf_len < TD_SERIAL_HEADER || p[0] != TD_SERIAL_MAGIC_0 || p[1] != TD_SERIAL_MAGIC_1 ||
+        p[2] != TD_SERIAL_VERSION) {
+        return EINVAL;
+    }
+    const double compression = td_double_get(p + 3);
+    const double min = td_double_get(p + 11);
+    const double max = td_double_get(p + 19);
+    p += TD_SERIAL_HEADER;
+    uint64_t cap64;
+    uint64_t count64;
+    size_t capacity;
+    // the smallest capacity a histogram of this compression can have, from td_init_ex() with a
+    // one-node buffer, and the default one
+    size_t min_capacity;
+    size_t default_capacity;
+    if (capacity_from_compression_and_buffer(compression, 1, &min_capacity) != 0 ||
+        capacity_from_compression(compression, &default_capacity) != 0 ||
+        !(p = td_varint_get(p, end, &cap64)) || !(p = td_varint_get(p, end, &count64)) ||
+        count64 > cap64 || capacity_from_uint64(cap64, &capacity) != 0 ||
+        capacity < min_capacity) {
+        return EINVAL;
+    }
+    // A larger td_init_ex() buffer is not restored: the recorded capacity is untrusted, and
+    // honouring it would let a few bytes of input commit gigabytes.
+    if (capacity > default_capacity) {
+        capacity = default_capacity;
+    }
+    if (count64 > capacity) {
+        return EINVAL;
+    }
+    // every centroid takes at least two bytes, so a bogus count cannot force a large allocation
+    if (count64 > (uint64_t)(end - p) / 2) {
+        return EINVAL;
+    }
+    td_histogram_t *h = NULL;
+    if (td_init_capacity(compression, capacity, &h) != 0) {
+        return ENOMEM;
+    }
+    // decoded straight into the merged prefix, already in order
+    const int count = (int)count64;
+    double *mean = h->nodes_mean;
+    long long *weight = h->nodes_weight;
+    long long total_weight = 0;
+    uint64_t key = 0;
+    for (int i = 0; i < count; i++) {
+        uint64_t delta;
+        uint64_t w;
+        if (!(p = td_varint_get(p, end, &delta)) || !(p = td_varint_get(p, end, &w)) ||
+            key + delta < key) {
+            td_free(h);
+            return EINVAL;
+        }
+        key += delta;
+        mean[i] = td_key_to_double(key);
+        if (!isfinite(mean[i]) || !(mean[i] >= min && mean[i] <= max) || w == 0 ||
+            w > (uint64_t)INT64_MAX) {
+            td_free(h);
+            return EINVAL;
+        }
+        weight[i] = (long long)w;
+        if (!_tdigest_long_long_add_safe(total_weight, weight[i])) {
+            td_free(h);
+            return EINVAL;
+        }
+        total_weight += weight[i];
+    }
+    if (p != end || (count > 0 && !(min <= max))) {
+        td_free(h);
+        return EINVAL;
+    }
+    h->min = min;
+    h->max = max;
+    h->merged_nodes = count;
+    h->merged_weight = total_weight;
+    td_cumulative_build(h);
+    *result = h;
+    return 0;
+}
+
+// Fixed view layout, in host byte order with every field 8-byte aligned, so a td_view_t can point
+// its arrays straight into the buffer:
+//   offset  0: uint32 TD_VIEW_MAGIC, uint32 TD_VIEW_VERSION
+//   offset  8: compression, min and max as doubles
+//   offset 32: int64 total weight
+//   offset 40: int32 node capacity, int32 centroid count n
+//   offset 48: n double means, n int64 weights, then n + 1 double cumulative weights
+// The cumulative weights are the same prefix sums td_cumulative_build() keeps, so the view queries
+// binary-search them instead of scanning. A buffer written on a host of the other byte order reads
+// back a byte-swapped magic and is rejected.
+#define TD_VIEW_MAGIC 0x57564454u
+#define TD_VIEW_VERSION 1u
+#define TD_VIEW_HEADER 48
+
+static inline size_t td_view_layout_size(size_t centroids) {
+    return TD_VIEW_HEADER + (3 * centroids + 1) * sizeof(double);
+}
+
+size_t td_view_serialized_size(td_histogram_t *h) {
+    if (td_compress(h) != 0) {
+        return 0;
+    }
+    return td_view_layout_size((size_t)h->merged_nodes);
+}
+
+int td_view_serialize(td_histogram_t *h, void *buf, size_t buf_len, size_t *written) {
+    if (!buf) {
+        return EINVAL;
+    }
+    if (td_compress(h) != 0) {
+        return EDOM;
+    }
+    const size_t n = (size_t)h->merged_nodes;
+    const size_t size = td_view_layout_size(n);
+    if (buf_len < size) {
+        return EINVAL;
+    }
+    unsigned char *p = (unsigned char *)buf;
+    const uint32_t magic = TD_VIEW_MAGIC;
+    const uint32_t version = TD_VIEW_VERSION;
+    const int64_t total_weight = h->merged_weight;
+    // a larger buffer, from td_init_ex(), is not kept: td_view_open() bounds the capacity by the
+    // compression, so that a header cannot make td_view_expand() allocate at will
+    // the compression of a histogram is always valid; initialized all the same
+    size_t default_cap = (size_t)h->cap;
+    capacity_from_compression(h->compression, &default_cap);
+    const int32_t cap = (int32_t)__td_min((size_t)h->cap, default_cap);
+    const int32_t centroids = h->merged_nodes;
+    memcpy(p, &magic, 4);
+    memcpy(p + 4, &version, 4);
+    memcpy(p + 8, &h->compression, 8);
+    memcpy(p + 16, &h->min, 8);
+    memcpy(p + 24, &h->max, 8);
+    memcpy(p + 32, &total_weight, 8);
+    memcpy(p + 40, &cap, 4);
+    memcpy(p + 44, &centroids, 4);
+    p += TD_VIEW_HEADER;
+    memcpy(p, h->nodes_mean, n * sizeof(double));
+    p += n * sizeof(double);
+    memcpy(p, h->nodes_weight, n * sizeof(long long));
+    p += n * sizeof(long long);
+    // summed in the same order as td_cumulative_build(), so view and histogram answers agree
+    double cumulative = 0;
+    memcpy(p, &cumulative, sizeof(double));
+    for (size_t i = 0; i < n; i++) {
+        cumulative += (double)h->nodes_weight[i];
+        memcpy(p + (i + 1) * sizeof(double), &cumulative, sizeof(double));
+    }
+    if (written) {
+        *written = size;
+    }
+    return 0;
+}
+
+int td_view_open(td_view_t *v, const void *buf, size_t buf_len) {
+    if (!v || !buf || ((uintptr_t)buf & 7) != 0 || buf_len < TD_VIEW_HEADER) {
+        return EINVAL;
+    }
+    const unsigned char *p = (const unsigned char *)buf;
+    uint32_t magic;
+    uint32_t version;
+    double compression;
+    double min;
+    double max;
+    int64_t total_weight;
+    int32_t cap;
+    int32_t centroids;
+    memcpy(&magic, p, 4);
+    memcpy(&version, p + 4, 4);
+    memcpy(&compression, p + 8, 8);
+    memcpy(&min, p + 16, 8);
+    memcpy(&max, p + 24, 8);
+    memcpy(&total_weight, p + 32, 8);
+    memcpy(&cap, p + 40, 4);
+    memcpy(&centroids, p + 44, 4);
+    // the capacities a histogram of this compression can have, from td_init_ex() with a one-node
+    // buffer up to td_init()
+    size_t min_cap;
+    size_t max_cap;
+    if (magic != TD_VIEW_MAGIC || version != TD_VIEW_VERSION ||
+        capacity_from_compression_and_buffer(compression, 1, &min_cap) != 0 ||
+        capacity_from_compression(compression, &max_cap) != 0 || cap < 0 ||
+        (size_t)cap < min_cap || (size_t)cap > max_cap || total_weight < 0 || centroids < 0 ||
+        cap < centroids || (centroids > 0 && !(min <= max)) ||
+        (size_t)centroids > (SIZE_MAX - TD_VIEW_HEADER) / (3 * sizeof(double)) - 1 ||
+        buf_len != td_view_layout_size((size_t)centroids)) {
+        return EINVAL;
+    }
+    const size_t n = (size_t)centroids;
+    v->compression = compression;
+    v->min = min;
+    v->max = max;
+    v->total_weight = total_weight;
+    v->cap = cap;
+    v->centroids = centroids;
+    v->mean = (const double *)(p + TD_VIEW_HEADER);
+    v->weight = (const long long *)(v->mean + n);
+    v->cumulative = (const double *)(v->weight + n);
+    return 0;
+}
+
+static inline void td_span_from_view(struct td_span *s, const td_view_t *v) {
+    s->mean = v->mean;
+    s->weight = v->weight;
+    s->mean_f = NULL;
+    s->weight_u32 = NULL;
+    s->cumulative = v->cumulative;
+    s->narrow = false;
+    s->exact = false;
+    s->n = v->centroids;
+    s->total_weight = v->total_weight;
+    s->min = v->min;
+    s->max = v->max;
+}
+
+double td_view_cdf(const td_view_t *v, double val) {
+    struct td_span s;
+    td_span_from_view(&s, v);
+    return td_span_cdf_layout(&s, false, val);
+}
+
+double td_view_quantile(const td_view_t *v, double q) {
+    struct td_span s;
+    td_span_from_view(&s, v);
+    return td_span_quantile_layout(&s, false, q);
+}
+
+int td_view_quantiles(const td_view_t *v, const double *quantiles, double *values, size_t length) {
+    struct td_span s;
+    td_span_from_view(&s, v);
+    return td_span_quantiles_layout(&s, false, quantiles, values, length);
+}
+
+int td_view_cdfs(const td_view_t *v, const double *xs, double *out, size_t length) {
+    struct td_span s;
+    td_span_from_view(&s, v);
+    return td_span_cdfs_layout(&td_default_allocator, &s, false, xs, out, length, 1);
+}
+
+double td_view_trimmed_mean(const td_view_t *v, double leftmost_cut, double rightmost_cut) {
+    struct td_span s;
+    td_span_from_view(&s, v);
+    return td_span_trimmed_mean(&s, leftmost_cut, rightmost_cut);
+}
+
+double td_view_trimmed_mean_symmetric(const td_view_t *v, double proportion_to_cut) {
+    return td_view_trimmed_mean(v, proportion_to_cut, 1.0 - proportion_to_cut);
+}
+
+long long td_view_size(const td_view_t *v) { return v->total_weight; }
+
+int td_view_centroid_count(const td_view_t *v) { return v->centroids; }
+
+int td_view_expand(const td_view_t *v, td_histogram_t **result) {
+    if (!v || !result) {
+        return EINVAL;
+    }
+    // the queries of a view trust its centroids, but a histogram outlives the buffer: check them
+    // before copying, as td_deserialize() does
+    long long total_weight = 0;
+    for (int i = 0; i < v->centroids; i++) {
+        const double mean = v->mean[i];
+        const long long weight = v->weight[i];
+        if (!(mean >= v->min && mean <= v->max) || (i > 0 && mean < v->mean[i - 1]) ||
+            weight <= 0 || !_tdigest_long_long_add_safe(total_weight, weight)) {
+            return EINVAL;
+        }
+        total_weight += weight;
+    }
+    if (total_weight != v->total_weight) {
+        return EINVAL;
+    }
+    td_histogram_t *h = NULL;
+    if (td_init_capacity(v->compression, (size_t)v->cap, &h) != 0) {
+        return ENOMEM;
+    }
+    memcpy(h->nodes_mean, v->mean, (size_t)v->centroids * sizeof(double));
+    memcpy(h->nodes_weight, v->weight, (size_t)v->centroids * sizeof(long long));
+    h->min = v->min;
+    h->max = v->max;
+    h->merged_nodes = v->centroids;
+    h->merged_weight = v->total_weight;
+    td_cumulative_build(h);
+    *result = h;
+    return 0;
+}
@@ -1,5 +1,7 @@
 #pragma once
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 
 /**
  * Adaptive histogram based on something like streaming k-means crossed with Q-digest.
@@ -25,6 +27,25 @@
 
 #define MM_PI 3.14159265358979323846
 
+// Ingest flags, see td_set_ingest_flags().
+#define TD_COLLAPSE_DUPLICATES 0x1
+
+/**
+ * Runtime allocator for a histogram, see td_init_with_allocator().
+ *
+ * Histograms created without one use the compile-time allocator of td_malloc.h.
+ */
+struct td_allocator {
+    // returns `size` bytes aligned for any type, or NULL on failure
+    void *(*alloc)(void *ctx, size_t size);
+    // releases memory returned by alloc; may be NULL for allocators freed as a whole (arenas)
+    void (*release)(void *ctx, void *ptr);
+    // passed to both hooks
+    void *ctx;
+};
+
+typedef struct td_allocator td_allocator_t;
+
 struct td_histogram {
     // compression is a setting used to configure the size of centroids when merged.
     double compression;
@@ -34,6 +55,8 @@ struct td_histogram {
 
     // cap is the total size of nodes
     int cap;
+    // nodes_cap is the number of node slots allocated, cap unless allocated lazily
+    int nodes_cap;
     // merged_nodes is the number of merged nodes at the front of nodes.
     int merged_nodes;
     // unmerged_nodes is the number of buffered nodes.
@@ -42,15 +65,57 @@ struct td_histogram {
     // we run the merge in reverse every other merge to avoid left-to-right bias in merging
     long long total_compressions;
 
+    // TD_* ingest flags
+    int ingest_flags;
+    // open-addressed table of buffer positions indexed by a hash of the node mean, with
+    // 1 << recent_bits slots; only allocated while TD_COLLAPSE_DUPLICATES is set
+    int *recent_nodes;
+    int recent_bits;
+
+    // raw samples are kept while there are at most exact_threshold distinct ones, see
+    // td_set_exact_threshold(); exact is set while they are
+    int exact_threshold;
+    bool exact;
+
     long long merged_weight;
     long long unmerged_weight;
 
+    // both point into the block holding this header, see td_required_size(), or into one separate
+    // allocation with nodes_in_block false, see td_init_lazy()
     double *nodes_mean;
     long long *nodes_weight;
+
+    // false for histograms initialised in caller-provided memory by td_init_in_place()
+    bool owns_block;
+    bool nodes_in_block;
+
+    // every allocation made on behalf of the histogram, including its block, goes through it
+    td_allocator_t allocator;
 };
 
 typedef struct td_histogram td_histogram_t;
 
+// Read-only compact snapshot of a histogram, see td_compact().
+typedef struct td_compact td_compact_t;
+
+// Read-only view of a histogram serialized by td_view_serialize(), see td_view_open(). Every
+// pointer points into the caller's buffer, which must outlive the view.
+struct td_view {
+    double compression;
+    double min;
+    double max;
+    long long total_weight;
+    // node capacity of the source histogram, at most that of td_init() at this compression
+    int cap;
+    int centroids;
+    const double *mean;
+    const long long *weight;
+    // cumulative[i] is the total weight of centroids [0, i)
+    const double *cumulative;
+};
+
+typedef struct td_view td_view_t;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -84,6 +149,141 @@ td_histogram_t *td_new(double compression);
  */
 int td_init(double compression, td_histogram_t **result);
 
+/**
+ * Allocate the memory and initialise the t-digest with an explicit unmerged buffer size.
+ *
+ * td_init() sizes the buffer from compression alone (5 * compression slots). A larger buffer
+ * makes td_compress() run less often on high-rate digests at the cost of memory; a smaller one
+ * keeps rarely updated digests small. Accuracy is governed by `compression` only.
+ *
+ * @param compression The compression parameter, see td_init().
+ * @param buffer_size Number of node slots reserved for unmerged samples, on top of the
+ * compression + 10 slots reserved for merged centroids. While few centroids are merged, part of
+ * the buffer is used by td_compress() as scratch space, and while the merged centroids leave
+ * their slots unused the buffer can hold a few more samples, so the number of samples accepted
+ * between compressions is approximately, not exactly, `buffer_size`.
+ * @param result Output parameter to capture allocated histogram, left untouched on failure.
+ * @return 0 on success, 1 if `compression` is invalid (see td_init()), `buffer_size` is <= 0,
+ * the resulting capacity would overflow, or if allocation failed.
+ */
+int td_init_ex(double compression, int buffer_size, td_histogram_t **result);
+
+/**
+ * Allocate the memory and initialise the t-digest through a runtime allocator.
+ *
+ * The allocator is copied into the histogram and serves every allocation made on its behalf: its
+ * block, the TD_COLLAPSE_DUPLICATES table and the scratch arrays of compressions and queries. So a
+ * histogram can live in a per-thread pool or a per-tenant arena, and an arena that is reset as a
+ * whole takes its histograms with it, without a td_free() per histogram. Histograms created by
+ * the other functions (td_init(), td_deserialize(), td_view_expand(), ...) use the td_malloc.h
+ * allocator.
+ *
+ * @param compression The compression parameter, see td_init().
+ * @param buffer_size Number of node slots reserved for unmerged samples, see td_init_ex(), or 0 for
+ * the default of td_init().
+ * @param allocator The allocator; `ctx` must outlive the histogram.
+ * @param result Output parameter to capture allocated histogram, left untouched on failure.
+ * @return 0 on success, 1 if an argument is NULL, `allocator->alloc` is NULL, `compression` is
+ * invalid (see td_init()), `buffer_size` is negative, the resulting capacity would overflow, or if
+ * allocation failed.
+ */
+int td_init_with_allocator(double compression, int buffer_size, const td_allocator_t *allocator,
+                           td_histogram_t **result);
+
+/**
+ * Allocate the memory and initialise a t-digest whose node arrays start small and grow with it.
+ *
+ * td_init() allocates the node arrays for cap = 6 * compression + 10 nodes up front, about 10 KB
+ * at compression 100. Here they start at a few nodes, outside the histogram's block, and double
+ * as samples arrive until they reach cap, so a digest holding a handful of samples stays a few
+ * hundred bytes. The digest itself is the one td_init() builds: same buffer, same compressions,
+ * same answers. See td_shrink_to_fit() to hand memory back once a digest has gone cold.
+ *
+ * @param compression The compression parameter, see td_init().
+ * @param result Output parameter to capture allocated histogram, left untouched on failure.
+ * @return 0 on success, 1 if `result` is NULL, `compression` is invalid (see td_init()) or if
+ * allocation failed.
+ */
+int td_init_lazy(double compression, td_histogram_t **result);
+
+/**
+ * Compresses a histogram and, if its node arrays were allocated by td_init_lazy(), shrinks them to
+ * the merged centroids plus their cumulative index. The arrays grow back on the next samples.
+ * Histograms with their nodes in their block are only compressed.
+ *
+ * @return 0 on success, EDOM if compressing overflowed, ENOMEM if allocation failed; the
+ * histogram is left compressed but unshrunk on ENOMEM.
+ */
+int td_shrink_to_fit(td_histogram_t *h);
+
+/**
+ * Returns the bytes a histogram holds: its block, node arrays allocated separately and the
+ * TD_COLLAPSE_DUPLICATES table, excluding allocator overhead. For a histogram from
+ * td_init_in_place() the block is counted even though the caller owns it.
+ */
+size_t td_memory_usage(const td_histogram_t *h);
+
+/**
+ * Returns the number of bytes td_init_in_place() needs for a histogram of the given compression.
+ *
+ * Every histogram lives in a single block: the header, then the centroid means and the centroid
+ * weights, each array starting on a cache line of its own. td_init() allocates such a block;
+ * td_init_in_place() lays one out in memory the caller provides.
+ *
+ * @param compression The compression parameter, see td_init().
+ * @return The block size, or 0 if `compression` is invalid (see td_init()).
+ */
+size_t td_required_size(double compression);
+
+/**
+ * Initialise a t-digest in caller-provided memory, such as an arena or a slab page, without
+ * allocating.
+ *
+ * The header holds absolute pointers into the block, so the block must not be relocated: neither
+ * copied or moved, nor mapped at another address, as shared memory is by another process. The
+ * histogram is only usable at the address it was initialised at. td_free() releases only what the histogram allocated on its own (the
+ * TD_COLLAPSE_DUPLICATES table, see td_set_ingest_flags()) and never `mem`; it is the caller's
+ * to free once the histogram is no longer used.
+ *
+ * @param mem The block, 8-byte aligned.
+ * @param size Size of `mem`, at least td_required_size(compression).
+ * @param compression The compression parameter, see td_init().
+ * @param result Output parameter to capture the histogram (at `mem`), left untouched on failure.
+ * @return 0 on success, 1 if an argument is NULL, `mem` is misaligned, `compression` is invalid
+ * (see td_init()) or `size` is too small.
+ */
+int td_init_in_place(void *mem, size_t size, double compression, td_histogram_t **result);
+
+/**
+ * Allocate the memory and initialise the t-digest with an explicit unmerged buffer size.
+ *
+ * @see td_init_ex()
+ * @return the histogram on success, NULL on failure.
+ */
+td_histogram_t *td_new_ex(double compression, int buffer_size);
+
+/**
+ * Allocate and initialise a t-digest holding the given centroids, for example ones persisted by
+ * the caller or exported by another t-digest implementation.
+ *
+ * Sorted centroids that fit the merged region are loaded as they are, in O(n). Unsorted ones, or
+ * more than fit, are sorted once and folded by one k-scale pass, exactly as td_compress() would,
+ * without going through td_add() and the unmerged buffer.
+ *
+ * @param compression The compression parameter, see td_init().
+ * @param means The centroid means.
+ * @param weights The centroid weights, all > 0.
+ * @param n The number of centroids.
+ * @param min The smallest value added to the digest; <= every mean. Ignored when `n` is 0.
+ * @param max The largest value added to the digest; >= every mean. Ignored when `n` is 0.
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, EINVAL if `compression` is invalid (see td_init()), an array is NULL
+ * while `n` > 0, `n` > INT_MAX, a weight is <= 0, or a mean is NaN or outside [min, max], EDOM
+ * if the weights overflow when summed, ENOMEM if allocation failed.
+ */
+int td_init_from_centroids(double compression, const double *means, const long long *weights,
+                           size_t n, double min, double max, td_histogram_t **result);
+
 /**
  * Frees the memory associated with the t-digest.
  *
@@ -103,6 +303,57 @@ void td_free(td_histogram_t *h);
  */
 void td_reset(td_histogram_t *h);
 
+/**
+ * Sets the ingest flags of a histogram. The flags persist across td_reset().
+ *
+ * TD_COLLAPSE_DUPLICATES: when a sample equals the mean of a recently buffered one, its weight is
+ * added to that buffered node instead of taking a new slot. Suited to quantized streams (e.g.
+ * integer latencies), where the buffer then fills, and td_compress() runs, far less often.
+ * Matching uses the last buffered node and a hash table of the buffered values (4 bytes per node
+ * slot, allocated while the flag is set). A repeat can still take its own node after a long run
+ * of hash collisions, which only costs buffer space.
+ *
+ * @param h "This" pointer
+ * @param flags A bitwise OR of TD_* ingest flags, or 0 for the default behaviour.
+ * @return 0 on success, ENOMEM if the hash table could not be allocated, in which case the flags
+ * are unchanged.
+ */
+int td_set_ingest_flags(td_histogram_t *h, int flags);
+
+/**
+ * Returns the ingest flags of a histogram.
+ */
+int td_ingest_flags(td_histogram_t *h);
+
+/**
+ * Keeps the raw samples of a histogram, rather than centroids, while it holds at most `threshold`
+ * distinct values.
+ *
+ * For a digest that only ever sees a few hundred samples the centroids are both larger and less
+ * accurate than the samples themselves. In the exact phase td_compress() only sorts the samples
+ * and folds equal values, and td_cdf(), td_quantile() and their batch and const variants answer
+ * exactly: td_cdf(x) is the weight below x plus half the weight at x, td_quantile(q) the sample
+ * holding rank q * td_size(). Both are a binary search over the compressed samples. Once a
+ * compression finds more than `threshold` distinct values, the samples are folded into centroids
+ * by the usual k-scale pass and the histogram stays a regular t-digest. Merging a regular
+ * t-digest into an exact-phase histogram ends the phase too.
+ *
+ * td_reset() returns the histogram to the exact phase. Serialized forms do not record the phase
+ * and answer with the usual interpolation. Combine with td_init_lazy() to keep low-count digests
+ * small as well.
+ *
+ * @param threshold The largest number of distinct samples kept, at most (cap - 1) / 2 so the
+ * samples and their cumulative index fit the node arrays, or 0 to turn the exact phase off.
+ * @return 0 on success, EINVAL if `threshold` is out of range, or if it is positive and the
+ * histogram already holds centroids.
+ */
+int td_set_exact_threshold(td_histogram_t *h, int threshold);
+
+/**
+ * Returns true while a histogram keeps its raw samples, see td_set_exact_threshold().
+ */
+bool td_is_exact(const td_histogram_t *h);
+
 /**
  * Adds a sample to a histogram.
  *
@@ -116,6 +367,55 @@ void td_reset(td_histogram_t *h);
  */
 int td_add(td_histogram_t *h, double val, long long weight);
 
+/**
+ * Adds a block of weighted samples to a histogram.
+ *
+ * Equivalent to calling td_add() for every element in order (the resulting digest is identical),
+ * but each run of samples that fits in the unmerged buffer is validated and copied in one pass,
+ * and td_compress() only runs when the buffer fills up.
+ *
+ * @param values The values to add. Every value must be finite (see td_add()).
+ * @param weights The weight of each value, `n` entries.
+ * @param n The number of samples.
+ * @param rejected Optional output parameter. On success it is set to `n`; on failure it is set to
+ * the index of the rejected element. Every element before it was added, none after it was.
+ * @return 0 on success, EINVAL if a value is not finite (NaN or +/-Inf), EDOM if overflow was
+ * detected as a consequence of adding a weight.
+ */
+int td_add_batch(td_histogram_t *h, const double *values, const long long *weights, size_t n,
+                 size_t *rejected);
+
+/**
+ * Adds a block of samples to a histogram, each with weight 1.
+ *
+ * @see td_add_batch()
+ */
+int td_add_batch_unweighted(td_histogram_t *h, const double *values, size_t n, size_t *rejected);
+
+/**
+ * Builds a histogram from a large array of unit-weight samples, such as one held in memory or in
+ * a mapped file, using up to `nthreads` threads.
+ *
+ * The array is split into one contiguous slice per thread; each thread ingests its slice into a
+ * private histogram of twice the compression, with no locking, and the private histograms are
+ * then folded into the result with td_merge_many(). The samples are only read, never copied.
+ * The extra compression of the private histograms makes up for the precision a merge loses, so
+ * the result is about as accurate as adding every sample to one histogram. Near the largest
+ * valid compression, where twice it would not be valid, they use `compression` itself.
+ *
+ * @param values The samples, all finite.
+ * @param n The number of samples.
+ * @param compression The compression parameter of the result, see td_init().
+ * @param nthreads The maximum number of threads, including the calling one. Fewer are used for
+ * small arrays, where starting a thread would cost more than it saves.
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, EINVAL if an argument is NULL, `compression` is invalid, `nthreads` is <= 0
+ * or a sample is not finite, EDOM if overflow was detected, ENOMEM if allocation failed or a
+ * thread could not be started.
+ */
+int td_build_from_samples(const double *values, size_t n, double compression, int nthreads,
+                          td_histogram_t **result);
+
 /**
  * Re-examines a t-digest to determine whether some centroids are redundant.  If your data are
  * perversely ordered, this may be a good idea.  Even if not, this may save 20% or so in space.
@@ -134,6 +434,9 @@ int td_compress(td_histogram_t *h);
 /**
  * Merges all of the values from 'from' to 'this' histogram.
  *
+ * Both histograms are compressed first; their sorted centroids are then merged in one linear pass,
+ * leaving 'this' compressed.
+ *
  * @param h "This" pointer
  * @param from Histogram to copy values from.
  * * @return 0 on success, EDOM if overflow was detected as a consequence of merging the the
@@ -141,6 +444,54 @@ int td_compress(td_histogram_t *h);
  */
 int td_merge(td_histogram_t *h, td_histogram_t *from);
 
+/**
+ * Merges all of the values from 'from' to 'this' histogram without modifying 'from', so it only
+ * needs to be protected against concurrent writers, not readers (see td_cdf_const()).
+ *
+ * If 'from' has unmerged values they are compressed into scratch space, as td_quantile_const()
+ * does, rather than into 'from' itself.
+ *
+ * @param h "This" pointer
+ * @param from Histogram to copy values from.
+ * @return 0 on success, EDOM if overflow was detected as a consequence of merging the provided
+ * histogram, ENOMEM if the scratch space for the unmerged values of 'from' could not be allocated.
+ */
+int td_merge_const(td_histogram_t *h, const td_histogram_t *from);
+
+/**
+ * Merges all of the values from every histogram in `froms` into 'this' histogram, as if by
+ * calling td_merge() on each of them in turn, but checking the combined weight for overflow before
+ * anything is merged.
+ *
+ * @param h "This" pointer
+ * @param froms Histograms to copy values from; each of them is compressed first.
+ * @param n Number of histograms in `froms`.
+ * @return 0 on success, EINVAL if `froms` is null, EDOM if overflow was detected as a consequence
+ * of merging the provided histograms, ENOMEM if the nodes of a lazily allocated histogram could
+ * not be grown (see td_init_lazy()). The original histogram is then not modified: both are
+ * checked before anything is merged.
+ */
+int td_merge_many(td_histogram_t *h, td_histogram_t **froms, size_t n);
+
+/**
+ * Lowers the compression of a histogram, say as a time bucket ages into a coarser retention tier.
+ *
+ * The centroids go through one k-scale pass under the new compression, which merges the neighbours
+ * it would not keep apart, and the node arrays shrink to the new cap: a
+ * histogram whose nodes live in its own block moves to a smaller block, so `*h` changes, while
+ * lazily allocated nodes (td_init_lazy()) are shrunk to fit in place. A histogram initialised in
+ * caller-provided memory stays where it is. A histogram in the exact phase (see
+ * td_set_exact_threshold()) leaves it.
+ *
+ * @param h The histogram; on success `*h` is the recompressed one, and the old pointer is no
+ * longer valid if it differs.
+ * @param compression The new compression, valid (see td_init()) and at most the current one.
+ * @return 0 on success, EINVAL if an argument is invalid, EDOM if compressing overflowed, ENOMEM
+ * if allocation failed. On ENOMEM a histogram with its nodes in its block is left as it was, and
+ * a lazily allocated one is recompressed but not shrunk.
+ */
+int td_recompress(td_histogram_t **h, double compression);
+
 /**
  * Returns the fraction of all points added which are &le; x.
  *
@@ -169,6 +520,27 @@ double td_quantile(td_histogram_t *h, double q);
  */
 int td_quantiles(td_histogram_t *h, const double *quantiles, double *values, size_t length);
 
+/**
+ * Returns td_cdf() at each of the given values, compressing only once.
+ *
+ * Ascending values are answered in a single pass over the centroids; values in any other order
+ * are sorted internally first.
+ *
+ * @param xs The values to get the cdf at.
+ * @param out Destination array for the cdf of each value, allocated by the caller.
+ * @return 0 on success, EINVAL if either array is null, ENOMEM if `xs` is not sorted and the
+ * sort buffer could not be allocated.
+ */
+int td_cdfs(td_histogram_t *h, const double *xs, double *out, size_t length);
+
+/**
+ * Like td_cdfs(), but returns the estimated weight of all data less or equal to each value, i.e.
+ * the cdf scaled by td_size().
+ *
+ * @see td_cdfs()
+ */
+int td_ranks(td_histogram_t *h, const double *xs, double *out, size_t length);
+
 /**
  * Returns the trimmed mean ignoring values outside given cutoff upper and lower limits.
  *
@@ -186,6 +558,36 @@ double td_trimmed_mean(td_histogram_t *h, double leftmost_cut, double rightmost_
  */
 double td_trimmed_mean_symmetric(td_histogram_t *h, double proportion_to_cut);
 
+/**
+ * Non-mutating variants of td_cdf(), td_quantile(), td_quantiles(), td_trimmed_mean() and
+ * td_trimmed_mean_symmetric().
+ *
+ * The mutating queries compress the histogram first, so even a read rewrites it. These variants
+ * never write to `h`: with an empty buffer they read the merged centroids in place, otherwise they
+ * merge the buffer into a temporary copy, the same way td_compress() would (the same linear merge
+ * or full sort, so tied means land in the same centroids), and answer from that.
+ * Any number of threads may therefore query the same histogram concurrently, as long as no thread
+ * modifies it meanwhile (a shared/exclusive lock is enough).
+ *
+ * Answering with a non-empty buffer allocates about 16 bytes per centroid and buffered sample.
+ * The double-returning variants return NaN, and td_quantiles_const() returns ENOMEM, if that
+ * allocation fails; an overflowing weight is reported as NaN or EDOM like td_compress() would.
+ */
+double td_cdf_const(const td_histogram_t *h, double x);
+
+/** @see td_cdf_const() */
+double td_quantile_const(const td_histogram_t *h, double q);
+
+/** @see td_cdf_const() */
+int td_quantiles_const(const td_histogram_t *h, const double *quantiles, double *values,
+                       size_t length);
+
+/** @see td_cdf_const() */
+double td_trimmed_mean_const(const td_histogram_t *h, double leftmost_cut, double rightmost_cut);
+
+/** @see td_cdf_const() */
+double td_trimmed_mean_symmetric_const(const td_histogram_t *h, double proportion_to_cut);
+
 /**
  * Returns the current compression factor.
  *
@@ -235,6 +637,10 @@ const long long *td_centroids_weight(td_histogram_t *h);
 /**
  * Get the full centroids mean array for 'this' histogram.
  *
+ * Only the first td_centroid_count() entries are centroid means. The slots past them are scratch
+ * space; after a compression they hold the running totals of the centroid weights that the
+ * queries search, and they change with every td_add() and td_compress().
+ *
  * @param h "This" pointer
  *
  * @return The full centroids mean array.
@@ -257,10 +663,218 @@ long long td_centroids_weight_at(td_histogram_t *h, int pos);
  * @param h "This" pointer
  * @param pos centroid position.
  *
- * @return The centroid mean.
+ * @return The centroid mean, or NAN unless 0 <= pos < td_centroid_count(h).
  */
 double td_centroids_mean_at(td_histogram_t *h, int pos);
 
+/**
+ * Creates a read-only compact snapshot of a histogram for long-lived, rarely updated digests.
+ *
+ * The histogram is compressed first, then its merged centroids are stored with float means and
+ * 32-bit weights in a single allocation, about half the size of the histogram's centroids and
+ * without its unmerged buffer. If any mean is outside the normal float range (beyond FLT_MAX, or
+ * nonzero and below FLT_MIN) or any weight above UINT32_MAX, the snapshot keeps double means and
+ * long long weights instead, so it never saturates or flushes to zero. Rounding the means to
+ * float changes
+ * td_compact_quantile() and td_compact_cdf() results by a relative ~6e-8 (float precision) or
+ * less, well below the digest's own error.
+ *
+ * @param h The histogram to snapshot; it is compressed but otherwise unchanged.
+ * @param result Output parameter to capture the snapshot, left untouched on failure.
+ * @return 0 on success, EINVAL if an argument is NULL, EDOM if compressing `h` overflowed,
+ * ENOMEM if allocation failed.
+ */
+int td_compact(td_histogram_t *h, td_compact_t **result);
+
+/**
+ * Creates a new histogram from a compact snapshot, so it can accept samples again. The new
+ * histogram has the compression and node capacity of the histogram the snapshot was taken from.
+ *
+ * @param c The snapshot.
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, EINVAL if an argument is NULL, ENOMEM if allocation failed.
+ */
+int td_expand(const td_compact_t *c, td_histogram_t **result);
+
+/**
+ * Frees a compact snapshot. Passing NULL is allowed and is a no-op.
+ */
+void td_compact_free(td_compact_t *c);
+
+/**
+ * td_cdf() over a compact snapshot.
+ */
+double td_compact_cdf(const td_compact_t *c, double x);
+
+/**
+ * td_quantile() over a compact snapshot.
+ */
+double td_compact_quantile(const td_compact_t *c, double q);
+
+/**
+ * td_quantiles() over a compact snapshot.
+ *
+ * @return 0 on success, EINVAL if either array is NULL.
+ */
+int td_compact_quantiles(const td_compact_t *c, const double *quantiles, double *values,
+                         size_t length);
+
+/**
+ * Returns the number of points in a compact snapshot (the sum of its centroid weights).
+ */
+long long td_compact_size(const td_compact_t *c);
+
+/**
+ * Returns the number of centroids in a compact snapshot.
+ */
+int td_compact_centroid_count(const td_compact_t *c);
+
+/**
+ * Returns the number of bytes allocated for a compact snapshot.
+ */
+size_t td_compact_bytes(const td_compact_t *c);
+
+/**
+ * Returns the number of bytes td_serialize() writes for a histogram.
+ *
+ * @param h The histogram; it is compressed first.
+ * @return The serialized size, or 0 if compressing `h` overflowed.
+ */
+size_t td_serialized_size(td_histogram_t *h);
+
+/**
+ * Writes a histogram in a compact, versioned binary form that td_deserialize() reads back.
+ *
+ * Only the merged centroids are written, with the means delta-encoded and the weights as varints,
+ * along with the compression, node capacity, min and max. The form is the same on every platform.
+ *
+ * @param h The histogram; it is compressed first.
+ * @param buf Destination buffer.
+ * @param buf_len Size of `buf`, at least td_serialized_size(h).
+ * @param written Output parameter for the number of bytes written; may be NULL.
+ * @return 0 on success, EINVAL if `buf` is NULL or too small, EDOM if compressing `h` overflowed.
+ */
+int td_serialize(td_histogram_t *h, void *buf, size_t buf_len, size_t *written);
+
+/**
+ * Creates a new histogram from the output of td_serialize(). The centroids are decoded straight
+ * into the merged prefix in a single pass, without sorting or compressing.
+ *
+ * Every centroid is checked on the way: its mean must lie within [min, max] and its weight be
+ * positive, and the node capacity must be one a histogram of the compression can have. A
+ * capacity above the default of the compression, i.e. a td_init_ex() buffer larger than the
+ * default one, is clamped to that default; the centroids must fit in it.
+ *
+ * @param buf The serialized histogram.
+ * @param buf_len Its exact size.
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, EINVAL if an argument is NULL or `buf` is not a valid serialized
+ * histogram of this format version, ENOMEM if allocation failed.
+ */
+int td_deserialize(const void *buf, size_t buf_len, td_histogram_t **result);
+
+/**
+ * Returns the number of bytes td_view_serialize() writes for a histogram.
+ *
+ * @param h The histogram; it is compressed first.
+ * @return The size of the view layout, or 0 if compressing `h` overflowed.
+ */
+size_t td_view_serialized_size(td_histogram_t *h);
+
+/**
+ * Writes a histogram in the fixed view layout that td_view_open() queries in place.
+ *
+ * The layout is a 48-byte header followed by the centroid means, their weights and the running
+ * total of the weights, each a contiguous 8-byte array in host byte order. It is about 24 bytes
+ * per centroid, larger than td_serialize(), but needs no decoding to be queried. A node capacity
+ * above that of td_init() at the histogram's compression, i.e. a larger buffer from td_init_ex(),
+ * is recorded as that of td_init().
+ *
+ * @param h The histogram; it is compressed first.
+ * @param buf Destination buffer.
+ * @param buf_len Size of `buf`, at least td_view_serialized_size(h).
+ * @param written Output parameter for the number of bytes written; may be NULL.
+ * @return 0 on success, EINVAL if `buf` is NULL or too small, EDOM if compressing `h` overflowed.
+ */
+int td_view_serialize(td_histogram_t *h, void *buf, size_t buf_len, size_t *written);
+
+/**
+ * Wraps a buffer written by td_view_serialize(), such as a network buffer or a mapped file, in a
+ * read-only view. Nothing is allocated or copied: the view points into `buf`.
+ *
+ * Only the header is checked, in constant time: its sizes, that the node capacity is one a
+ * histogram of its compression can have, and that min <= max. The centroids are not checked, yet
+ * the queries binary-search the means and the cumulative weights and rely on both being sorted.
+ * Do not open a buffer that may have been tampered with as a view: read it with td_deserialize(),
+ * which checks every centroid.
+ *
+ * @param v The view to fill in, left untouched on failure.
+ * @param buf The view layout, 8-byte aligned.
+ * @param buf_len Its exact size.
+ * @return 0 on success, EINVAL if an argument is NULL, `buf` is misaligned, or it does not hold a
+ * view of this format version written on a host of the same byte order.
+ */
+int td_view_open(td_view_t *v, const void *buf, size_t buf_len);
+
+/**
+ * td_cdf() over a view.
+ */
+double td_view_cdf(const td_view_t *v, double x);
+
+/**
+ * td_quantile() over a view.
+ */
+double td_view_quantile(const td_view_t *v, double q);
+
+/**
+ * td_quantiles() over a view.
+ *
+ * @return 0 on success, EINVAL if either array is NULL.
+ */
+int td_view_quantiles(const td_view_t *v, const double *quantiles, double *values, size_t length);
+
+/**
+ * td_cdfs() over a view. Allocates a scratch array only when `xs` is not sorted.
+ *
+ * @return 0 on success, EINVAL if either array is NULL, ENOMEM if allocation failed.
+ */
+int td_view_cdfs(const td_view_t *v, const double *xs, double *out, size_t length);
+
+/**
+ * td_trimmed_mean() over a view.
+ */
+double td_view_trimmed_mean(const td_view_t *v, double leftmost_cut, double rightmost_cut);
+
+/**
+ * td_trimmed_mean_symmetric() over a view.
+ */
+double td_view_trimmed_mean_symmetric(const td_view_t *v, double proportion_to_cut);
+
+/**
+ * Returns the number of points in a view (the sum of its centroid weights).
+ */
+long long td_view_size(const td_view_t *v);
+
+/**
+ * Returns the number of centroids in a view.
+ */
+int td_view_centroid_count(const td_view_t *v);
+
+/**
+ * Creates a new histogram from a view, so it can accept samples again. The new histogram has the
+ * compression and node capacity of the histogram the view was written from, the capacity being
+ * at most that of td_init() at that compression.
+ *
+ * The centroids are checked as they are copied: sorted, within [min, max], with positive weights
+ * adding up to the total weight.
+ *
+ * @param v The view.
+ * @param result Output parameter to capture the histogram, left untouched on failure.
+ * @return 0 on success, EINVAL if an argument is NULL or the centroids are not valid, ENOMEM if
+ * allocation failed.
+ */
+int td_view_expand(const td_view_t *v, td_histogram_t **result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,7 +1,15 @@
 #include <benchmark/benchmark.h>
 #include "tdigest.h"
+#include "td_sharded.h"
+#include "td_store.h"
+#include "td_window.h"
+#include "td_decay.h"
 #include <math.h>
 #include <random>
+#include <algorithm>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #ifdef _WIN32
 #pragma comment(lib, "Shlwapi.lib")
@@ -55,6 +63,35 @@ static void BM_td_add_uniform_dist(benchmark::State &state) {
     }
 }
 
+static void BM_td_add_batch_uniform_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = state.range(1);
+    td_histogram_t *mdigest = td_new(compression);
+    std::vector<double> input;
+    input.resize(stream_size, 0);
+    std::mt19937_64 rng;
+    rng.seed(std::random_device()());
+    std::uniform_real_distribution<double> dist(0, 1);
+
+    for (double &i : input) {
+        i = dist(rng);
+    }
+
+    while (state.KeepRunning()) {
+        td_add_batch_unweighted(mdigest, input.data(), input.size(), NULL);
+        td_compress(mdigest);
+        // read/write barrier
+        benchmark::ClobberMemory();
+        state.SetItemsProcessed(stream_size);
+        // Set the counter as a thread-average quantity. It will
+        // be presented divided by the number of threads ( in our case just one thread ).
+        state.counters["Centroid_Count"] =
+            benchmark::Counter(td_centroid_count(mdigest), benchmark::Counter::kAvgThreads);
+        state.counters["Total_Compressions"] =
+            benchmark::Counter(mdigest->total_compressions, benchmark::Counter::kAvgThreads);
+    }
+}
+
 static void BM_td_add_lognormal_dist(benchmark::State &state) {
     const double compression = state.range(0);
     const int64_t stream_size = state.range(1);
@@ -86,6 +123,59 @@ static void BM_td_add_lognormal_dist(benchmark::State &state) {
     }
 }
 
+static void generate_collapse_arguments_pairs(benchmark::internal::Benchmark *b) {
+    for (int64_t compression = min_compression; compression <= max_compression;
+         compression += step_compression_unit) {
+        // ingest flags: default, TD_COLLAPSE_DUPLICATES
+        b = b->ArgPair(compression, 0);
+        b = b->ArgPair(compression, TD_COLLAPSE_DUPLICATES);
+    }
+}
+
+// Lognormal latencies quantized to integers, as with millisecond or microsecond timers.
+static void td_add_quantized_lognormal_dist(benchmark::State &state, double unit_scale) {
+    const double compression = state.range(0);
+    const int ingest_flags = (int)state.range(1);
+    const int64_t stream_size = 10000000;
+    td_histogram_t *mdigest = td_new(compression);
+    td_set_ingest_flags(mdigest, ingest_flags);
+    std::vector<double> input;
+    input.resize(stream_size, 0);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> dist(1, 0.5);
+
+    for (double &i : input) {
+        i = std::round(dist(rng) * unit_scale);
+    }
+
+    int64_t adds = 0;
+    for (auto _ : state) {
+        for (int64_t i = 0; i < stream_size; ++i) {
+            td_add(mdigest, input[i], 1);
+        }
+        td_compress(mdigest);
+        // read/write barrier
+        benchmark::ClobberMemory();
+        adds += stream_size;
+    }
+    state.SetItemsProcessed(adds);
+    state.counters["Centroid_Count"] = td_centroid_count(mdigest);
+    state.counters["Compressions_per_Million_Adds"] =
+        (double)mdigest->total_compressions * 1e6 / (double)adds;
+    td_free(mdigest);
+}
+
+// values in milliseconds: a few dozen distinct integers
+static void BM_td_add_integer_ms_lognormal_dist(benchmark::State &state) {
+    td_add_quantized_lognormal_dist(state, 1);
+}
+
+// values in microseconds: a few thousand distinct integers
+static void BM_td_add_integer_us_lognormal_dist(benchmark::State &state) {
+    td_add_quantized_lognormal_dist(state, 1000);
+}
+
 static void BM_td_quantile_lognormal_dist(benchmark::State &state) {
     const double compression = state.range(0);
     const int64_t stream_size = state.range(1);
@@ -154,6 +244,407 @@ static void BM_td_merge_lognormal_dist(benchmark::State &state) {
     }
 }
 
+static void generate_merge_many_arguments_pairs(benchmark::internal::Benchmark *b) {
+    for (int64_t digests = 10; digests <= 1000; digests *= 10) {
+        b = b->ArgPair(INT64_C(100), digests);
+    }
+}
+
+// Rolls state.range(1) digests of 1000 lognormal samples each up into one with td_merge_many().
+static void BM_td_merge_many_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t digests = state.range(1);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    std::vector<td_histogram_t *> froms((size_t)digests);
+    for (auto &from : froms) {
+        from = td_new(compression);
+        for (int i = 0; i < 1000; i++) {
+            td_add(from, distSamples(rng), 1);
+        }
+        td_compress(from);
+    }
+    td_histogram_t *into = td_new(compression);
+    for (auto _ : state) {
+        td_reset(into);
+        benchmark::DoNotOptimize(td_merge_many(into, froms.data(), froms.size()));
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * digests);
+    state.counters["Centroid_Count"] =
+        benchmark::Counter(td_centroid_count(into), benchmark::Counter::kAvgThreads);
+    td_free(into);
+    for (auto from : froms) {
+        td_free(from);
+    }
+}
+
+// Round-trips a compressed digest through td_serialize()/td_deserialize(). Bytes_per_Centroid
+// reports the encoded size against the 16 bytes per centroid held in memory.
+static void BM_td_serialize_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    for (int64_t i = 0; i < 1000000; ++i) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    const size_t size = td_serialized_size(mdigest);
+    std::vector<unsigned char> buf(size);
+    for (auto _ : state) {
+        size_t written = 0;
+        benchmark::DoNotOptimize(td_serialize(mdigest, buf.data(), buf.size(), &written));
+        td_histogram_t *back = NULL;
+        benchmark::DoNotOptimize(td_deserialize(buf.data(), written, &back));
+        td_free(back);
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    const int centroids = td_centroid_count(mdigest);
+    state.SetItemsProcessed(state.iterations() * centroids);
+    state.SetBytesProcessed(state.iterations() * size);
+    state.counters["Centroid_Count"] = benchmark::Counter(centroids, benchmark::Counter::kAvgThreads);
+    state.counters["Bytes_per_Centroid"] =
+        benchmark::Counter((double)size / centroids, benchmark::Counter::kAvgThreads);
+    td_free(mdigest);
+}
+
+// Lowers a compression-500 digest of 1M lognormal samples to compression 100, with td_recompress()
+// when state.range(0) is set and with a td_new() plus td_merge() replay otherwise. Each iteration
+// starts from a fresh copy of the digest, made outside the timed region.
+static void BM_td_recompress_lognormal_dist(benchmark::State &state) {
+    const bool recompress = state.range(0) != 0;
+    td_histogram_t *mdigest = td_new(500);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    for (int64_t i = 0; i < 1000000; ++i) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    std::vector<unsigned char> buf(td_serialized_size(mdigest));
+    size_t written = 0;
+    td_serialize(mdigest, buf.data(), buf.size(), &written);
+    size_t bytes = 0;
+    int centroids = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        td_histogram_t *h = NULL;
+        td_deserialize(buf.data(), written, &h);
+        state.ResumeTiming();
+        if (recompress) {
+            td_recompress(&h, 100);
+        } else {
+            td_histogram_t *lower = td_new(100);
+            td_merge(lower, h);
+            td_free(h);
+            h = lower;
+        }
+        benchmark::DoNotOptimize(h);
+        state.PauseTiming();
+        bytes = td_memory_usage(h);
+        centroids = td_centroid_count(h);
+        td_free(h);
+        state.ResumeTiming();
+    }
+    state.counters["Centroid_Count"] = td_centroid_count(mdigest);
+    state.counters["Centroid_Count_after"] = centroids;
+    state.counters["bytes_after"] = (double)bytes;
+    td_free(mdigest);
+}
+
+static void generate_from_centroids_arguments_pairs(benchmark::internal::Benchmark *b) {
+    for (int64_t compression = min_compression; compression <= max_compression;
+         compression += step_compression_unit) {
+        // 1 loads the centroids in order, 0 shuffled
+        b = b->ArgPair(compression, 1);
+        b = b->ArgPair(compression, 0);
+    }
+}
+
+// Restores a digest from its exported centroids with td_init_from_centroids(). Sorted input is a
+// straight copy; shuffled input takes one sort and one k-scale pass.
+static void BM_td_init_from_centroids_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const bool sorted = state.range(1) != 0;
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    for (int64_t i = 0; i < 1000000; ++i) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    td_compress(mdigest);
+    const int n = mdigest->merged_nodes;
+    std::vector<int> order((size_t)n);
+    for (int i = 0; i < n; i++) {
+        order[i] = i;
+    }
+    if (!sorted) {
+        std::shuffle(order.begin(), order.end(), rng);
+    }
+    std::vector<double> means((size_t)n);
+    std::vector<long long> weights((size_t)n);
+    for (int i = 0; i < n; i++) {
+        means[i] = mdigest->nodes_mean[order[i]];
+        weights[i] = mdigest->nodes_weight[order[i]];
+    }
+    for (auto _ : state) {
+        td_histogram_t *h = NULL;
+        benchmark::DoNotOptimize(td_init_from_centroids(compression, means.data(), weights.data(),
+                                                        (size_t)n, mdigest->min, mdigest->max,
+                                                        &h));
+        td_free(h);
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * n);
+    state.counters["Centroid_Count"] = n;
+    td_free(mdigest);
+}
+
+// Per-key digests holding state.range(0) samples each, created by td_init_lazy() when
+// state.range(1) is set and by td_init() otherwise; reports the resident bytes per digest.
+static void BM_td_sparse_digests(benchmark::State &state) {
+    const int64_t samples = state.range(0);
+    const bool lazy = state.range(1) != 0;
+    const size_t digests = 1000;
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    std::vector<td_histogram_t *> pool(digests);
+    size_t bytes = 0;
+    for (auto _ : state) {
+        bytes = 0;
+        for (size_t d = 0; d < digests; d++) {
+            if (lazy) {
+                td_init_lazy(100, &pool[d]);
+            } else {
+                td_init(100, &pool[d]);
+            }
+            for (int64_t i = 0; i < samples; i++) {
+                td_add(pool[d], distSamples(rng), 1);
+            }
+            td_shrink_to_fit(pool[d]);
+            bytes += td_memory_usage(pool[d]);
+        }
+        for (size_t d = 0; d < digests; d++) {
+            td_free(pool[d]);
+        }
+    }
+    state.counters["bytes_per_digest"] = (double)bytes / (double)digests;
+    state.SetItemsProcessed(state.iterations() * digests * samples);
+}
+
+// Low-traffic keys: lazily allocated digests of state.range(0) lognormal samples, keeping the raw
+// samples up to 300 distinct values when state.range(1) is set. Reports the resident bytes per
+// digest and the relative error of the median against the sample holding that rank.
+static void BM_td_low_count_digests(benchmark::State &state) {
+    const int64_t samples = state.range(0);
+    const bool exact = state.range(1) != 0;
+    const size_t digests = 1000;
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    std::vector<td_histogram_t *> pool(digests);
+    std::vector<double> values((size_t)samples);
+    size_t bytes = 0;
+    double value_error = 0;
+    for (auto _ : state) {
+        bytes = 0;
+        value_error = 0;
+        for (size_t d = 0; d < digests; d++) {
+            td_init_lazy(100, &pool[d]);
+            if (exact) {
+                td_set_exact_threshold(pool[d], 300);
+            }
+            for (double &v : values) {
+                v = distSamples(rng);
+            }
+            td_add_batch_unweighted(pool[d], values.data(), values.size(), NULL);
+            const double median = td_quantile(pool[d], 0.5);
+            td_shrink_to_fit(pool[d]);
+            bytes += td_memory_usage(pool[d]);
+            const size_t rank = (size_t)(0.5 * (double)samples);
+            std::nth_element(values.begin(), values.begin() + rank, values.end());
+            value_error += std::abs(median - values[rank]) / values[rank];
+        }
+        for (size_t d = 0; d < digests; d++) {
+            td_free(pool[d]);
+        }
+    }
+    state.counters["bytes_per_digest"] = (double)bytes / (double)digests;
+    state.counters["median_error"] = value_error / (double)digests;
+    state.SetItemsProcessed(state.iterations() * digests * samples);
+}
+
+// A 60-second window in 1-second intervals, fed one lognormal sample per millisecond and asked for
+// its p99 every state.range(0) samples. A query merges only the current interval onto the cached
+// merge of the closed ones, which is rebuilt once per second.
+static void BM_td_window_p99_lognormal_dist(benchmark::State &state) {
+    const int64_t query_every = state.range(0);
+    td_window_t *w = td_window_new(100, 60, 1000);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    long long ts = 0;
+    // fill the window first
+    for (; ts < 60000; ts++) {
+        td_window_add(w, ts, distSamples(rng));
+    }
+    for (auto _ : state) {
+        td_window_add(w, ts, distSamples(rng));
+        if (ts % query_every == 0) {
+            benchmark::DoNotOptimize(td_window_quantile(w, 0.99));
+        }
+        ts++;
+    }
+    state.SetItemsProcessed(state.iterations());
+    td_window_free(w);
+}
+
+// The decayed counterpart of BM_td_window_p99_lognormal_dist: a digest with a 60-second half-life,
+// fed one lognormal sample per millisecond and asked for its p99 every state.range(0) samples.
+// There is no window to rotate; the landmark moves forward every ~92 minutes of samples.
+static void BM_td_decay_p99_lognormal_dist(benchmark::State &state) {
+    const int64_t query_every = state.range(0);
+    td_decay_t *d = td_decay_new(100, log(2) / 60000, 0);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    long long ts = 0;
+    for (; ts < 60000; ts++) {
+        td_decay_add(d, ts, distSamples(rng), 1);
+    }
+    for (auto _ : state) {
+        td_decay_add(d, ts, distSamples(rng), 1);
+        if (ts % query_every == 0) {
+            benchmark::DoNotOptimize(td_decay_quantile(d, 0.99));
+        }
+        ts++;
+    }
+    state.SetItemsProcessed(state.iterations());
+    td_decay_free(d);
+}
+
+// Lifetime of a small, short-lived digest: create it, add a few samples, query and free it. With
+// state.range(1) set the digest is initialised in place in a reused buffer instead of allocated.
+static void BM_td_small_digest_lifetime(benchmark::State &state) {
+    const double compression = state.range(0);
+    const bool in_place = state.range(1) != 0;
+    std::vector<double> block(td_required_size(compression) / sizeof(double) + 1);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    std::vector<double> input(16);
+    for (double &v : input) {
+        v = distSamples(rng);
+    }
+    for (auto _ : state) {
+        td_histogram_t *h = NULL;
+        if (in_place) {
+            td_init_in_place(block.data(), block.size() * sizeof(double), compression, &h);
+        } else {
+            td_init(compression, &h);
+        }
+        td_add_batch_unweighted(h, input.data(), input.size(), NULL);
+        benchmark::DoNotOptimize(td_quantile(h, 0.99));
+        td_free(h);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void generate_compress_arguments_pairs(benchmark::internal::Benchmark *b) {
+    for (int64_t compression = min_compression; compression <= max_compression;
+         compression += step_compression_unit) {
+        // percentage of the free buffer that is filled before each measured compression
+        for (int64_t fill = 10; fill <= 100; fill *= 10) {
+            b = b->ArgPair(compression, fill);
+        }
+    }
+}
+
+// Times td_compress() alone over a digest that already holds a merged prefix, with a buffer filled
+// to state.range(1) percent. Only the buffer is sorted (the prefix is merged linearly), so the
+// time per buffered node should stay roughly flat as the buffer shrinks.
+static void BM_td_compress_buffer_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t fill = state.range(1);
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    for (int64_t i = 0; i < 1000000; ++i) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    td_compress(mdigest);
+    int64_t buffered = 0;
+    for (auto _ : state) {
+        state.PauseTiming();
+        const int room = mdigest->cap - 2 * mdigest->merged_nodes - 2;
+        const int64_t to_add = std::max<int64_t>(1, room * fill / 100);
+        for (int64_t i = 0; i < to_add; ++i) {
+            td_add(mdigest, distSamples(rng), 1);
+        }
+        buffered += mdigest->unmerged_nodes;
+        state.ResumeTiming();
+        td_compress(mdigest);
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(buffered);
+    state.counters["Merged_Nodes"] = mdigest->merged_nodes;
+    td_free(mdigest);
+}
+
+static void generate_buffer_arguments_pairs(benchmark::internal::Benchmark *b) {
+    for (int64_t compression = min_compression; compression <= max_compression;
+         compression += step_compression_unit) {
+        // unmerged buffer size as a multiple of compression; 5 is the td_new() default
+        for (int64_t factor : {1, 5, 20, 100}) {
+            b = b->ArgPair(compression, factor * compression);
+        }
+    }
+}
+
+// Ingest cost against the unmerged buffer size chosen with td_new_ex(): a larger buffer runs
+// td_compress() less often, at the cost of memory.
+static void BM_td_add_buffer_size_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int buffer_size = (int)state.range(1);
+    const int64_t stream_size = 1000000;
+    td_histogram_t *mdigest = td_new_ex(compression, buffer_size);
+    std::vector<double> input;
+    input.resize(stream_size, 0);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+
+    for (double &i : input) {
+        i = distSamples(rng);
+    }
+
+    int64_t adds = 0;
+    for (auto _ : state) {
+        for (int64_t i = 0; i < stream_size; ++i) {
+            td_add(mdigest, input[i], 1);
+        }
+        // read/write barrier
+        benchmark::ClobberMemory();
+        adds += stream_size;
+    }
+    state.SetItemsProcessed(adds);
+    state.counters["Cap"] = mdigest->cap;
+    state.counters["Compressions_per_Million_Adds"] =
+        (double)mdigest->total_compressions * 1e6 / (double)adds;
+    // seconds per add, reported with an SI prefix (n for nanoseconds)
+    state.counters["Time_per_Add"] =
+        benchmark::Counter((double)adds, benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+    td_free(mdigest);
+}
+
 static void BM_td_trimmed_mean_symmetric_lognormal_dist(benchmark::State &state) {
     const double compression = state.range(0);
     const int64_t stream_size = state.range(1);
@@ -196,7 +687,7 @@ static void BM_td_quantile_lognormal_dist_given_array(benchmark::State &state) {
     std::mt19937_64 rng;
     rng.seed(12345);
     std::lognormal_distribution<double> distSamples(1, 0.5);
-    const double percentile_list[4] = {50.0, 95.0, 99.0, 99.9};
+    const double percentile_list[4] = {0.5, 0.95, 0.99, 0.999};
 
     for (double &i : input) {
         td_add(mdigest, distSamples(rng), 1);
@@ -222,6 +713,59 @@ static void BM_td_quantile_lognormal_dist_given_array(benchmark::State &state) {
     }
 }
 
+static void BM_td_cdf_lognormal_dist_given_array(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = state.range(1);
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    const double percentile_list[4] = {0.5, 0.95, 0.99, 0.999};
+    double value_list[4];
+
+    for (int64_t i = 0; i < stream_size; i++) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    td_quantiles(mdigest, percentile_list, value_list, 4);
+    for (auto _ : state) {
+        for (auto value : value_list) {
+            benchmark::DoNotOptimize(td_cdf(mdigest, value));
+            // read/write barrier
+            benchmark::ClobberMemory();
+        }
+        state.SetItemsProcessed(stream_size);
+        state.counters["Centroid_Count"] =
+            benchmark::Counter(td_centroid_count(mdigest), benchmark::Counter::kAvgThreads);
+    }
+    td_free(mdigest);
+}
+
+static void BM_td_cdfs_lognormal_dist_given_array(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = state.range(1);
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    const double percentile_list[4] = {0.5, 0.95, 0.99, 0.999};
+    double value_list[4];
+    double cdf_list[4];
+
+    for (int64_t i = 0; i < stream_size; i++) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    td_quantiles(mdigest, percentile_list, value_list, 4);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(td_cdfs(mdigest, value_list, cdf_list, 4));
+        // read/write barrier
+        benchmark::ClobberMemory();
+        state.SetItemsProcessed(stream_size);
+        state.counters["Centroid_Count"] =
+            benchmark::Counter(td_centroid_count(mdigest), benchmark::Counter::kAvgThreads);
+    }
+    td_free(mdigest);
+}
+
 static void BM_td_quantiles_lognormal_dist_given_array(benchmark::State &state) {
     const double compression = state.range(0);
     const int64_t stream_size = state.range(1);
@@ -231,7 +775,7 @@ static void BM_td_quantiles_lognormal_dist_given_array(benchmark::State &state)
     std::mt19937_64 rng;
     rng.seed(12345);
     std::lognormal_distribution<double> distSamples(1, 0.5);
-    const double percentile_list[4] = {50.0, 95.0, 99.0, 99.9};
+    const double percentile_list[4] = {0.5, 0.95, 0.99, 0.999};
     double values[4] = {.0};
 
     for (double &i : input) {
@@ -254,13 +798,268 @@ static void BM_td_quantiles_lognormal_dist_given_array(benchmark::State &state)
     }
 }
 
+// Same queries as BM_td_quantiles_lognormal_dist_given_array, over a td_compact() snapshot.
+static void BM_td_compact_quantiles_lognormal_dist_given_array(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = state.range(1);
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    const double percentile_list[4] = {0.5, 0.95, 0.99, 0.999};
+    double values[4] = {.0};
+
+    for (int64_t i = 0; i < stream_size; ++i) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    td_compact_t *compact = NULL;
+    td_compact(mdigest, &compact);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(td_compact_quantiles(compact, percentile_list, values, 4));
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations() * 4);
+    state.counters["Centroid_Count"] = td_compact_centroid_count(compact);
+    state.counters["Bytes"] = (double)td_compact_bytes(compact);
+    td_compact_free(compact);
+    td_free(mdigest);
+}
+
+// Cold-start query on a serialized digest: each iteration wraps the buffer in a td_view_t and
+// answers one quantile, with no allocation or decoding.
+static void BM_td_view_open_quantile_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = state.range(1);
+    td_histogram_t *mdigest = td_new(compression);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    for (int64_t i = 0; i < stream_size; ++i) {
+        td_add(mdigest, distSamples(rng), 1);
+    }
+    const size_t size = td_view_serialized_size(mdigest);
+    std::vector<double> buf(size / sizeof(double));
+    td_view_serialize(mdigest, buf.data(), size, NULL);
+    for (auto _ : state) {
+        td_view_t view;
+        benchmark::DoNotOptimize(td_view_open(&view, buf.data(), size));
+        benchmark::DoNotOptimize(td_view_quantile(&view, 0.99));
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["Centroid_Count"] = td_centroid_count(mdigest);
+    state.counters["Bytes"] = (double)size;
+    td_free(mdigest);
+}
+
+// A store file of state.range(0) small per-endpoint digests, written once per process on first
+// use and removed at exit.
+struct store_file {
+    std::string path;
+    int64_t digests = 0;
+    ~store_file() {
+        if (digests > 0) {
+            std::remove(path.c_str());
+        }
+    }
+};
+static store_file bench_store;
+
+static const std::string &bench_store_path(int64_t digests) {
+    if (bench_store.digests == digests) {
+        return bench_store.path;
+    }
+    bench_store.path = "td_store_benchmark_" + std::to_string(digests) + ".tds";
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    // a million live histograms would take gigabytes, so the keys share a pool of digests
+    std::vector<td_histogram_t *> pool(1024);
+    for (auto &h : pool) {
+        h = td_new(100);
+        for (int j = 0; j < 8; j++) {
+            td_add(h, distSamples(rng), 1);
+        }
+    }
+    std::vector<std::string> names((size_t)digests);
+    std::vector<const char *> keys((size_t)digests);
+    std::vector<td_histogram_t *> histograms((size_t)digests);
+    for (int64_t i = 0; i < digests; i++) {
+        names[i] = "endpoint:" + std::to_string(i);
+        keys[i] = names[i].c_str();
+        histograms[i] = pool[(size_t)i % pool.size()];
+    }
+    td_store_write(bench_store.path.c_str(), keys.data(), NULL, histograms.data(),
+                   (size_t)digests);
+    for (auto h : pool) {
+        td_free(h);
+    }
+    bench_store.digests = digests;
+    return bench_store.path;
+}
+
+// Startup cost of a digest store: each iteration opens the store file, looks one random key up
+// and answers a quantile on it, then closes the store. The file is in the page cache, so this is
+// the cost of mapping and probing, not of disk reads.
+static void BM_td_store_open_first_query(benchmark::State &state) {
+    const int64_t digests = state.range(0);
+    const std::string &path = bench_store_path(digests);
+    std::mt19937_64 rng;
+    rng.seed(12345);
+    std::uniform_int_distribution<int64_t> pick(0, digests - 1);
+    for (auto _ : state) {
+        const std::string key = "endpoint:" + std::to_string(pick(rng));
+        td_store_t *store = NULL;
+        td_store_open(path.c_str(), &store);
+        size_t index = 0;
+        td_store_find(store, key.data(), key.size(), &index);
+        benchmark::DoNotOptimize(td_store_quantile(store, index, 0.99));
+        td_store_close(store);
+        // read/write barrier
+        benchmark::ClobberMemory();
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["Digests"] = (double)digests;
+}
+
+static const int max_threads = (int)std::max(1u, std::thread::hardware_concurrency());
+static td_sharded_t *sharded_digest = NULL;
+static td_histogram_t *mutex_digest = NULL;
+static std::mutex mutex_digest_lock;
+
+static std::vector<double> generate_thread_input(int thread_index, int64_t stream_size) {
+    std::vector<double> input;
+    input.resize(stream_size, 0);
+    std::mt19937_64 rng;
+    rng.seed(12345 + thread_index);
+    std::lognormal_distribution<double> distSamples(1, 0.5);
+    for (double &i : input) {
+        i = distSamples(rng);
+    }
+    return input;
+}
+
+// Every thread adds to its own shard of a td_sharded_t; adds should scale with the thread count.
+static void BM_td_sharded_add_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = 100000;
+    if (state.thread_index() == 0) {
+        sharded_digest = td_sharded_new(compression, state.threads());
+    }
+    const std::vector<double> input = generate_thread_input(state.thread_index(), stream_size);
+    td_shard_t *shard = NULL;
+    for (auto _ : state) {
+        // the shard is looked up once, after the start barrier has published sharded_digest
+        if (!shard) {
+            shard = td_sharded_shard(sharded_digest, state.thread_index());
+        }
+        for (int64_t i = 0; i < stream_size; ++i) {
+            td_shard_add(shard, input[i], 1);
+        }
+        td_shard_flush(shard);
+    }
+    state.SetItemsProcessed(state.iterations() * stream_size);
+    if (state.thread_index() == 0) {
+        td_sharded_free(sharded_digest);
+        sharded_digest = NULL;
+    }
+}
+
+// Baseline for BM_td_sharded_add_lognormal_dist: one digest behind a mutex.
+static void BM_td_mutex_add_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int64_t stream_size = 100000;
+    if (state.thread_index() == 0) {
+        mutex_digest = td_new(compression);
+    }
+    const std::vector<double> input = generate_thread_input(state.thread_index(), stream_size);
+    for (auto _ : state) {
+        for (int64_t i = 0; i < stream_size; ++i) {
+            std::lock_guard<std::mutex> guard(mutex_digest_lock);
+            td_add(mutex_digest, input[i], 1);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * stream_size);
+    if (state.thread_index() == 0) {
+        td_free(mutex_digest);
+        mutex_digest = NULL;
+    }
+}
+
+static void generate_build_arguments_pairs(benchmark::internal::Benchmark *b) {
+    for (int64_t threads = 1; threads < max_threads; threads *= 2) {
+        b = b->ArgPair(100, threads);
+    }
+    b->ArgPair(100, max_threads);
+}
+
+// Bulk build of one digest from 10M in-memory samples, split across state.range(1) threads.
+// Compare with BM_td_add_batch_uniform_dist for single-threaded streaming ingest.
+static void BM_td_build_from_samples_lognormal_dist(benchmark::State &state) {
+    const double compression = state.range(0);
+    const int nthreads = (int)state.range(1);
+    const int64_t stream_size = 10000000;
+    const std::vector<double> input = generate_thread_input(0, stream_size);
+    int centroids = 0;
+    for (auto _ : state) {
+        td_histogram_t *h = NULL;
+        benchmark::DoNotOptimize(
+            td_build_from_samples(input.data(), input.size(), compression, nthreads, &h));
+        centroids = td_centroid_count(h);
+        td_free(h);
+    }
+    state.SetItemsProcessed(state.iterations() * stream_size);
+    state.counters["Centroid_Count"] = centroids;
+}
+
 // Register the functions as a benchmark
 BENCHMARK(BM_td_add_uniform_dist)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_add_batch_uniform_dist)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_td_add_lognormal_dist)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_add_integer_ms_lognormal_dist)->Apply(generate_collapse_arguments_pairs);
+BENCHMARK(BM_td_add_integer_us_lognormal_dist)->Apply(generate_collapse_arguments_pairs);
+BENCHMARK(BM_td_add_buffer_size_lognormal_dist)->Apply(generate_buffer_arguments_pairs);
 BENCHMARK(BM_td_quantile_lognormal_dist)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_td_quantile_lognormal_dist_given_array)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_td_quantiles_lognormal_dist_given_array)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_cdf_lognormal_dist_given_array)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_cdfs_lognormal_dist_given_array)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_compact_quantiles_lognormal_dist_given_array)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_view_open_quantile_lognormal_dist)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_store_open_first_query)->Arg(1000000)->Unit(benchmark::kMicrosecond);
 BENCHMARK(BM_td_merge_lognormal_dist)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_merge_many_lognormal_dist)->Apply(generate_merge_many_arguments_pairs);
+BENCHMARK(BM_td_init_from_centroids_lognormal_dist)->Apply(generate_from_centroids_arguments_pairs);
+BENCHMARK(BM_td_small_digest_lifetime)->ArgPair(100, 0)->ArgPair(100, 1);
+BENCHMARK(BM_td_sparse_digests)
+    ->ArgPair(3, 0)
+    ->ArgPair(3, 1)
+    ->ArgPair(100, 0)
+    ->ArgPair(100, 1)
+    ->ArgPair(10000, 0)
+    ->ArgPair(10000, 1);
+BENCHMARK(BM_td_window_p99_lognormal_dist)->Arg(1)->Arg(100)->Arg(1000);
+BENCHMARK(BM_td_decay_p99_lognormal_dist)->Arg(1)->Arg(100)->Arg(1000);
+BENCHMARK(BM_td_low_count_digests)
+    ->ArgPair(50, 0)
+    ->ArgPair(50, 1)
+    ->ArgPair(250, 0)
+    ->ArgPair(250, 1);
+BENCHMARK(BM_td_recompress_lognormal_dist)->Arg(0)->Arg(1);
+BENCHMARK(BM_td_serialize_lognormal_dist)->Apply(generate_arguments_pairs);
 BENCHMARK(BM_td_trimmed_mean_symmetric_lognormal_dist)->Apply(generate_arguments_pairs);
+BENCHMARK(BM_td_compress_buffer_lognormal_dist)->Apply(generate_compress_arguments_pairs);
+
+BENCHMARK(BM_td_sharded_add_lognormal_dist)
+    ->Arg(100)
+    ->ThreadRange(1, max_threads)
+    ->UseRealTime();
+BENCHMARK(BM_td_mutex_add_lognormal_dist)->Arg(100)->ThreadRange(1, max_threads)->UseRealTime();
+BENCHMARK(BM_td_build_from_samples_lognormal_dist)
+    ->Apply(generate_build_arguments_pairs)
+    ->Unit(benchmark::kMillisecond)
+    ->UseRealTime();
 
 BENCHMARK_MAIN();
\ No newline at end of file
@@ -27,6 +27,14 @@
  *            stays flat. Removing or weakening the fallback fails both the fallback-reached and
  *            the bound assertion.
  *
+ *   Part C - merge-only compress. With a merged prefix already in place, td_compress() sorts only
+ *            the unmerged buffer and merges it linearly with the sorted prefix, so the comparison
+ *            count is bounded by the buffer size rather than by the whole node range.
+ *
+ *   Part D - the radix backend (td_radix_sort, used by TD_RADIX_SORT builds) on the Part A and B
+ *            inputs: it must match td_qsort's order, keep equal keys in input order (stability),
+ *            perform no comparisons, and move each element at most once per 8-bit digit pass.
+ *
  * Numbers above are measured, not assumed; the asserted constants leave generous margin over
  * them while staying far below quadratic.
  */
@@ -260,6 +268,95 @@ static double compares_killer(int n, unsigned long long *fallbacks_out) {
     return c;
 }
 
+/* ---------- Part C: merge-only compress ----------
+ *
+ * Once a digest holds a merged prefix, td_compress() sorts only the unmerged buffer and merges it
+ * linearly with the (already sorted) prefix. Compare the key comparisons of a compress over `m`
+ * merged + `u` buffered distinct keys against a sort of just the `u` buffered keys. */
+static double compares_buffer_only(int u, double compression, int *merged_out) {
+    td_histogram_t *h = td_new(compression);
+    if (h == NULL) {
+        fprintf(stderr, "allocation failed at u=%d\n", u);
+        exit(1);
+    }
+    srand(7);
+    /* Build a large merged prefix from distinct, exactly weighted values. */
+    for (int i = 0; i < 20 * u; ++i) {
+        if (td_add(h, (double)rand() / RAND_MAX, 1) != 0) {
+            fprintf(stderr, "td_add failed at %d\n", i);
+            exit(1);
+        }
+    }
+    if (td_compress(h) != 0) {
+        fprintf(stderr, "compress failed at u=%d\n", u);
+        exit(1);
+    }
+    *merged_out = h->merged_nodes;
+    for (int i = 0; i < u; ++i) {
+        if (td_add(h, (double)rand() / RAND_MAX, 1) != 0) {
+            fprintf(stderr, "td_add failed at %d\n", i);
+            exit(1);
+        }
+    }
+    CHECK(h->unmerged_nodes == u, "C: expected one buffered batch of %d (got %d)", u,
+          h->unmerged_nodes);
+    td_sort_comparisons = 0;
+    const long long before = td_size(h);
+    if (td_compress(h) != 0) {
+        fprintf(stderr, "compress failed at u=%d\n", u);
+        exit(1);
+    }
+    const double c = (double)td_sort_comparisons;
+    long long total = 0;
+    for (int i = 0; i < h->merged_nodes; ++i) {
+        total += h->nodes_weight[i];
+        CHECK(i == 0 || h->nodes_mean[i - 1] <= h->nodes_mean[i],
+              "C: centroids not sorted at %d (u=%d)", i, u);
+    }
+    CHECK(total == before, "C: weight not conserved (u=%d)", u);
+    td_free(h);
+    return c;
+}
+
+/* ---------- Part D: radix backend ----------
+ *
+ * td_radix_sort() is called directly (it is only wired into td_compress() in TD_RADIX_SORT
+ * builds). Its cost is counted in element moves: every executed 8-bit digit pass moves each
+ * element once, so a linear sort performs at most 8n moves whatever the input order. */
+static double radix_moves(const double *input, int n) {
+    double *means = (double *)calloc((size_t)n, sizeof(double));
+    double *expected = (double *)calloc((size_t)n, sizeof(double));
+    long long *weights = (long long *)calloc((size_t)n, sizeof(long long));
+    long long *expected_w = (long long *)calloc((size_t)n, sizeof(long long));
+    if (means == NULL || expected == NULL || weights == NULL || expected_w == NULL) {
+        fprintf(stderr, "allocation failed at n=%d\n", n);
+        exit(1);
+    }
+    for (int i = 0; i < n; ++i) {
+        means[i] = expected[i] = input[i];
+        weights[i] = expected_w[i] = i; /* original position, to check stability */
+    }
+    td_qsort(expected, expected_w, 0, (unsigned int)(n - 1));
+    td_sort_comparisons = 0;
+    td_sort_radix_moves = 0;
+    CHECK(td_radix_sort(&td_default_allocator, means, weights, 0, n - 1) == 0,
+          "D: radix scratch allocation failed");
+    CHECK(td_sort_comparisons == 0, "D: radix sort performed key comparisons");
+    for (int i = 0; i < n; ++i) {
+        CHECK(means[i] == expected[i], "D: radix order differs from td_qsort at %d (n=%d)", i, n);
+        CHECK(input[weights[i]] == means[i], "D: weight %d not moved with its mean (n=%d)", i,
+              n);
+        if (i > 0 && means[i - 1] == means[i]) {
+            CHECK(weights[i - 1] < weights[i], "D: not stable at %d (n=%d)", i, n);
+        }
+    }
+    free(means);
+    free(expected);
+    free(weights);
+    free(expected_w);
+    return (double)td_sort_radix_moves;
+}
+
 int main(void) {
     /* Part A is O(n) so it runs at large sizes. Part B's killer GENERATION runs the adversarial
      * mirror sort, which is intentionally O(n^2), so it uses modest sizes; the fallback engages
@@ -312,6 +409,74 @@ int main(void) {
     CHECK(max_ratio <= 2.0 * min_ratio, "B: normalized comparison ratio not flat (%.3f..%.3f)",
           min_ratio, max_ratio);
 
+    /* Part C: with a merged prefix of m centroids in place, a compress must only pay for sorting
+     * the u buffered keys (measured ~1.3-1.4 u log2 u); the prefix is merged linearly instead of
+     * being re-sorted. Bound 2 u log2 u: re-sorting the full m + u ~ 2u range measures 3-6 u log2 u
+     * at these sizes, so a regression to the full sort fails it. */
+    printf("Part C - merge-only compress, sort cost bounded by the buffer:\n");
+    const int c_sizes[] = {64, 128, 256, 512};
+    for (unsigned i = 0; i < sizeof(c_sizes) / sizeof(c_sizes[0]); ++i) {
+        const int u = c_sizes[i];
+        int m = 0;
+        const double c = compares_buffer_only(u, 4.0 * u, &m);
+        const double bound = 2.0 * (double)u * log2((double)u);
+        printf("  u=%5d  m=%5d  cmps=%8.0f  bound(2*u*log2u)=%.0f\n", u, m, c, bound);
+        CHECK(c <= bound, "C: u=%d (m=%d) comparisons %.0f exceed buffer-only bound %.0f", u, m, c,
+              bound);
+    }
+
+    /* Part D: radix backend on the same adversarial inputs. All-duplicates shares every digit,
+     * so no pass runs at all; the median-of-3 killer is just another permutation to an LSD radix
+     * sort. Both must stay within 8n moves (one per executed digit pass) with a flat moves/n. */
+    printf("Part D - radix backend, must be stable and linear:\n");
+    for (int i = 0; i < na; ++i) {
+        const int n = a_sizes[i];
+        double *dups = (double *)calloc((size_t)n, sizeof(double));
+        if (dups == NULL) {
+            fprintf(stderr, "allocation failed at n=%d\n", n);
+            exit(1);
+        }
+        for (int j = 0; j < n; ++j) {
+            dups[j] = 42.0;
+        }
+        const double moves = radix_moves(dups, n);
+        printf("  all-equal n=%7d  moves=%10.0f  moves/n=%4.2f\n", n, moves, moves / n);
+        CHECK(moves <= 8.0 * n, "D: all-equal n=%d moves %.0f exceed 8n", n, moves);
+        free(dups);
+    }
+    double min_moves = 1e300;
+    double max_moves = 0.0;
+    for (int i = 0; i < nb; ++i) {
+        const int n = b_sizes[i];
+        double *killer = (double *)calloc((size_t)n, sizeof(double));
+        if (killer == NULL) {
+            fprintf(stderr, "allocation failed at n=%d\n", n);
+            exit(1);
+        }
+        gen_killer(n, killer);
+        /* Spread the killer over both signs and add duplicates so the key transform and the
+         * stability of equal runs are both exercised. */
+        for (int j = 0; j < n; ++j) {
+            killer[j] = (killer[j] - n / 2) / 4.0;
+            if (j % 5 == 0) {
+                killer[j] = floor(killer[j]);
+            }
+        }
+        const double moves = radix_moves(killer, n);
+        const double per_n = moves / n;
+        if (per_n < min_moves) {
+            min_moves = per_n;
+        }
+        if (per_n > max_moves) {
+            max_moves = per_n;
+        }
+        printf("  killer    n=%7d  moves=%10.0f  moves/n=%4.2f\n", n, moves, per_n);
+        CHECK(moves <= 8.0 * n, "D: killer n=%d moves %.0f exceed 8n", n, moves);
+        free(killer);
+    }
+    CHECK(max_moves <= 2.0 * min_moves, "D: moves per element not flat (%.2f..%.2f)", min_moves,
+          max_moves);
+
     if (failures == 0) {
         printf("OK\n");
         return 0;
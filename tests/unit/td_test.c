@@ -11,7 +11,14 @@
 #include <limits.h>
 
 #include <stdio.h>
+#include <string.h>
 #include "tdigest.h"
+#include "td_sharded.h"
+#include "td_store.h"
+#include "td_window.h"
+#include "td_decay.h"
+#include <pthread.h>
+#include <unistd.h>
 
 #include "minunit.h"
 
@@ -297,6 +304,331 @@ MU_TEST(test_trimmed_mean_complex) {
     td_free(t);
 }
 
+static void assert_same_centroids(const td_histogram_t *a, const td_histogram_t *b) {
+    mu_assert_double_eq(a->compression, b->compression);
+    mu_assert_int_eq(a->cap, b->cap);
+    mu_assert_int_eq(a->merged_nodes, b->merged_nodes);
+    mu_assert_long_eq(a->merged_weight, b->merged_weight);
+    mu_assert_int_eq(0, b->unmerged_nodes);
+    mu_assert(memcmp(&a->min, &b->min, sizeof(double)) == 0, "same min");
+    mu_assert(memcmp(&a->max, &b->max, sizeof(double)) == 0, "same max");
+    mu_assert(memcmp(a->nodes_mean, b->nodes_mean, a->merged_nodes * sizeof(double)) == 0,
+              "same means");
+    mu_assert(memcmp(a->nodes_weight, b->nodes_weight, a->merged_nodes * sizeof(long long)) == 0,
+              "same weights");
+}
+
+MU_TEST(test_serialize) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 0; i < 10000; ++i) {
+        const double v = i % 7 == 0 ? -0.0 : (i % 2 ? 1 : -1) * exp((double)(i % 997) / 50.0);
+        mu_assert(td_add(t, v, 1 + i % 5) == 0, "Insertion");
+    }
+    mu_assert(t->unmerged_nodes > 0, "samples are buffered");
+    const size_t size = td_serialized_size(t);
+    mu_assert_int_eq(0, t->unmerged_nodes);
+    // far below the 16 bytes per centroid of the node arrays
+    mu_assert(size < (size_t)t->merged_nodes * 12, "compact encoding");
+    unsigned char *buf = (unsigned char *)malloc(size + 1);
+    mu_assert(buf != NULL, "allocated");
+    size_t written = 0;
+    mu_assert_int_eq(EINVAL, td_serialize(t, buf, size - 1, &written));
+    mu_assert_int_eq(EINVAL, td_serialize(t, NULL, size, &written));
+    mu_assert_int_eq(0, td_serialize(t, buf, size + 1, &written));
+    mu_assert_int_eq((int)size, (int)written);
+
+    td_histogram_t *back = NULL;
+    mu_assert_int_eq(0, td_deserialize(buf, size, &back));
+    assert_same_centroids(t, back);
+    mu_assert_double_eq(td_quantile(t, 0.99), td_quantile(back, 0.99));
+    mu_assert_double_eq(td_cdf(t, 1.5), td_cdf(back, 1.5));
+    // the result accepts samples again
+    mu_assert(td_add(back, 3.0, 1) == 0, "Insertion");
+    mu_assert_long_eq(td_size(t) + 1, td_size(back));
+    td_free(back);
+
+    // every truncation, trailing bytes and a bad header are rejected, leaving result untouched
+    back = NULL;
+    for (size_t len = 0; len < size; ++len) {
+        mu_assert_int_eq(EINVAL, td_deserialize(buf, len, &back));
+    }
+    mu_assert_int_eq(EINVAL, td_deserialize(buf, size + 1, &back));
+    buf[2]++;
+    mu_assert_int_eq(EINVAL, td_deserialize(buf, size, &back));
+    buf[2]--;
+    mu_assert_int_eq(EINVAL, td_deserialize(NULL, size, &back));
+    mu_assert(back == NULL, "result untouched on failure");
+    free(buf);
+
+    // empty histogram
+    td_reset(t);
+    unsigned char empty[64];
+    mu_assert_int_eq(0, td_serialize(t, empty, sizeof(empty), &written));
+    mu_assert_int_eq((int)td_serialized_size(t), (int)written);
+    mu_assert_int_eq(0, td_deserialize(empty, written, &back));
+    assert_same_centroids(t, back);
+    mu_assert(isnan(td_quantile(back, 0.5)), "empty quantile is NaN");
+    td_free(back);
+
+    // corrupted centroids and capacities: a single sample of weight 1 ends in its weight byte
+    mu_assert(td_add(t, 5.0, 1) == 0, "Insertion");
+    unsigned char one[64];
+    unsigned char bad[64];
+    size_t one_len = 0;
+    mu_assert_int_eq(0, td_serialize(t, one, sizeof(one), &one_len));
+    mu_assert_int_eq(1, one[one_len - 1]);
+    back = NULL;
+    memcpy(bad, one, one_len);
+    bad[one_len - 1] = 0;
+    mu_assert_int_eq(EINVAL, td_deserialize(bad, one_len, &back));
+    // 2^64 - 1 as a ten-byte varint
+    memset(bad + one_len - 1, 0xff, 9);
+    bad[one_len + 8] = 0x01;
+    mu_assert_int_eq(EINVAL, td_deserialize(bad, one_len + 9, &back));
+    // the mean outside [min, max]
+    const double four = 4.0;
+    memcpy(bad, one, one_len);
+    memcpy(bad + 11, &four, 8);
+    memcpy(bad + 19, &four, 8);
+    mu_assert_int_eq(EINVAL, td_deserialize(bad, one_len, &back));
+    // a capacity of 100 (one varint byte) where compression 100 needs at least 111
+    memcpy(bad, one, 27);
+    bad[27] = 100;
+    memcpy(bad + 28, one + 29, one_len - 29);
+    mu_assert_int_eq(EINVAL, td_deserialize(bad, one_len - 1, &back));
+    mu_assert(back == NULL, "result untouched on failure");
+    mu_assert_int_eq(0, td_deserialize(one, one_len, &back));
+    mu_assert_long_eq(1, td_size(back));
+    td_free(back);
+    // a capacity of 40,000,000 (four varint bytes) is clamped to the default instead of allocated
+    const unsigned char huge_cap[4] = {0x80, 0xb4, 0x89, 0x13};
+    memcpy(bad, one, 27);
+    memcpy(bad + 27, huge_cap, 4);
+    memcpy(bad + 31, one + 29, one_len - 29);
+    mu_assert_int_eq(0, td_deserialize(bad, one_len + 2, &back));
+    mu_assert_int_eq(6 * 100 + 10, back->cap);
+    mu_assert_long_eq(1, td_size(back));
+    td_free(back);
+    // and so is the larger buffer of td_new_ex()
+    td_histogram_t *ex = td_new_ex(100, 1000);
+    mu_assert(ex != NULL, "created_histogram");
+    mu_assert(td_add(ex, 5.0, 1) == 0, "Insertion");
+    mu_assert_int_eq(0, td_serialize(ex, one, sizeof(one), &one_len));
+    mu_assert_int_eq(0, td_deserialize(one, one_len, &back));
+    mu_assert_int_eq(6 * 100 + 10, back->cap);
+    mu_assert_double_eq(td_quantile(ex, 0.5), td_quantile(back, 0.5));
+    td_free(back);
+    td_free(ex);
+    td_free(t);
+}
+
+MU_TEST(test_init_from_centroids) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 0; i < 100000; ++i) {
+        mu_assert(td_add(t, randfrom(-5, 5) * randfrom(0, 10), 1 + i % 4) == 0, "Insertion");
+    }
+    td_compress(t);
+    const int n = t->merged_nodes;
+
+    // sorted centroids are loaded as they are
+    td_histogram_t *h = NULL;
+    mu_assert_int_eq(0, td_init_from_centroids(100, t->nodes_mean, t->nodes_weight, (size_t)n,
+                                               t->min, t->max, &h));
+    assert_same_centroids(t, h);
+    mu_assert_double_eq(td_quantile(t, 0.999), td_quantile(h, 0.999));
+    mu_assert(td_add(h, 1, 1) == 0, "Insertion");
+    mu_assert_long_eq(td_size(t) + 1, td_size(h));
+    td_free(h);
+
+    // unsorted centroids are sorted once and folded into fewer, coarser ones
+    double *means = (double *)malloc((size_t)n * sizeof(double));
+    long long *weights = (long long *)malloc((size_t)n * sizeof(long long));
+    mu_assert(means && weights, "allocated");
+    for (int i = 0; i < n; i++) {
+        const int j = (int)(((long long)i * 7919) % n);
+        means[i] = t->nodes_mean[j];
+        weights[i] = t->nodes_weight[j];
+    }
+    mu_assert_int_eq(0, td_init_from_centroids(25, means, weights, (size_t)n, t->min, t->max, &h));
+    mu_assert(h->merged_nodes < n, "folded by the k-scale pass");
+    mu_assert_long_eq(td_size(t), td_size(h));
+    mu_assert_double_eq(td_min(t), td_min(h));
+    mu_assert_double_eq(td_max(t), td_max(h));
+    for (int i = 1; i < h->merged_nodes; i++) {
+        mu_assert(h->nodes_mean[i - 1] <= h->nodes_mean[i], "sorted");
+    }
+    // within 1% of the [-50, 50] range
+    mu_assert_double_eq_epsilon(td_quantile(t, 0.5), td_quantile(h, 0.5), 1.0);
+    mu_assert_double_eq(td_quantile(h, 0.5), td_quantile_const(h, 0.5));
+    td_free(h);
+    free(means);
+    free(weights);
+
+    // more centroids than the node arrays hold
+    const size_t many = 50000;
+    means = (double *)malloc(many * sizeof(double));
+    weights = (long long *)malloc(many * sizeof(long long));
+    mu_assert(means && weights, "allocated");
+    for (size_t i = 0; i < many; i++) {
+        means[i] = (double)((i * 7919) % many);
+        weights[i] = 1;
+    }
+    mu_assert_int_eq(0, td_init_from_centroids(100, means, weights, many, 0, many - 1, &h));
+    mu_assert(h->merged_nodes <= h->cap, "fits the node arrays");
+    mu_assert_long_eq(many, td_size(h));
+    mu_assert_double_eq_epsilon(many / 2.0, td_quantile(h, 0.5), many * 0.01);
+    mu_assert_double_eq_epsilon(many * 0.99, td_quantile(h, 0.99), many * 0.001);
+    td_free(h);
+
+    // invalid input leaves result untouched
+    td_histogram_t *untouched = t;
+    h = untouched;
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, means, weights, many, 0, 10, &h));
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, means, weights, many, NAN, many, &h));
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(0, means, weights, many, 0, many, &h));
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, NULL, weights, many, 0, many, &h));
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, means, NULL, many, 0, many, &h));
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, means, weights, many, 0, many, NULL));
+    means[3] = NAN;
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, means, weights, many, 0, many, &h));
+    means[3] = 3;
+    weights[3] = 0;
+    mu_assert_int_eq(EINVAL, td_init_from_centroids(100, means, weights, many, 0, many, &h));
+    weights[3] = LLONG_MAX / 2;
+    weights[4] = LLONG_MAX / 2;
+    weights[5] = LLONG_MAX / 2;
+    mu_assert_int_eq(EDOM, td_init_from_centroids(100, means, weights, many, 0, many, &h));
+    mu_assert(h == untouched, "result untouched on failure");
+    free(means);
+    free(weights);
+
+    // no centroids
+    mu_assert_int_eq(0, td_init_from_centroids(100, NULL, NULL, 0, NAN, NAN, &h));
+    mu_assert_long_eq(0, td_size(h));
+    mu_assert(isnan(td_quantile(h, 0.5)), "empty quantile is NaN");
+    td_free(h);
+    td_free(t);
+}
+
+MU_TEST(test_view) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 0; i < 10000; ++i) {
+        mu_assert(td_add(t, (i % 2 ? 1 : -1) * exp((double)(i % 997) / 50.0), 1 + i % 3) == 0,
+                  "Insertion");
+    }
+    const size_t size = td_view_serialized_size(t);
+    mu_assert_int_eq(0, t->unmerged_nodes);
+    mu_assert_int_eq(48 + (3 * t->merged_nodes + 1) * 8, (int)size);
+    // one spare word so the layout can also be placed at a misaligned address
+    double *storage = (double *)malloc(size + sizeof(double));
+    mu_assert(storage != NULL, "allocated");
+    unsigned char *buf = (unsigned char *)storage;
+    size_t written = 0;
+    mu_assert_int_eq(EINVAL, td_view_serialize(t, buf, size - 1, &written));
+    mu_assert_int_eq(0, td_view_serialize(t, buf, size, &written));
+    mu_assert_int_eq((int)size, (int)written);
+
+    td_view_t v;
+    mu_assert_int_eq(0, td_view_open(&v, buf, size));
+    mu_assert((const unsigned char *)v.mean == buf + 48, "means are read in place");
+    mu_assert_int_eq(t->merged_nodes, td_view_centroid_count(&v));
+    mu_assert_long_eq(td_size(t), td_view_size(&v));
+    mu_assert_int_eq(t->cap, v.cap);
+    mu_assert_double_eq(t->compression, v.compression);
+    mu_assert_double_eq(td_min(t), v.min);
+    mu_assert_double_eq(td_max(t), v.max);
+    const double qs[] = {0, 0.001, 0.01, 0.25, 0.5, 0.75, 0.99, 0.999, 1};
+    double from_view[9];
+    double from_histogram[9];
+    mu_assert_int_eq(0, td_view_quantiles(&v, qs, from_view, 9));
+    mu_assert_int_eq(0, td_quantiles(t, qs, from_histogram, 9));
+    for (int i = 0; i < 9; i++) {
+        mu_assert_double_eq(from_histogram[i], from_view[i]);
+        mu_assert_double_eq(td_quantile(t, qs[i]), td_view_quantile(&v, qs[i]));
+    }
+    const double xs[] = {100, -1e9, -3, 0, 0.5, 2, 1e9};
+    mu_assert_int_eq(0, td_view_cdfs(&v, xs, from_view, 7));
+    mu_assert_int_eq(0, td_cdfs(t, xs, from_histogram, 7));
+    for (int i = 0; i < 7; i++) {
+        mu_assert_double_eq(from_histogram[i], from_view[i]);
+        mu_assert_double_eq(td_cdf(t, xs[i]), td_view_cdf(&v, xs[i]));
+    }
+    mu_assert_double_eq(td_trimmed_mean(t, 0.1, 0.8), td_view_trimmed_mean(&v, 0.1, 0.8));
+    mu_assert_double_eq(td_trimmed_mean_symmetric(t, 0.2),
+                        td_view_trimmed_mean_symmetric(&v, 0.2));
+
+    // a failed open leaves the view untouched
+    td_view_t untouched = v;
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf, size - 1));
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf, size + 8));
+    mu_assert_int_eq(EINVAL, td_view_open(&v, NULL, size));
+    mu_assert_int_eq(EINVAL, td_view_open(NULL, buf, size));
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf, 47));
+    memmove(buf + 4, buf, size);
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf + 4, size));
+    memmove(buf, buf + 4, size);
+    buf[0] ^= 0xff;
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf, size));
+    buf[0] ^= 0xff;
+    buf[4]++;
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf, size));
+    buf[4]--;
+    // a node capacity its compression cannot have, or min above max
+    int32_t cap;
+    memcpy(&cap, buf + 40, 4);
+    const int32_t bad_caps[] = {INT32_MAX, 6 * 100 + 11, 100 + 10, -1};
+    for (size_t i = 0; i < sizeof(bad_caps) / sizeof(bad_caps[0]); i++) {
+        memcpy(buf + 40, &bad_caps[i], 4);
+        mu_assert_int_eq(EINVAL, td_view_open(&v, buf, size));
+    }
+    memcpy(buf + 40, &cap, 4);
+    memcpy(buf + 16, &t->max, 8);
+    memcpy(buf + 24, &t->min, 8);
+    mu_assert_int_eq(EINVAL, td_view_open(&v, buf, size));
+    memcpy(buf + 16, &t->min, 8);
+    memcpy(buf + 24, &t->max, 8);
+    mu_assert(memcmp(&untouched, &v, sizeof(v)) == 0, "view untouched");
+    mu_assert_int_eq(0, td_view_open(&v, buf, size));
+
+    // unsorted centroids are only caught on the way into a histogram
+    td_histogram_t *expanded = NULL;
+    double *means = (double *)(buf + 48);
+    const double first = means[0];
+    means[0] = means[1] + 1;
+    mu_assert_int_eq(0, td_view_open(&v, buf, size));
+    mu_assert_int_eq(EINVAL, td_view_expand(&v, &expanded));
+    means[0] = first;
+    mu_assert(expanded == NULL, "result untouched on failure");
+    mu_assert_int_eq(0, td_view_expand(&v, &expanded));
+    mu_assert_int_eq(t->cap, expanded->cap);
+    td_free(expanded);
+    free(storage);
+
+    // a larger buffer is recorded as the default capacity
+    td_histogram_t *buffered = td_new_ex(100, 1000);
+    mu_assert(buffered != NULL, "created_histogram");
+    mu_assert(td_add(buffered, 1.0, 1) == 0, "Insertion");
+    double small[16];
+    mu_assert_int_eq(0, td_view_serialize(buffered, small, sizeof(small), &written));
+    mu_assert_int_eq(0, td_view_open(&v, small, written));
+    mu_assert_int_eq(t->cap, v.cap);
+    td_free(buffered);
+
+    // empty histogram
+    td_reset(t);
+    double empty[8];
+    mu_assert_int_eq(56, (int)td_view_serialized_size(t));
+    mu_assert_int_eq(0, td_view_serialize(t, empty, sizeof(empty), &written));
+    mu_assert_int_eq(0, td_view_open(&v, empty, written));
+    mu_assert_int_eq(0, td_view_centroid_count(&v));
+    mu_assert(isnan(td_view_quantile(&v, 0.5)), "empty quantile is NaN");
+    mu_assert(isnan(td_view_cdf(&v, 0.5)), "empty cdf is NaN");
+    td_free(t);
+}
+
 MU_TEST(test_compress_small) {
     td_histogram_t *t = td_new(100);
     mu_assert(t != NULL, "created_histogram");
@@ -389,6 +721,224 @@ MU_TEST(test_negative_values_merge) {
     td_free(d2);
 }
 
+MU_TEST(test_merge_linear) {
+    td_histogram_t *all = td_new(100);
+    td_histogram_t *into = td_new(100);
+    // from's centroids alone overflow the capacity of this one
+    td_histogram_t *small = td_new_ex(20, 1);
+    mu_assert(all != NULL && into != NULL && small != NULL, "created_histogram");
+    for (int d = 0; d < 20; ++d) {
+        td_histogram_t *from = td_new(100);
+        mu_assert(from != NULL, "created_histogram");
+        for (int i = 0; i < 1000; ++i) {
+            const double v = (double)((i * 7919 + d * 104729) % 10007) + d;
+            mu_assert(td_add(from, v, 1) == 0, "Insertion");
+            mu_assert(td_add(all, v, 1) == 0, "Insertion");
+        }
+        const int compressions = into->total_compressions;
+        mu_assert_int_eq(0, td_merge(into, from));
+        // merged in one pass, nothing left buffered
+        mu_assert_int_eq(0, into->unmerged_nodes);
+        mu_assert_int_eq(compressions + 1, into->total_compressions);
+        // too little room to merge in place, falls back to replaying the centroids
+        mu_assert(small->merged_nodes + from->merged_nodes > small->cap, "no room to merge");
+        mu_assert_int_eq(0, td_merge(small, from));
+        td_free(from);
+    }
+    mu_assert_long_eq(td_size(all), td_size(into));
+    mu_assert_long_eq(td_size(all), td_size(small));
+    mu_assert_double_eq(td_min(all), td_min(into));
+    mu_assert_double_eq(td_max(all), td_max(into));
+    for (double q = 0.01; q < 1; q += 0.01) {
+        mu_assert_double_eq_epsilon(td_quantile(all, q), td_quantile(into, q), 40.0);
+    }
+
+    // merging into itself doubles every weight
+    const double p50 = td_quantile(into, 0.5);
+    mu_assert_int_eq(0, td_merge(into, into));
+    mu_assert_long_eq(2 * td_size(all), td_size(into));
+    mu_assert_double_eq_epsilon(p50, td_quantile(into, 0.5), 40.0);
+
+    // merging an empty histogram is a no-op
+    td_histogram_t *empty = td_new(100);
+    mu_assert(empty != NULL, "created_histogram");
+    mu_assert_int_eq(0, td_merge(into, empty));
+    mu_assert_long_eq(2 * td_size(all), td_size(into));
+    mu_assert_int_eq(0, td_merge(empty, into));
+    mu_assert_long_eq(td_size(into), td_size(empty));
+    mu_assert_double_eq(td_min(into), td_min(empty));
+    td_free(empty);
+    td_free(all);
+    td_free(into);
+    td_free(small);
+}
+
+static void *test_no_memory_alloc(void *ctx, size_t size) {
+    (void)ctx;
+    (void)size;
+    return NULL;
+}
+
+MU_TEST(test_merge_many) {
+    td_histogram_t *froms[51];
+    td_histogram_t *all = td_new(100);
+    td_histogram_t *into = td_new(100);
+    mu_assert(all != NULL && into != NULL, "created_histogram");
+    for (int d = 0; d < 50; ++d) {
+        froms[d] = td_new(100);
+        mu_assert(froms[d] != NULL, "created_histogram");
+        // a few samples each, most of them left buffered
+        for (int i = 0; i < 200 + d; ++i) {
+            const double v = (double)((i * 7919 + d * 104729) % 10007) - 5000;
+            mu_assert(td_add(froms[d], v, 1 + i % 3) == 0, "Insertion");
+            mu_assert(td_add(all, v, 1 + i % 3) == 0, "Insertion");
+        }
+    }
+    // an empty one is skipped
+    froms[50] = td_new(100);
+    mu_assert(froms[50] != NULL, "created_histogram");
+    mu_assert(td_add(into, 123.0, 1) == 0, "Insertion");
+    mu_assert(td_add(all, 123.0, 1) == 0, "Insertion");
+
+    mu_assert_int_eq(0, td_merge_many(into, froms, 51));
+    mu_assert_int_eq(0, into->unmerged_nodes);
+    mu_assert_long_eq(td_size(all), td_size(into));
+    mu_assert_double_eq(td_min(all), td_min(into));
+    mu_assert_double_eq(td_max(all), td_max(into));
+    for (double q = 0.01; q < 1; q += 0.01) {
+        mu_assert_double_eq_epsilon(td_quantile(all, q), td_quantile(into, q), 40.0);
+    }
+
+    // nothing to merge
+    mu_assert_int_eq(0, td_merge_many(into, froms + 50, 1));
+    mu_assert_int_eq(0, td_merge_many(into, NULL, 0));
+    mu_assert_int_eq(EINVAL, td_merge_many(into, NULL, 1));
+    mu_assert_long_eq(td_size(all), td_size(into));
+
+    // the target may also be one of the sources
+    td_histogram_t *self[2] = {into, froms[0]};
+    const long long before = td_size(into);
+    mu_assert_int_eq(0, td_merge_many(into, self, 2));
+    mu_assert_long_eq(2 * before + td_size(froms[0]), td_size(into));
+
+    // an overflowing combined weight is reported before anything is merged
+    td_histogram_t *heavy[2] = {td_new(100), td_new(100)};
+    mu_assert(heavy[0] != NULL && heavy[1] != NULL, "created_histogram");
+    mu_assert(td_add(heavy[0], 1.0, LLONG_MAX / 2) == 0, "Insertion");
+    mu_assert(td_add(heavy[1], 2.0, LLONG_MAX / 2) == 0, "Insertion");
+    const long long size_before = td_size(into);
+    const int centroids_before = td_centroid_count(into);
+    mu_assert_int_eq(EDOM, td_merge_many(into, heavy, 2));
+    mu_assert_long_eq(size_before, td_size(into));
+    mu_assert_int_eq(centroids_before, td_centroid_count(into));
+    td_free(heavy[0]);
+    td_free(heavy[1]);
+
+    // a lazily allocated target that cannot grow fails before anything is merged
+    td_histogram_t *lazy = NULL;
+    mu_assert_int_eq(0, td_init_lazy(100, &lazy));
+    mu_assert(td_add(lazy, 123.0, 1) == 0, "Insertion");
+    const td_allocator_t allocator = lazy->allocator;
+    const td_allocator_t no_memory = {test_no_memory_alloc, NULL, NULL};
+    lazy->allocator = no_memory;
+    mu_assert_int_eq(ENOMEM, td_merge_many(lazy, froms, 51));
+    mu_assert_long_eq(1, td_size(lazy));
+    mu_assert_int_eq(1, td_centroid_count(lazy));
+    lazy->allocator = allocator;
+    mu_assert_int_eq(0, td_merge_many(lazy, froms, 51));
+    mu_assert_long_eq(td_size(all), td_size(lazy));
+    td_free(lazy);
+
+    for (int d = 0; d < 51; ++d) {
+        td_free(froms[d]);
+    }
+    td_free(all);
+    td_free(into);
+}
+
+MU_TEST(test_recompress) {
+    // a digest built at the target compression from the same samples
+    td_histogram_t *reference = td_new(100);
+    td_histogram_t *h = td_new(500);
+    td_histogram_t *lazy = NULL;
+    mu_assert_int_eq(0, td_init_lazy(500, &lazy));
+    mu_assert(reference != NULL && h != NULL, "created_histogram");
+    for (int i = 0; i < 100000; ++i) {
+        const double v = (double)((i * 7919) % 100000) / 100.0;
+        mu_assert(td_add(reference, v, 1) == 0, "Insertion");
+        mu_assert(td_add(h, v, 1) == 0, "Insertion");
+        mu_assert(td_add(lazy, v, 1) == 0, "Insertion");
+    }
+    td_histogram_t *before = h;
+    mu_assert_int_eq(EINVAL, td_recompress(NULL, 100));
+    mu_assert_int_eq(EINVAL, td_recompress(&h, 1000));
+    mu_assert_int_eq(EINVAL, td_recompress(&h, NAN));
+    mu_assert(h == before, "untouched on failure");
+    const size_t usage = td_memory_usage(h);
+    const int centroids = td_centroid_count(h);
+
+    mu_assert_int_eq(0, td_recompress(&h, 100));
+    mu_assert_double_eq(100, h->compression);
+    mu_assert_int_eq(610, h->cap);
+    mu_assert(td_memory_usage(h) < usage / 4, "moved to a smaller block");
+    mu_assert(td_centroid_count(h) < centroids / 2, "centroids folded");
+    mu_assert(td_centroid_count(h) <= td_centroid_count(reference) * 2, "close to a fresh digest");
+    mu_assert_long_eq(100000, td_size(h));
+    mu_assert_double_eq(0, td_min(h));
+    mu_assert_double_eq(999.99, td_max(h));
+    for (int i = 1; i < 100; ++i) {
+        const double q = i / 100.0;
+        mu_assert_double_eq_epsilon(q * 1000, td_quantile(h, q), 5.0);
+    }
+
+    // lazily allocated nodes shrink in place
+    td_histogram_t *lazy_before = lazy;
+    const size_t lazy_usage = td_memory_usage(lazy);
+    mu_assert_int_eq(0, td_recompress(&lazy, 100));
+    mu_assert(lazy == lazy_before, "recompressed in place");
+    mu_assert(td_memory_usage(lazy) < lazy_usage / 4, "nodes shrunk");
+    mu_assert_int_eq(td_centroid_count(h), td_centroid_count(lazy));
+    mu_assert_double_eq(td_quantile(h, 0.5), td_quantile(lazy, 0.5));
+
+    // and both keep working
+    for (int i = 0; i < 10000; ++i) {
+        mu_assert(td_add(h, 2000, 1) == 0, "Insertion");
+        mu_assert(td_add(lazy, 2000, 1) == 0, "Insertion");
+    }
+    mu_assert_double_eq(2000, td_quantile(h, 0.99));
+    mu_assert_double_eq(2000, td_quantile(lazy, 0.99));
+
+    // a small block from td_init_ex() keeps its cap
+    td_histogram_t *ex = td_new_ex(500, 50);
+    mu_assert(ex != NULL, "created_histogram");
+    for (int i = 0; i < 10000; ++i) {
+        mu_assert(td_add(ex, i, 1) == 0, "Insertion");
+    }
+    td_histogram_t *ex_before = ex;
+    mu_assert_int_eq(0, td_recompress(&ex, 100));
+    mu_assert(ex == ex_before, "recompressed in place");
+    mu_assert_int_eq(560, ex->cap);
+    mu_assert_double_eq_epsilon(5000, td_quantile(ex, 0.5), 100.0);
+
+    // the exact phase ends
+    td_histogram_t *exact = td_new(100);
+    mu_assert(exact != NULL, "created_histogram");
+    mu_assert_int_eq(0, td_set_exact_threshold(exact, 300));
+    for (int i = 0; i < 200; ++i) {
+        mu_assert(td_add(exact, i, 1) == 0, "Insertion");
+    }
+    mu_assert_int_eq(0, td_recompress(&exact, 10));
+    mu_assert(!td_is_exact(exact), "folded into centroids");
+    mu_assert_int_eq(34, exact->exact_threshold); // (70 - 1) / 2
+    mu_assert(td_centroid_count(exact) < 50, "folded into centroids");
+
+    td_free(reference);
+    td_free(h);
+    td_free(lazy);
+    td_free(ex);
+    td_free(exact);
+}
+
 MU_TEST(test_large_outlier_test) {
     td_histogram_t *t = td_new(100);
     mu_assert(t != NULL, "created_histogram");
@@ -448,6 +998,72 @@ MU_TEST(test_add_nonfinite) {
     td_free(t);
 }
 
+// td_add_batch() must build exactly the digest that td_add() would, and stop at the first
+// rejected element while keeping every element before it.
+MU_TEST(test_add_batch) {
+    const size_t n = 20000;
+    double *values = (double *)malloc(n * sizeof(double));
+    long long *weights = (long long *)malloc(n * sizeof(long long));
+    mu_assert(values != NULL && weights != NULL, "allocated input");
+    for (size_t i = 0; i < n; ++i) {
+        values[i] = randfrom(-100, 100);
+        weights[i] = 1 + (long long)(i % 7);
+    }
+    td_histogram_t *one = td_new(100);
+    td_histogram_t *batch = td_new(100);
+    td_histogram_t *unit_one = td_new(100);
+    td_histogram_t *unit_batch = td_new(100);
+    for (size_t i = 0; i < n; ++i) {
+        mu_assert(td_add(one, values[i], weights[i]) == 0, "Insertion");
+        mu_assert(td_add(unit_one, values[i], 1) == 0, "Insertion");
+    }
+    size_t rejected = 0;
+    // Feed the batch in uneven blocks so block edges and buffer edges do not line up.
+    for (size_t i = 0; i < n; i += 777) {
+        const size_t len = MIN(777, n - i);
+        mu_assert(td_add_batch(batch, values + i, weights + i, len, &rejected) == 0, "batch");
+        mu_assert(rejected == len, "a successful batch reports n");
+        mu_assert(td_add_batch_unweighted(unit_batch, values + i, len, NULL) == 0, "batch");
+    }
+    td_histogram_t *pairs[2][2] = {{one, batch}, {unit_one, unit_batch}};
+    for (int p = 0; p < 2; ++p) {
+        td_histogram_t *a = pairs[p][0];
+        td_histogram_t *b = pairs[p][1];
+        mu_assert_long_eq(a->total_compressions, b->total_compressions);
+        mu_assert_int_eq(td_centroid_count(a), td_centroid_count(b));
+        mu_assert_long_eq(td_size(a), td_size(b));
+        mu_assert_double_eq(td_min(a), td_min(b));
+        mu_assert_double_eq(td_max(a), td_max(b));
+        for (int i = 0; i < td_centroid_count(a); ++i) {
+            mu_assert_double_eq(a->nodes_mean[i], b->nodes_mean[i]);
+            mu_assert_long_eq(a->nodes_weight[i], b->nodes_weight[i]);
+        }
+    }
+    td_free(one);
+    td_free(batch);
+    td_free(unit_one);
+    td_free(unit_batch);
+    free(values);
+    free(weights);
+
+    td_histogram_t *t = td_new(100);
+    const double with_nan[6] = {1, 2, 3, 4, NAN, 6};
+    mu_assert(td_add_batch_unweighted(t, with_nan, 6, &rejected) == EINVAL, "NaN rejected");
+    mu_assert(rejected == 4, "rejected index reported");
+    mu_assert_long_eq(4, td_size(t));
+    mu_assert_double_eq(4.0, td_max(t));
+    td_reset(t);
+    const double big[3] = {1, 2, 3};
+    const long long big_weights[3] = {1, __LONG_LONG_MAX__, 1};
+    mu_assert(td_add_batch(t, big, big_weights, 3, &rejected) == EDOM, "overflow rejected");
+    mu_assert(rejected == 1, "overflowing index reported");
+    mu_assert_long_eq(1, td_size(t));
+    mu_assert(td_add_batch(t, NULL, big_weights, 3, &rejected) == EINVAL, "NULL values");
+    mu_assert(td_add_batch(t, big, big_weights, 0, &rejected) == 0, "empty batch");
+    mu_assert(rejected == 0, "empty batch reports 0");
+    td_free(t);
+}
+
 MU_TEST(test_two_interp) {
     td_histogram_t *t = td_new(1000);
     mu_assert(td_add(t, 1, 1) == 0, "Insertion");
@@ -809,6 +1425,1212 @@ MU_TEST(test_td_init_large_success_is_usable) {
     td_free(t);
 }
 
+// td_init_ex() decouples the unmerged buffer from compression: cap = compression + 10 + buffer.
+MU_TEST(test_init_in_place) {
+    mu_assert_int_eq(0, (int)td_required_size(0));
+    mu_assert_int_eq(0, (int)td_required_size(NAN));
+    const size_t size = td_required_size(100);
+    mu_assert(size >= sizeof(td_histogram_t) + 610 * 16, "room for the header and both arrays");
+
+    // 8-byte aligned but not on a cache line, so the padding after the header is the largest
+    char *storage = (char *)malloc(size + 2 * 64);
+    mu_assert(storage != NULL, "allocated");
+    char *mem = (char *)(((uintptr_t)storage + 63) & ~(uintptr_t)63) + 8;
+    memset(mem, 0xab, size);
+    td_histogram_t *h = NULL;
+    mu_assert_int_eq(1, td_init_in_place(mem, size - 1, 100, &h));
+    mu_assert_int_eq(1, td_init_in_place(mem + 4, size, 100, &h));
+    mu_assert_int_eq(1, td_init_in_place(NULL, size, 100, &h));
+    mu_assert_int_eq(1, td_init_in_place(mem, size, 0, &h));
+    mu_assert(h == NULL, "result untouched on failure");
+    mu_assert_int_eq(0, td_init_in_place(mem, size, 100, &h));
+    mu_assert((char *)h == mem, "the header is at the start of the block");
+    mu_assert_int_eq(610, h->cap);
+    mu_assert(((uintptr_t)h->nodes_mean & 63) == 0, "means on a cache line");
+    mu_assert(((uintptr_t)h->nodes_weight & 63) == 0, "weights on a cache line");
+    mu_assert((char *)(h->nodes_weight + h->cap) <= mem + size, "the arrays fit the block");
+
+    // behaves exactly like a histogram from td_new()
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    mu_assert(((uintptr_t)t->nodes_mean & 63) == 0, "means on a cache line");
+    mu_assert(((uintptr_t)t->nodes_weight & 63) == 0, "weights on a cache line");
+    mu_assert_int_eq(0, td_set_ingest_flags(h, TD_COLLAPSE_DUPLICATES));
+    mu_assert_int_eq(0, td_set_ingest_flags(t, TD_COLLAPSE_DUPLICATES));
+    for (int i = 0; i < 100000; ++i) {
+        const double v = (double)(i % 1000) / 10.0;
+        mu_assert(td_add(h, v, 1) == 0, "Insertion");
+        mu_assert(td_add(t, v, 1) == 0, "Insertion");
+    }
+    mu_assert_double_eq(td_quantile(t, 0.99), td_quantile(h, 0.99));
+    mu_assert_double_eq(td_cdf(t, 42), td_cdf(h, 42));
+    td_free(t);
+    // releases the duplicates table only; the block is still the caller's
+    td_free(h);
+    free(storage);
+}
+
+// Bump allocator over a fixed buffer that counts its calls; released memory is never reused.
+struct test_arena {
+    unsigned char buf[64 * 1024];
+    size_t used;
+    int allocs;
+    int releases;
+};
+
+static void *test_arena_alloc(void *ctx, size_t size) {
+    struct test_arena *a = (struct test_arena *)ctx;
+    const size_t start = (a->used + 15) & ~(size_t)15;
+    if (start + size > sizeof(a->buf)) {
+        return NULL;
+    }
+    a->used = start + size;
+    a->allocs++;
+    return a->buf + start;
+}
+
+static void test_arena_release(void *ctx, void *ptr) {
+    struct test_arena *a = (struct test_arena *)ctx;
+    mu_assert((unsigned char *)ptr >= a->buf && (unsigned char *)ptr < a->buf + a->used,
+              "released memory comes from the arena");
+    a->releases++;
+}
+
+MU_TEST(test_init_with_allocator) {
+    static struct test_arena arena;
+    memset(&arena, 0, sizeof(arena));
+    const td_allocator_t allocator = {test_arena_alloc, test_arena_release, &arena};
+    const td_allocator_t no_alloc = {NULL, test_arena_release, &arena};
+    td_histogram_t *h = NULL;
+    mu_assert_int_eq(1, td_init_with_allocator(100, 0, NULL, &h));
+    mu_assert_int_eq(1, td_init_with_allocator(100, 0, &no_alloc, &h));
+    mu_assert_int_eq(1, td_init_with_allocator(100, 0, &allocator, NULL));
+    mu_assert_int_eq(1, td_init_with_allocator(NAN, 0, &allocator, &h));
+    mu_assert_int_eq(1, td_init_with_allocator(100, -1, &allocator, &h));
+    // too large for the arena
+    mu_assert_int_eq(1, td_init_with_allocator(10000, 0, &allocator, &h));
+    mu_assert(h == NULL, "result untouched on failure");
+    mu_assert_int_eq(0, arena.releases);
+
+    mu_assert_int_eq(0, td_init_with_allocator(100, 0, &allocator, &h));
+    mu_assert((unsigned char *)h >= arena.buf && (unsigned char *)h < arena.buf + arena.used,
+              "the block comes from the arena");
+    mu_assert_int_eq(610, h->cap);
+    td_histogram_t *e = NULL;
+    mu_assert_int_eq(0, td_init_with_allocator(100, 100, &allocator, &e));
+    mu_assert_int_eq(210, e->cap);
+    td_free(e);
+    mu_assert_int_eq(2, arena.allocs);
+    mu_assert_int_eq(1, arena.releases);
+
+    // every allocation on behalf of the histogram goes through the arena
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    mu_assert_int_eq(0, td_set_ingest_flags(h, TD_COLLAPSE_DUPLICATES));
+    mu_assert_int_eq(3, arena.allocs);
+    for (int i = 0; i < 1000; ++i) {
+        const double v = (double)((i * 7919) % 1000);
+        mu_assert(td_add(h, v, 1) == 0, "Insertion");
+        mu_assert(td_add(t, v, 1) == 0, "Insertion");
+    }
+    // queries on the buffered samples merge them in scratch arrays
+    const int allocs = arena.allocs;
+    mu_assert_double_eq(td_quantile(t, 0.5), td_quantile_const(h, 0.5));
+    mu_assert(arena.allocs > allocs, "scratch from the arena");
+    const double xs[3] = {700, 100, 400};
+    double out_h[3];
+    double out_t[3];
+    mu_assert_int_eq(0, td_cdfs(h, xs, out_h, 3));
+    mu_assert_int_eq(0, td_cdfs(t, xs, out_t, 3));
+    for (int i = 0; i < 3; ++i) {
+        mu_assert_double_eq(out_t[i], out_h[i]);
+    }
+    td_free(t);
+    td_free(h);
+    mu_assert_int_eq(arena.allocs, arena.releases);
+
+    // without a release hook the memory is simply left to the arena
+    const td_allocator_t bump = {test_arena_alloc, NULL, &arena};
+    arena.used = 0;
+    mu_assert_int_eq(0, td_init_with_allocator(100, 0, &bump, &h));
+    mu_assert_int_eq(0, td_set_ingest_flags(h, TD_COLLAPSE_DUPLICATES));
+    mu_assert(td_add(h, 1, 1) == 0, "Insertion");
+    mu_assert_double_eq(1, td_quantile_const(h, 0.5));
+    td_free(h);
+    mu_assert_int_eq(arena.allocs - arena.releases, 4);
+}
+
+MU_TEST(test_init_lazy) {
+    td_histogram_t *h = NULL;
+    mu_assert_int_eq(1, td_init_lazy(0, &h));
+    mu_assert_int_eq(1, td_init_lazy(100, NULL));
+    mu_assert(h == NULL, "result untouched on failure");
+    mu_assert_int_eq(0, td_init_lazy(100, &h));
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    mu_assert_int_eq(t->cap, h->cap);
+    mu_assert(td_memory_usage(t) > 610 * 16, "td_new() allocates every node up front");
+    for (int i = 0; i < 3; ++i) {
+        mu_assert(td_add(h, i, 1) == 0, "Insertion");
+        mu_assert(td_add(t, i, 1) == 0, "Insertion");
+    }
+    mu_assert(td_memory_usage(h) < 1024, "a sparse digest stays small");
+    mu_assert_double_eq(td_quantile(t, 0.5), td_quantile(h, 0.5));
+
+    // grows through td_add(), td_add_batch() and td_merge() into the digest td_new() builds
+    double batch[1000];
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < 1000; ++i) {
+            const double v = (double)((i * 7919 + round * 104729) % 100000) / 7.0;
+            mu_assert(td_add(h, v, 1 + i % 3) == 0, "Insertion");
+            mu_assert(td_add(t, v, 1 + i % 3) == 0, "Insertion");
+            batch[i] = v / 3;
+        }
+        mu_assert_int_eq(0, td_add_batch_unweighted(h, batch, 1000, NULL));
+        mu_assert_int_eq(0, td_add_batch_unweighted(t, batch, 1000, NULL));
+    }
+    mu_assert(h->nodes_cap <= h->cap, "never grows past cap");
+    td_histogram_t *from = td_new(100);
+    mu_assert(from != NULL, "created_histogram");
+    for (int i = 0; i < 5000; ++i) {
+        mu_assert(td_add(from, 20000 + i, 1) == 0, "Insertion");
+    }
+    mu_assert_int_eq(0, td_merge(h, from));
+    mu_assert_int_eq(0, td_merge(t, from));
+    td_free(from);
+    for (int i = 0; i <= 100; ++i) {
+        mu_assert_double_eq(td_quantile(t, i / 100.0), td_quantile(h, i / 100.0));
+    }
+    mu_assert_double_eq(td_cdf(t, 5000), td_cdf(h, 5000));
+    mu_assert_int_eq(t->merged_nodes, h->merged_nodes);
+
+    // shrinks to the merged centroids and their cumulative index, with the same answers
+    const size_t before = td_memory_usage(h);
+    mu_assert_int_eq(0, td_shrink_to_fit(h));
+    mu_assert_int_eq(0, td_shrink_to_fit(t));
+    mu_assert(td_memory_usage(h) < before, "shrunk");
+    mu_assert_int_eq(2 * h->merged_nodes + 1, h->nodes_cap);
+    mu_assert_int_eq(t->cap, t->nodes_cap);
+    for (int i = 0; i <= 100; ++i) {
+        mu_assert_double_eq(td_quantile(t, i / 100.0), td_quantile(h, i / 100.0));
+    }
+    mu_assert_double_eq(td_trimmed_mean(t, 0.1, 0.9), td_trimmed_mean(h, 0.1, 0.9));
+    // and grows back
+    for (int i = 0; i < 10000; ++i) {
+        mu_assert(td_add(h, i, 1) == 0, "Insertion");
+        mu_assert(td_add(t, i, 1) == 0, "Insertion");
+    }
+    mu_assert_double_eq(td_quantile(t, 0.99), td_quantile(h, 0.99));
+
+    // TD_COLLAPSE_DUPLICATES keeps working across growth
+    td_reset(h);
+    td_reset(t);
+    mu_assert_int_eq(0, td_shrink_to_fit(h));
+    mu_assert_int_eq(16, h->nodes_cap);
+    mu_assert_int_eq(0, td_set_ingest_flags(h, TD_COLLAPSE_DUPLICATES));
+    mu_assert_int_eq(0, td_set_ingest_flags(t, TD_COLLAPSE_DUPLICATES));
+    mu_assert(td_memory_usage(h) > 16 * 16 + 1024 * sizeof(int), "the table is counted");
+    for (int i = 0; i < 50000; ++i) {
+        mu_assert(td_add(h, i % 500, 1) == 0, "Insertion");
+        mu_assert(td_add(t, i % 500, 1) == 0, "Insertion");
+    }
+    mu_assert_double_eq(td_quantile(t, 0.25), td_quantile(h, 0.25));
+    mu_assert_double_eq(td_cdf(t, 250), td_cdf(h, 250));
+    td_free(h);
+    td_free(t);
+}
+
+MU_TEST(test_td_init_ex) {
+    td_histogram_t *a = NULL, *b = NULL;
+    mu_assert_long_eq(0, td_init_ex(100, 500, &a));
+    mu_assert_long_eq(0, td_init(100, &b));
+    mu_assert_long_eq(610, a->cap); // 100 + 10 + 500, same as the td_init() default
+    mu_assert_long_eq(b->cap, a->cap);
+    td_free(a);
+    td_free(b);
+
+    // invalid parameters leave *result untouched
+    td_histogram_t *sentinel = (td_histogram_t *)&sentinel;
+    a = sentinel;
+    mu_assert_long_eq(1, td_init_ex(100, 0, &a));
+    mu_assert_long_eq(1, td_init_ex(100, -1, &a));
+    mu_assert_long_eq(1, td_init_ex(NAN, 100, &a));
+    mu_assert_long_eq(1, td_init_ex(0, 100, &a));
+    mu_assert_long_eq(1, td_init_ex(100, __INT_MAX__, &a)); // capacity overflows int
+    mu_assert(a == sentinel, "result must be untouched on failure");
+    mu_assert(td_new_ex(100, 0) == NULL, "td_new_ex rejects an empty buffer");
+
+    // A small buffer compresses more often than a large one; accuracy is set by compression.
+    td_histogram_t *small = td_new_ex(100, 16);
+    td_histogram_t *large = td_new_ex(100, 10000);
+    mu_assert(small != NULL && large != NULL, "allocated");
+    mu_assert_long_eq(126, small->cap);
+    for (int i = 1; i <= 100000; ++i) {
+        const double v = (double)((i * 7919) % 100000);
+        mu_assert(td_add(small, v, 1) == 0, "Insertion");
+        mu_assert(td_add(large, v, 1) == 0, "Insertion");
+    }
+    mu_assert(small->total_compressions > 10 * large->total_compressions,
+              "small buffer must compress more often");
+    mu_assert_long_eq(100000, td_size(small));
+    mu_assert_long_eq(100000, td_size(large));
+    mu_assert_double_eq_epsilon(50000, td_quantile(small, 0.5), 1000.0);
+    mu_assert_double_eq_epsilon(50000, td_quantile(large, 0.5), 1000.0);
+    mu_assert_double_eq_epsilon(99000, td_quantile(small, 0.99), 200.0);
+    mu_assert_double_eq_epsilon(99000, td_quantile(large, 0.99), 200.0);
+    td_free(small);
+    td_free(large);
+}
+
+// Compact snapshots store float means and 32-bit weights; results must match the full-width
+// histogram to float precision, and wide values must be promoted rather than saturated.
+MU_TEST(test_compact) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 1; i <= 100000; ++i) {
+        mu_assert(td_add(t, exp((double)((i * 7919) % 100000) / 20000.0), 1) == 0, "Insertion");
+    }
+    td_compact_t *c = NULL;
+    mu_assert_int_eq(0, td_compact(t, &c));
+    mu_assert_long_eq(td_size(t), td_compact_size(c));
+    mu_assert_int_eq(td_centroid_count(t), td_compact_centroid_count(c));
+    // float means and uint32 weights: 8 bytes per centroid plus a small header
+    mu_assert(td_compact_bytes(c) <= (size_t)td_compact_centroid_count(c) * 8 + 128,
+              "compact snapshot uses 8 bytes per centroid");
+    for (int i = 0; i <= 1000; ++i) {
+        const double q = i / 1000.0;
+        const double full = td_quantile(t, q);
+        mu_assert(fabs(td_compact_quantile(c, q) - full) <= 1e-7 * fabs(full),
+                  "quantile within float precision");
+        mu_assert(fabs(td_compact_cdf(c, full) - td_cdf(t, full)) <= 1e-7,
+                  "cdf within float precision");
+    }
+    const double qs[3] = {0.5, 0.9, 0.99};
+    double values[3];
+    mu_assert_int_eq(0, td_compact_quantiles(c, qs, values, 3));
+    mu_assert_double_eq(td_compact_quantile(c, 0.99), values[2]);
+    mu_assert_int_eq(EINVAL, td_compact_quantiles(c, qs, NULL, 3));
+
+    // expanding restores a usable histogram with the same centroids
+    td_histogram_t *e = NULL;
+    mu_assert_int_eq(0, td_expand(c, &e));
+    mu_assert_long_eq(t->cap, e->cap);
+    mu_assert_long_eq(td_size(t), td_size(e));
+    mu_assert_double_eq(td_compact_quantile(c, 0.5), td_quantile(e, 0.5));
+    mu_assert(td_add(e, 1.0, 1) == 0, "Insertion after expand");
+    mu_assert_long_eq(td_size(t) + 1, td_size(e));
+    td_free(e);
+    td_compact_free(c);
+
+    // a weight above UINT32_MAX and a mean beyond FLT_MAX are promoted, not truncated
+    td_reset(t);
+    mu_assert(td_add(t, 1.0, 5000000000LL) == 0, "Insertion");
+    mu_assert(td_add(t, 1e300, 1) == 0, "Insertion");
+    c = NULL;
+    mu_assert_int_eq(0, td_compact(t, &c));
+    mu_assert_long_eq(5000000001LL, td_compact_size(c));
+    mu_assert_double_eq(1e300, td_compact_quantile(c, 1.0));
+    mu_assert_double_eq(td_quantile(t, 0.5), td_compact_quantile(c, 0.5));
+    td_compact_free(c);
+
+    // means below FLT_MIN would lose their precision as floats, or vanish, so they stay wide too
+    td_reset(t);
+    for (int i = 1; i <= 1000; ++i) {
+        mu_assert(td_add(t, i * 1e-50, 1) == 0, "Insertion");
+    }
+    c = NULL;
+    mu_assert_int_eq(0, td_compact(t, &c));
+    mu_assert_double_eq(td_min(t), td_compact_quantile(c, 0.0));
+    mu_assert_double_eq(td_quantile(t, 0.5), td_compact_quantile(c, 0.5));
+    mu_assert_double_eq(td_cdf(t, 5e-48), td_compact_cdf(c, 5e-48));
+    td_compact_free(c);
+
+    // empty histogram
+    td_reset(t);
+    c = NULL;
+    mu_assert_int_eq(0, td_compact(t, &c));
+    mu_assert(isnan(td_compact_quantile(c, 0.5)), "empty snapshot quantile is NaN");
+    mu_assert(isnan(td_compact_cdf(c, 0.5)), "empty snapshot cdf is NaN");
+    td_compact_free(c);
+    td_compact_free(NULL);
+    mu_assert_int_eq(EINVAL, td_compact(NULL, &c));
+    td_free(t);
+}
+
+// TD_COLLAPSE_DUPLICATES folds repeated values into buffered nodes: quantized streams compress far
+// less often, the weight is preserved, and the batch path matches td_add() exactly.
+MU_TEST(test_collapse_duplicates) {
+    td_histogram_t *plain = td_new(100);
+    td_histogram_t *collapsed = td_new(100);
+    td_histogram_t *batched = td_new(100);
+    mu_assert(plain != NULL && collapsed != NULL && batched != NULL, "created_histogram");
+    mu_assert_int_eq(0, td_set_ingest_flags(collapsed, TD_COLLAPSE_DUPLICATES));
+    mu_assert_int_eq(0, td_set_ingest_flags(batched, TD_COLLAPSE_DUPLICATES));
+    mu_assert_int_eq(TD_COLLAPSE_DUPLICATES, td_ingest_flags(collapsed));
+    mu_assert_int_eq(0, td_ingest_flags(plain));
+
+    const size_t n = 100000;
+    double *values = (double *)malloc(n * sizeof(double));
+    mu_assert(values != NULL, "allocated input");
+    for (size_t i = 0; i < n; ++i) {
+        // millisecond-quantized latencies with runs of equal values
+        values[i] = (double)(((i / 4) * 7919) % 200);
+        mu_assert(td_add(plain, values[i], 1) == 0, "Insertion");
+        mu_assert(td_add(collapsed, values[i], 1) == 0, "Insertion");
+    }
+    mu_assert_int_eq(0, td_add_batch_unweighted(batched, values, n, NULL));
+    mu_assert(collapsed->total_compressions * 20 < plain->total_compressions,
+              "collapsing must make compressions much rarer");
+    mu_assert_long_eq(td_size(plain), td_size(collapsed));
+    mu_assert_long_eq(collapsed->total_compressions, batched->total_compressions);
+    mu_assert_int_eq(td_centroid_count(collapsed), td_centroid_count(batched));
+    for (int i = 0; i < td_centroid_count(collapsed); ++i) {
+        mu_assert_double_eq(collapsed->nodes_mean[i], batched->nodes_mean[i]);
+        mu_assert_long_eq(collapsed->nodes_weight[i], batched->nodes_weight[i]);
+    }
+    mu_assert_double_eq(0.0, td_min(collapsed));
+    mu_assert_double_eq(199.0, td_max(collapsed));
+    mu_assert_double_eq_epsilon(td_quantile(plain, 0.5), td_quantile(collapsed, 0.5), 2.0);
+    mu_assert_double_eq_epsilon(td_quantile(plain, 0.99), td_quantile(collapsed, 0.99), 2.0);
+
+    // the flags survive a reset, and weighted duplicates accumulate
+    td_reset(collapsed);
+    mu_assert_int_eq(TD_COLLAPSE_DUPLICATES, td_ingest_flags(collapsed));
+    mu_assert(td_add(collapsed, 5.0, 3) == 0, "Insertion");
+    mu_assert(td_add(collapsed, 7.0, 1) == 0, "Insertion");
+    mu_assert(td_add(collapsed, 5.0, 2) == 0, "Insertion");
+    mu_assert_int_eq(2, td_centroid_count(collapsed));
+    mu_assert_long_eq(6, td_size(collapsed));
+    mu_assert_int_eq(0, td_set_ingest_flags(collapsed, 0));
+    mu_assert(td_add(collapsed, 5.0, 1) == 0, "Insertion");
+    mu_assert_int_eq(3, td_centroid_count(collapsed));
+
+    // a compression at weight 1 merges the buffered sample; an equal one added after it is
+    // buffered on its own rather than folded into the merged centroid
+    td_reset(plain);
+    td_reset(collapsed);
+    mu_assert_int_eq(0, td_set_ingest_flags(collapsed, TD_COLLAPSE_DUPLICATES));
+    const double sequence[] = {5.0, 5.0, 7.0};
+    for (int i = 0; i < 3; i++) {
+        mu_assert(td_add(plain, sequence[i], 1) == 0, "Insertion");
+        mu_assert(td_add(collapsed, sequence[i], 1) == 0, "Insertion");
+        if (i == 0) {
+            mu_assert_int_eq(0, td_compress(plain));
+            mu_assert_int_eq(0, td_compress(collapsed));
+        }
+    }
+    mu_assert_long_eq(1, collapsed->merged_weight);
+    mu_assert_double_eq(td_cdf(plain, 6.0), td_cdf(collapsed, 6.0));
+    mu_assert_int_eq(0, td_compress(collapsed));
+    mu_assert_long_eq(3, collapsed->merged_weight);
+    mu_assert_long_eq(0, collapsed->unmerged_weight);
+    free(values);
+    td_free(plain);
+    td_free(collapsed);
+    td_free(batched);
+}
+
+// Exact cdf and quantile of weighted samples, by brute force.
+static double exact_cdf(const double *values, const long long *weights, int n, double x) {
+    double below = 0, at = 0, total = 0;
+    for (int i = 0; i < n; i++) {
+        total += (double)weights[i];
+        if (values[i] < x) {
+            below += (double)weights[i];
+        } else if (values[i] == x) {
+            at += (double)weights[i];
+        }
+    }
+    return (below + at / 2) / total;
+}
+
+static double exact_quantile(const double *sorted, const long long *weights, int n, double q) {
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        total += (double)weights[i];
+    }
+    double so_far = 0;
+    for (int i = 0; i < n; i++) {
+        so_far += (double)weights[i];
+        if (so_far > q * total) {
+            return sorted[i];
+        }
+    }
+    return sorted[n - 1];
+}
+
+MU_TEST(test_exact_phase) {
+    td_histogram_t *h = td_new(100);
+    mu_assert(h != NULL, "created_histogram");
+    mu_assert(!td_is_exact(h), "off by default");
+    mu_assert_int_eq(EINVAL, td_set_exact_threshold(h, -1));
+    mu_assert_int_eq(EINVAL, td_set_exact_threshold(h, 305)); // (cap - 1) / 2 = 304
+    mu_assert_int_eq(0, td_set_exact_threshold(h, 300));
+    mu_assert(td_is_exact(h), "exact while empty");
+
+    // 200 weighted samples on 150 distinct values, sorted by value for the reference
+    double values[200];
+    long long weights[200];
+    for (int i = 0; i < 200; i++) {
+        values[i] = (double)((i * 37) % 150) * 1.25 - 40;
+        weights[i] = 1 + i % 4;
+    }
+    for (int i = 0; i < 200; i++) {
+        mu_assert(td_add(h, values[i], weights[i]) == 0, "Insertion");
+    }
+    // const queries on the buffered samples, then the compressed ones
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i <= 100; i++) {
+            const double x = -45 + i * 2.0;
+            const double cdf = pass == 0 ? td_cdf_const(h, x) : td_cdf(h, x);
+            mu_assert_double_eq(exact_cdf(values, weights, 200, x), cdf);
+        }
+    }
+    mu_assert(td_is_exact(h), "below the threshold");
+    mu_assert_int_eq(150, h->merged_nodes);
+    // the reference quantile wants the samples in order, weights along
+    for (int i = 1; i < 200; i++) {
+        for (int j = i; j > 0 && values[j - 1] > values[j]; j--) {
+            const double v = values[j];
+            const long long w = weights[j];
+            values[j] = values[j - 1];
+            weights[j] = weights[j - 1];
+            values[j - 1] = v;
+            weights[j - 1] = w;
+        }
+    }
+    double qs[101];
+    double out[101];
+    for (int i = 0; i <= 100; i++) {
+        qs[i] = i / 100.0;
+        mu_assert_double_eq(exact_quantile(values, weights, 200, qs[i]), td_quantile(h, qs[i]));
+    }
+    mu_assert_int_eq(0, td_quantiles(h, qs, out, 101));
+    for (int i = 0; i <= 100; i++) {
+        mu_assert_double_eq(exact_quantile(values, weights, 200, qs[i]), out[i]);
+    }
+    mu_assert(isnan(td_quantile(h, 1.5)), "q out of range");
+
+    // merging raw samples keeps the phase
+    td_histogram_t *other = td_new(100);
+    mu_assert(other != NULL, "created_histogram");
+    mu_assert_int_eq(0, td_set_exact_threshold(other, 300));
+    mu_assert(td_add(other, 1000, 1) == 0, "Insertion");
+    mu_assert_int_eq(0, td_merge(h, other));
+    mu_assert(td_is_exact(h), "merged samples");
+    mu_assert_double_eq(1000, td_quantile(h, 1));
+    mu_assert_double_eq(values[199], td_quantile(h, 499.0 / 501));
+
+    // a regular t-digest ends it, and so does crossing the threshold
+    td_histogram_t *sketch = td_new(100);
+    mu_assert(sketch != NULL, "created_histogram");
+    mu_assert(td_add(sketch, 5, 3) == 0, "Insertion");
+    mu_assert_int_eq(EINVAL, td_set_exact_threshold(sketch, 10));
+    mu_assert_int_eq(0, td_merge(other, sketch));
+    mu_assert(!td_is_exact(other), "merged centroids");
+    td_reset(h);
+    mu_assert(td_is_exact(h), "td_reset() returns to the exact phase");
+    for (int i = 0; i < 10000; i++) {
+        mu_assert(td_add(h, i, 1) == 0, "Insertion");
+        mu_assert(td_add(sketch, i, 1) == 0, "Insertion");
+    }
+    mu_assert_double_eq_epsilon(td_quantile_const(h, 0.5), td_quantile(h, 0.5), 1e-9);
+    mu_assert(!td_is_exact(h), "past the threshold");
+    mu_assert(h->merged_nodes < 300, "folded into centroids");
+    mu_assert_double_eq_epsilon(5000, td_quantile(h, 0.5), 50.0);
+    td_free(h);
+    td_free(other);
+    td_free(sketch);
+}
+
+#define SHARDED_THREADS 4
+#define SHARDED_SAMPLES 100000
+
+struct sharded_writer {
+    td_sharded_t *sharded;
+    int index;
+    int res;
+};
+
+static void *sharded_writer_run(void *arg) {
+    struct sharded_writer *w = (struct sharded_writer *)arg;
+    td_shard_t *shard = td_sharded_shard(w->sharded, w->index);
+    w->res = 0;
+    for (int i = 0; i < SHARDED_SAMPLES && w->res == 0; ++i) {
+        w->res = td_shard_add(shard, (double)(i * SHARDED_THREADS + w->index), 1);
+    }
+    if (w->res == 0) {
+        w->res = td_shard_flush(shard);
+    }
+    return NULL;
+}
+
+// Writers each own a shard; a reader snapshots concurrently, and after the writers flush the
+// snapshot holds every sample.
+MU_TEST(test_sharded) {
+    mu_assert(td_sharded_new(100, 0) == NULL, "zero shards are rejected");
+    mu_assert(td_sharded_new(NAN, 2) == NULL, "invalid compression is rejected");
+    td_sharded_t *sharded = td_sharded_new(100, SHARDED_THREADS);
+    mu_assert(sharded != NULL, "created sharded digest");
+    mu_assert_int_eq(SHARDED_THREADS, td_sharded_shard_count(sharded));
+    mu_assert(td_sharded_shard(sharded, SHARDED_THREADS) == NULL, "shard index out of range");
+    mu_assert_int_eq(EINVAL, td_shard_add(td_sharded_shard(sharded, 0), NAN, 1));
+
+    pthread_t threads[SHARDED_THREADS];
+    struct sharded_writer writers[SHARDED_THREADS];
+    for (int i = 0; i < SHARDED_THREADS; ++i) {
+        writers[i].sharded = sharded;
+        writers[i].index = i;
+        mu_assert_int_eq(0, pthread_create(&threads[i], NULL, sharded_writer_run, &writers[i]));
+    }
+    // concurrent readers see a consistent, partial digest
+    for (int r = 0; r < 10; ++r) {
+        td_histogram_t *partial = NULL;
+        mu_assert_int_eq(0, td_sharded_snapshot(sharded, &partial));
+        mu_assert(td_size(partial) <= (long long)SHARDED_THREADS * SHARDED_SAMPLES,
+                  "partial snapshot");
+        td_free(partial);
+    }
+    for (int i = 0; i < SHARDED_THREADS; ++i) {
+        mu_assert_int_eq(0, pthread_join(threads[i], NULL));
+        mu_assert_int_eq(0, writers[i].res);
+    }
+
+    td_histogram_t *all = NULL;
+    mu_assert_int_eq(0, td_sharded_snapshot(sharded, &all));
+    const double n = (double)SHARDED_THREADS * SHARDED_SAMPLES;
+    mu_assert_long_eq((long long)n, td_size(all));
+    mu_assert_double_eq(0, td_min(all));
+    mu_assert_double_eq(n - 1, td_max(all));
+    mu_assert_double_eq_epsilon(n / 2, td_quantile(all, 0.5), n * 0.01);
+    mu_assert_double_eq_epsilon(n * 0.99, td_quantile(all, 0.99), n * 0.001);
+
+    // merging into an existing histogram adds to it
+    td_histogram_t *into = td_new(100);
+    mu_assert(td_add(into, -1.0, 1) == 0, "Insertion");
+    mu_assert_int_eq(0, td_sharded_merge_into(sharded, into));
+    mu_assert_long_eq((long long)n + 1, td_size(into));
+    mu_assert_double_eq(-1.0, td_min(into));
+    td_free(into);
+    td_free(all);
+    td_sharded_free(sharded);
+    td_sharded_free(NULL);
+}
+
+#define STORE_DIGESTS 100
+
+MU_TEST(test_store) {
+    char path[] = "td_store_test_XXXXXX";
+    const int fd = mkstemp(path);
+    mu_assert(fd >= 0, "created temporary file");
+    close(fd);
+
+    char names[STORE_DIGESTS][32];
+    const char *keys[STORE_DIGESTS];
+    td_histogram_t *digests[STORE_DIGESTS];
+    for (int i = 0; i < STORE_DIGESTS; i++) {
+        snprintf(names[i], sizeof(names[i]), "endpoint:%d", i);
+        keys[i] = names[i];
+        digests[i] = td_new(100);
+        mu_assert(digests[i] != NULL, "created_histogram");
+        for (int j = 0; j <= i * 10; j++) {
+            mu_assert(td_add(digests[i], i + j * 0.5, 1 + j % 3) == 0, "Insertion");
+        }
+    }
+    mu_assert_int_eq(0, td_store_write(path, keys, NULL, digests, STORE_DIGESTS));
+
+    td_store_t *store = NULL;
+    mu_assert_int_eq(0, td_store_open(path, &store));
+    mu_assert_int_eq(STORE_DIGESTS, (int)td_store_count(store));
+    for (int i = 0; i < STORE_DIGESTS; i++) {
+        size_t index = 0;
+        mu_assert_int_eq(0, td_store_find(store, keys[i], strlen(keys[i]), &index));
+        const char *key;
+        size_t key_len;
+        mu_assert_int_eq(0, td_store_key(store, index, &key, &key_len));
+        mu_assert(key_len == strlen(keys[i]) && memcmp(key, keys[i], key_len) == 0, "same key");
+        td_view_t v;
+        mu_assert_int_eq(0, td_store_view(store, index, &v));
+        mu_assert_long_eq(td_size(digests[i]), td_view_size(&v));
+        mu_assert_double_eq(td_quantile(digests[i], 0.9), td_store_quantile(store, index, 0.9));
+        mu_assert_double_eq(td_cdf(digests[i], i + 3.0), td_store_cdf(store, index, i + 3.0));
+    }
+    size_t index = 0;
+    mu_assert_int_eq(ENOENT, td_store_find(store, "endpoint:100", 12, &index));
+    mu_assert_int_eq(ENOENT, td_store_find(store, "endpoint:1", 9, &index));
+    mu_assert_int_eq(EINVAL, td_store_view(store, STORE_DIGESTS, &(td_view_t){0}));
+    mu_assert(isnan(td_store_quantile(store, STORE_DIGESTS, 0.5)), "out of range quantile");
+
+    // the first write copies the digest out of the file, and queries see it from then on
+    mu_assert_int_eq(0, td_store_find(store, "endpoint:7", 10, &index));
+    td_histogram_t *h = NULL;
+    mu_assert_int_eq(0, td_store_histogram(store, index, &h));
+    td_histogram_t *again = NULL;
+    mu_assert_int_eq(0, td_store_histogram(store, index, &again));
+    mu_assert(h == again, "the same histogram is returned");
+    mu_assert(td_add(h, 1000, 70) == 0, "Insertion");
+    mu_assert_double_eq(1000, td_store_quantile(store, index, 1));
+    td_view_t stored;
+    mu_assert_int_eq(0, td_store_view(store, index, &stored));
+    mu_assert_double_eq(td_max(digests[7]), stored.max);
+
+    // saving over the open store's own file leaves the open store readable
+    mu_assert_int_eq(0, td_store_save(store, path));
+    mu_assert_double_eq(td_quantile(digests[8], 0.5), td_store_quantile(store, index + 1, 0.5));
+    td_store_t *saved = NULL;
+    mu_assert_int_eq(0, td_store_open(path, &saved));
+    mu_assert_int_eq(0, td_store_find(saved, "endpoint:7", 10, &index));
+    mu_assert_double_eq(1000, td_store_quantile(saved, index, 1));
+    td_view_t v;
+    mu_assert_int_eq(0, td_store_view(saved, index, &v));
+    mu_assert_long_eq(td_size(digests[7]) + 70, td_view_size(&v));
+    mu_assert_int_eq(0, td_store_find(saved, "endpoint:42", 11, &index));
+    mu_assert_double_eq(td_quantile(digests[42], 0.25), td_store_quantile(saved, index, 0.25));
+    td_store_close(saved);
+    td_store_close(store);
+
+    // binary keys, including an empty one, and a repeated key
+    const char *binary_keys[3] = {"a\0b", "a\0c", ""};
+    const size_t binary_lens[3] = {3, 3, 0};
+    mu_assert_int_eq(0, td_store_write(path, binary_keys, binary_lens, digests, 3));
+    mu_assert_int_eq(0, td_store_open(path, &store));
+    mu_assert_int_eq(0, td_store_find(store, "a\0c", 3, &index));
+    mu_assert_int_eq(1, (int)index);
+    mu_assert_int_eq(0, td_store_find(store, NULL, 0, &index));
+    mu_assert_int_eq(2, (int)index);
+    mu_assert_int_eq(ENOENT, td_store_find(store, "a", 1, &index));
+    td_store_close(store);
+    const char *repeated[2] = {"same", "same"};
+    mu_assert_int_eq(EINVAL, td_store_write(path, repeated, NULL, digests, 2));
+
+    // an empty store
+    mu_assert_int_eq(0, td_store_write(path, NULL, NULL, NULL, 0));
+    mu_assert_int_eq(0, td_store_open(path, &store));
+    mu_assert_int_eq(0, (int)td_store_count(store));
+    mu_assert_int_eq(ENOENT, td_store_find(store, "x", 1, &index));
+    td_store_close(store);
+
+    // files that are not stores
+    FILE *f = fopen(path, "wb");
+    mu_assert(f != NULL, "opened file");
+    for (int i = 0; i < 100; i++) {
+        fputc(i, f);
+    }
+    fclose(f);
+    store = NULL;
+    mu_assert_int_eq(EINVAL, td_store_open(path, &store));
+    mu_assert(store == NULL, "result untouched on failure");
+    remove(path);
+    mu_assert_int_eq(ENOENT, td_store_open(path, &store));
+    mu_assert_int_eq(EINVAL, td_store_open(NULL, &store));
+
+    for (int i = 0; i < STORE_DIGESTS; i++) {
+        td_free(digests[i]);
+    }
+}
+
+MU_TEST(test_window) {
+    td_window_t *w = NULL;
+    mu_assert_int_eq(1, td_window_init(100, 0, 10, &w));
+    mu_assert_int_eq(1, td_window_init(100, 4, 0, &w));
+    mu_assert_int_eq(1, td_window_init(0, 4, 10, &w));
+    mu_assert(w == NULL, "result untouched on failure");
+    // four intervals of width 10: [0, 10), [10, 20), ...
+    mu_assert_int_eq(0, td_window_init(100, 4, 10, &w));
+    mu_assert(isnan(td_window_quantile(w, 0.5)), "empty window");
+    for (int ts = 0; ts < 40; ts++) {
+        mu_assert_int_eq(0, td_window_add(w, ts, ts));
+    }
+    mu_assert_long_eq(40, td_window_size(w));
+    mu_assert_double_eq(0, td_window_quantile(w, 0));
+    mu_assert_double_eq(39, td_window_quantile(w, 1));
+    mu_assert_double_eq_epsilon(20, td_window_quantile(w, 0.5), 1.0);
+    // repeated queries reuse the cached merges
+    mu_assert_double_eq_epsilon(20, td_window_quantile(w, 0.5), 1.0);
+
+    // the first interval falls out of the window
+    td_window_advance(w, 45);
+    mu_assert_long_eq(30, td_window_size(w));
+    mu_assert_double_eq(10, td_window_quantile(w, 0));
+    mu_assert_double_eq(39, td_window_quantile(w, 1));
+    // earlier timestamps leave it where it is
+    td_window_advance(w, 12);
+    mu_assert_long_eq(30, td_window_size(w));
+
+    // late samples land in their closed interval, too old ones are rejected
+    mu_assert_int_eq(0, td_window_add(w, 15, 1000));
+    mu_assert_double_eq(1000, td_window_quantile(w, 1));
+    mu_assert_int_eq(ERANGE, td_window_add(w, 9, 1));
+    mu_assert_int_eq(EINVAL, td_window_add(w, 46, NAN));
+    mu_assert_int_eq(0, td_window_add(w, 46, -5));
+    mu_assert_double_eq(-5, td_window_quantile(w, 0));
+    mu_assert_long_eq(32, td_window_size(w));
+    mu_assert_double_eq_epsilon(0.5, td_window_cdf(w, 25), 0.05);
+
+    // a gap of a whole window recycles every interval
+    td_window_advance(w, 1000);
+    mu_assert_long_eq(0, td_window_size(w));
+    mu_assert(isnan(td_window_quantile(w, 0.5)), "empty window");
+    mu_assert_int_eq(ERANGE, td_window_add(w, 46, 1));
+    td_window_free(w);
+
+    // negative timestamps round down to their interval; matches a digest of the live samples
+    w = td_window_new(100, 3, 1000);
+    mu_assert(w != NULL, "created window");
+    td_histogram_t *live = td_new(100);
+    mu_assert(live != NULL, "created_histogram");
+    for (long long ts = -5000; ts < 5000; ts++) {
+        const double v = (double)((ts * 7919 + 1000000) % 1000);
+        mu_assert_int_eq(0, td_window_add(w, ts, v));
+        if (ts >= 2000) {
+            mu_assert(td_add(live, v, 1) == 0, "Insertion");
+        }
+        if (ts == -1) {
+            // [-3000, 0)
+            mu_assert_long_eq(3000, td_window_size(w));
+        }
+    }
+    mu_assert_long_eq(3000, td_window_size(w));
+    for (int i = 1; i < 10; i++) {
+        mu_assert_double_eq_epsilon(td_quantile(live, i / 10.0), td_window_quantile(w, i / 10.0),
+                                    5.0);
+    }
+    td_free(live);
+    td_window_free(w);
+    td_window_free(NULL);
+}
+
+// Rank of x among samples of the given fractional weights, equal ones counting half.
+static double weighted_rank(const double *values, const double *weights, int n, double x) {
+    double below = 0;
+    double total = 0;
+    for (int i = 0; i < n; i++) {
+        if (values[i] < x) {
+            below += weights[i];
+        } else if (values[i] == x) {
+            below += weights[i] / 2;
+        }
+        total += weights[i];
+    }
+    return below / total;
+}
+
+MU_TEST(test_decay) {
+    td_decay_t *d = NULL;
+    mu_assert_int_eq(1, td_decay_init(0, 0.1, 0, &d));
+    mu_assert_int_eq(1, td_decay_init(100, -0.1, 0, &d));
+    mu_assert_int_eq(1, td_decay_init(100, NAN, 0, &d));
+    mu_assert_int_eq(1, td_decay_init(100, 0.1, INFINITY, &d));
+    mu_assert(d == NULL, "result untouched on failure");
+
+    // without decay, fractional weights work like integer ones
+    mu_assert_int_eq(0, td_decay_init(100, 0, 0, &d));
+    mu_assert(isnan(td_decay_quantile(d, 0.5)), "empty digest");
+    mu_assert(isnan(td_decay_cdf(d, 0)), "empty digest");
+    for (int i = 1; i <= 1000; i++) {
+        mu_assert_int_eq(0, td_decay_add(d, i, i, 0.5));
+    }
+    mu_assert_double_eq(500, td_decay_size(d, 1000));
+    mu_assert_double_eq(1, td_decay_quantile(d, 0));
+    mu_assert_double_eq(1000, td_decay_quantile(d, 1));
+    mu_assert_double_eq_epsilon(500, td_decay_quantile(d, 0.5), 2.0);
+    mu_assert_double_eq_epsilon(990, td_decay_quantile(d, 0.99), 1.0);
+    mu_assert_double_eq_epsilon(0.25, td_decay_cdf(d, 250), 0.005);
+    mu_assert_double_eq(0, td_decay_cdf(d, 0));
+    mu_assert_double_eq(1, td_decay_cdf(d, 1001));
+    mu_assert(isnan(td_decay_quantile(d, 1.5)), "q out of range");
+    mu_assert(td_decay_centroid_count(d) < 6 * 100 + 10, "bounded by the capacity");
+    mu_assert_int_eq(EINVAL, td_decay_add(d, 1, NAN, 1));
+    mu_assert_int_eq(EINVAL, td_decay_add(d, INFINITY, 1, 1));
+    mu_assert_int_eq(EINVAL, td_decay_add(d, 1, 1, 0));
+    mu_assert_int_eq(EINVAL, td_decay_add(d, 1, 1, TD_DECAY_MIN_WEIGHT / 2));
+    td_decay_free(d);
+
+    // half-life of 10: the old regime fades out, and growing weights move the landmark
+    const double rate = log(2) / 10;
+    d = td_decay_new(100, rate, 0);
+    mu_assert(d != NULL, "created digest");
+    for (int t = 0; t < 1000; t++) {
+        const double v = (double)((t * 7919) % 100);
+        mu_assert_int_eq(0, td_decay_add(d, t, t < 500 ? v : 1000 + v, 1));
+    }
+    mu_assert(td_decay_landmark(d) > 0, "landmark moved");
+    // sum of 2^(-k/10) over the 500 samples of the new regime
+    mu_assert_double_eq_epsilon(1 / (1 - pow(2, -0.1)), td_decay_size(d, 999), 0.01);
+    mu_assert(td_decay_quantile(d, 0.01) >= 1000, "old regime decayed away");
+    // its extremes went with it
+    mu_assert(td_decay_quantile(d, 0) >= 1000, "min recomputed from the kept centroids");
+    mu_assert_double_eq(0, td_decay_cdf(d, 999));
+    mu_assert_double_eq_epsilon(0.5, td_decay_size(d, 1009) / td_decay_size(d, 999), 1e-9);
+    // a sample that is too old to weigh anything
+    mu_assert_int_eq(ERANGE, td_decay_add(d, -10000, 1, 1));
+    td_decay_free(d);
+
+    // the decayed quantiles of a drifting stream match the exactly weighted ones
+    const int n = 20000;
+    double *values = (double *)malloc(n * sizeof(double));
+    double *weights = (double *)malloc(n * sizeof(double));
+    mu_assert(values && weights, "allocated samples");
+    d = td_decay_new(100, 0.001, 0);
+    mu_assert(d != NULL, "created digest");
+    for (int t = 0; t < n; t++) {
+        values[t] = (double)((t * 7919) % 1000) + t / 10.0;
+        weights[t] = exp(0.001 * (t - (n - 1)));
+        mu_assert_int_eq(0, td_decay_add(d, t, values[t], 1));
+    }
+    mu_assert(td_decay_centroid_count(d) < 6 * 100 + 10, "constant memory");
+    const double qs[] = {0.01, 0.1, 0.5, 0.9, 0.99, 0.999};
+    for (size_t i = 0; i < sizeof(qs) / sizeof(qs[0]); i++) {
+        const double x = td_decay_quantile(d, qs[i]);
+        mu_assert_double_eq_epsilon(qs[i], weighted_rank(values, weights, n, x), 0.005);
+        mu_assert_double_eq_epsilon(qs[i], td_decay_cdf(d, x), 1e-9);
+    }
+    free(values);
+    free(weights);
+    td_decay_free(d);
+    td_decay_free(NULL);
+}
+
+static int compare_values(const void *a, const void *b) {
+    const double x = *(const double *)a;
+    const double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+MU_TEST(test_build_from_samples) {
+    const size_t n = 1000000;
+    double *values = (double *)malloc(n * sizeof(double));
+    double *sorted = (double *)malloc(n * sizeof(double));
+    mu_assert(values && sorted, "allocated");
+    td_histogram_t *streamed = td_new(100);
+    mu_assert(streamed != NULL, "created_histogram");
+    for (size_t i = 0; i < n; i++) {
+        values[i] = exp(randfrom(-3, 3)) * randfrom(0, 1);
+        sorted[i] = values[i];
+        mu_assert(td_add(streamed, values[i], 1) == 0, "Insertion");
+    }
+    qsort(sorted, n, sizeof(double), compare_values);
+
+    td_histogram_t *built = NULL;
+    mu_assert_int_eq(0, td_build_from_samples(values, n, 100, 4, &built));
+    mu_assert_long_eq(td_size(streamed), td_size(built));
+    mu_assert_double_eq(td_min(streamed), td_min(built));
+    mu_assert_double_eq(td_max(streamed), td_max(built));
+    const double qs[] = {0.0001, 0.001, 0.01, 0.1, 0.5, 0.9, 0.99, 0.999, 0.9999};
+    double streamed_error = 0;
+    double built_error = 0;
+    for (int i = 0; i < 9; i++) {
+        const double q = qs[i];
+        const double truth = sorted[(size_t)(q * n)];
+        streamed_error += fabs(td_cdf(streamed, truth) - q);
+        built_error += fabs(td_cdf(built, truth) - q);
+    }
+    // single quantiles are noisy either way; overall the build is about as accurate as streaming
+    mu_assert(built_error <= 2 * streamed_error, "accuracy equivalent to streaming");
+    td_free(built);
+
+    // small arrays run on the calling thread alone
+    mu_assert_int_eq(0, td_build_from_samples(values, 1000, 100, 8, &built));
+    mu_assert_long_eq(1000, td_size(built));
+    td_free(built);
+    mu_assert_int_eq(0, td_build_from_samples(NULL, 0, 100, 2, &built));
+    mu_assert_long_eq(0, td_size(built));
+    td_free(built);
+
+    built = streamed;
+    values[n / 2] = NAN;
+    mu_assert_int_eq(EINVAL, td_build_from_samples(values, n, 100, 4, &built));
+    values[n / 2] = 1;
+    mu_assert_int_eq(EINVAL, td_build_from_samples(values, n, 100, 0, &built));
+    mu_assert_int_eq(EINVAL, td_build_from_samples(values, n, 0, 4, &built));
+    // beyond the largest compression td_init() accepts: invalid input, not a lack of memory
+    mu_assert_int_eq(EINVAL, td_build_from_samples(values, n, 1e9, 4, &built));
+    mu_assert_int_eq(EINVAL, td_build_from_samples(values, n, NAN, 4, &built));
+    mu_assert_int_eq(EINVAL, td_build_from_samples(NULL, n, 100, 4, &built));
+    mu_assert_int_eq(EINVAL, td_build_from_samples(values, n, 100, 4, NULL));
+    mu_assert(built == streamed, "result untouched on failure");
+    td_free(streamed);
+    free(values);
+    free(sorted);
+}
+
+struct const_reader {
+    const td_histogram_t *h;
+    double expected_p99;
+    int mismatches;
+};
+
+static void *const_reader_run(void *arg) {
+    struct const_reader *r = (struct const_reader *)arg;
+    r->mismatches = 0;
+    for (int i = 0; i < 200; ++i) {
+        r->mismatches += td_quantile_const(r->h, 0.99) != r->expected_p99;
+    }
+    return NULL;
+}
+
+// The const queries must leave the histogram untouched, buffered samples included, and agree
+// exactly with the mutating queries.
+MU_TEST(test_const_queries) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 0; i < 2000; ++i) {
+        mu_assert(td_add(t, (double)((i * 7919) % 2000), 1) == 0, "Insertion");
+    }
+    mu_assert(t->unmerged_nodes > 0, "samples are buffered");
+    const int nodes = td_centroid_count(t);
+    const int merged = t->merged_nodes;
+    double *mean_before = (double *)malloc(t->cap * sizeof(double));
+    long long *weight_before = (long long *)malloc(t->cap * sizeof(long long));
+    mu_assert(mean_before != NULL && weight_before != NULL, "allocated");
+    memcpy(mean_before, t->nodes_mean, t->cap * sizeof(double));
+    memcpy(weight_before, t->nodes_weight, t->cap * sizeof(long long));
+
+    const double qs[4] = {0.1, 0.5, 0.9, 0.99};
+    double const_values[4];
+    double values[4];
+    const double cdf = td_cdf_const(t, 1000.0);
+    const double p50 = td_quantile_const(t, 0.5);
+    mu_assert_int_eq(0, td_quantiles_const(t, qs, const_values, 4));
+    const double trimmed = td_trimmed_mean_const(t, 0.1, 0.9);
+    const double trimmed_symmetric = td_trimmed_mean_symmetric_const(t, 0.1);
+    mu_assert_int_eq(EINVAL, td_quantiles_const(t, qs, NULL, 4));
+
+    mu_assert_int_eq(nodes, td_centroid_count(t));
+    mu_assert_int_eq(merged, t->merged_nodes);
+    mu_assert(memcmp(mean_before, t->nodes_mean, t->cap * sizeof(double)) == 0,
+              "means untouched");
+    mu_assert(memcmp(weight_before, t->nodes_weight, t->cap * sizeof(long long)) == 0,
+              "weights untouched");
+
+    mu_assert_double_eq(td_cdf(t, 1000.0), cdf);
+    mu_assert_double_eq(td_quantile(t, 0.5), p50);
+    mu_assert_int_eq(0, td_quantiles(t, qs, values, 4));
+    for (int i = 0; i < 4; ++i) {
+        mu_assert_double_eq(values[i], const_values[i]);
+    }
+    mu_assert_double_eq(td_trimmed_mean(t, 0.1, 0.9), trimmed);
+    mu_assert_double_eq(td_trimmed_mean_symmetric(t, 0.1), trimmed_symmetric);
+    // fully merged: answered in place
+    mu_assert_double_eq(td_quantile(t, 0.9), td_quantile_const(t, 0.9));
+
+    // several readers poll the same digest concurrently
+    for (int i = 0; i < 100; ++i) {
+        mu_assert(td_add(t, (double)i, 1) == 0, "Insertion");
+    }
+    struct const_reader readers[4];
+    pthread_t threads[4];
+    const double expected_p99 = td_quantile_const(t, 0.99);
+    for (int i = 0; i < 4; ++i) {
+        readers[i].h = t;
+        readers[i].expected_p99 = expected_p99;
+        mu_assert_int_eq(0, pthread_create(&threads[i], NULL, const_reader_run, &readers[i]));
+    }
+    for (int i = 0; i < 4; ++i) {
+        mu_assert_int_eq(0, pthread_join(threads[i], NULL));
+        mu_assert_int_eq(0, readers[i].mismatches);
+    }
+
+    // a small buffer makes td_compress() sort the whole range instead of merging the prefix
+    // linearly; with tied means the view has to take the same path to build the same centroids
+    td_histogram_t *small = td_new_ex(8, 4);
+    mu_assert(small != NULL, "created_histogram");
+    for (int i = 0; i < 500; ++i) {
+        mu_assert(td_add(small, (double)((i * 7919) % 5), 1 + i % 3) == 0, "Insertion");
+        if (i % 7 == 0 && small->unmerged_nodes > 0) {
+            const double p99 = td_quantile_const(small, 0.99);
+            const double cdf2 = td_cdf_const(small, 2.5);
+            mu_assert_double_eq(td_quantile(small, 0.99), p99);
+            mu_assert_double_eq(td_cdf(small, 2.5), cdf2);
+        }
+    }
+    td_free(small);
+
+    // empty histogram
+    td_reset(t);
+    mu_assert(isnan(td_quantile_const(t, 0.5)), "empty quantile is NaN");
+    mu_assert(isnan(td_cdf_const(t, 0.5)), "empty cdf is NaN");
+    free(mean_before);
+    free(weight_before);
+    td_free(t);
+}
+
+// td_merge_const must give exactly what td_merge gives, without touching the source.
+MU_TEST(test_merge_const) {
+    td_histogram_t *from = td_new(100);
+    td_histogram_t *from_copy = td_new(100);
+    td_histogram_t *into = td_new(100);
+    td_histogram_t *into_copy = td_new(100);
+    mu_assert(from && from_copy && into && into_copy, "created_histogram");
+    for (int i = 0; i < 3000; ++i) {
+        const double v = (double)((i * 7919) % 3001);
+        mu_assert(td_add(from, v, 1) == 0, "Insertion");
+        mu_assert(td_add(from_copy, v, 1) == 0, "Insertion");
+        mu_assert(td_add(into, -v, 1) == 0, "Insertion");
+        mu_assert(td_add(into_copy, -v, 1) == 0, "Insertion");
+    }
+    mu_assert(from->unmerged_nodes > 0, "samples are buffered");
+    const int merged = from->merged_nodes;
+    const int unmerged = from->unmerged_nodes;
+    double *mean_before = (double *)malloc(from->cap * sizeof(double));
+    long long *weight_before = (long long *)malloc(from->cap * sizeof(long long));
+    mu_assert(mean_before != NULL && weight_before != NULL, "allocated");
+    memcpy(mean_before, from->nodes_mean, from->cap * sizeof(double));
+    memcpy(weight_before, from->nodes_weight, from->cap * sizeof(long long));
+
+    mu_assert_int_eq(0, td_merge_const(into, from));
+    mu_assert_int_eq(merged, from->merged_nodes);
+    mu_assert_int_eq(unmerged, from->unmerged_nodes);
+    mu_assert(memcmp(mean_before, from->nodes_mean, from->cap * sizeof(double)) == 0,
+              "means untouched");
+    mu_assert(memcmp(weight_before, from->nodes_weight, from->cap * sizeof(long long)) == 0,
+              "weights untouched");
+
+    mu_assert_int_eq(0, td_merge(into_copy, from_copy));
+    mu_assert_long_eq(td_size(into_copy), td_size(into));
+    mu_assert_int_eq(td_centroid_count(into_copy), td_centroid_count(into));
+    for (int i = 0; i < into->merged_nodes; ++i) {
+        mu_assert_double_eq(into_copy->nodes_mean[i], into->nodes_mean[i]);
+        mu_assert_long_eq(into_copy->nodes_weight[i], into->nodes_weight[i]);
+    }
+    mu_assert_double_eq(td_min(into_copy), td_min(into));
+    mu_assert_double_eq(td_max(into_copy), td_max(into));
+
+    // readers of the source keep going while it is merged from
+    struct const_reader readers[2];
+    pthread_t threads[2];
+    const double expected_p99 = td_quantile_const(from, 0.99);
+    for (int i = 0; i < 2; ++i) {
+        readers[i].h = from;
+        readers[i].expected_p99 = expected_p99;
+        mu_assert_int_eq(0, pthread_create(&threads[i], NULL, const_reader_run, &readers[i]));
+    }
+    for (int i = 0; i < 20; ++i) {
+        mu_assert_int_eq(0, td_merge_const(into, from));
+    }
+    for (int i = 0; i < 2; ++i) {
+        mu_assert_int_eq(0, pthread_join(threads[i], NULL));
+        mu_assert_int_eq(0, readers[i].mismatches);
+    }
+    mu_assert_long_eq(td_size(into_copy) + 20 * td_size(from_copy), td_size(into));
+
+    // merging into itself
+    const long long size = td_size(into);
+    mu_assert_int_eq(0, td_merge_const(into, into));
+    mu_assert_long_eq(2 * size, td_size(into));
+
+    free(mean_before);
+    free(weight_before);
+    td_free(from);
+    td_free(from_copy);
+    td_free(into);
+    td_free(into_copy);
+}
+
+MU_TEST(test_cumulative_index) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 0; i < 5000; ++i) {
+        // a mix of repeated values and a long tail of singletons
+        const double v = i % 3 == 0 ? (double)(i % 17) : (double)i * 1.5;
+        mu_assert(td_add(t, v, 1 + i % 4) == 0, "Insertion");
+    }
+    mu_assert_int_eq(0, td_compress(t));
+    const int merged = t->merged_nodes;
+    mu_assert(2 * merged + 1 <= t->cap, "index fits after the merged centroids");
+    mu_assert_double_eq((double)t->merged_weight, t->nodes_mean[2 * merged]);
+    // the index past the centroids is not handed out as a mean
+    mu_assert_int_eq(merged, td_centroid_count(t));
+    mu_assert(isnan(td_centroids_mean_at(t, merged)), "td_centroids_mean_at past the centroids");
+
+    double probes[64];
+    int probe_count = 0;
+    for (int i = 0; i < merged; i += merged / 20 + 1) {
+        // exactly at a centroid, and just either side of it
+        probes[probe_count++] = t->nodes_mean[i];
+        probes[probe_count++] = nextafter(t->nodes_mean[i], -INFINITY);
+        probes[probe_count++] = nextafter(t->nodes_mean[i], INFINITY);
+    }
+    probes[probe_count++] = t->nodes_mean[merged - 1];
+    probes[probe_count++] = NAN;
+    const double qs[7] = {0.0001, 0.01, 0.25, 0.5, 0.75, 0.99, 0.9999};
+    double indexed_cdf[64];
+    double indexed_q[7];
+    double indexed_qs[7];
+    for (int i = 0; i < probe_count; ++i) {
+        indexed_cdf[i] = td_cdf(t, probes[i]);
+    }
+    for (int i = 0; i < 7; ++i) {
+        indexed_q[i] = td_quantile(t, qs[i]);
+    }
+    mu_assert_int_eq(0, td_quantiles(t, qs, indexed_qs, 7));
+
+    // pretend the index does not fit, forcing the linear scans
+    const int cap = t->cap;
+    t->cap = 2 * merged;
+    for (int i = 0; i < probe_count; ++i) {
+        const double linear = td_cdf(t, probes[i]);
+        mu_assert(linear == indexed_cdf[i] || (isnan(linear) && isnan(indexed_cdf[i])),
+                  "indexed cdf matches the linear scan");
+    }
+    double linear_qs[7];
+    mu_assert_int_eq(0, td_quantiles(t, qs, linear_qs, 7));
+    for (int i = 0; i < 7; ++i) {
+        mu_assert_double_eq(td_quantile(t, qs[i]), indexed_q[i]);
+        mu_assert_double_eq(linear_qs[i], indexed_qs[i]);
+    }
+    t->cap = cap;
+
+    // a new sample invalidates the index until the next compression rebuilds it
+    mu_assert(td_add(t, -1.0, 1) == 0, "Insertion");
+    mu_assert_double_eq_epsilon(0.5 / (double)td_size(t), td_cdf(t, -1.0), 1e-12);
+    mu_assert_double_eq((double)t->merged_weight, t->nodes_mean[2 * t->merged_nodes]);
+    td_free(t);
+}
+
+MU_TEST(test_cdfs) {
+    td_histogram_t *t = td_new(100);
+    mu_assert(t != NULL, "created_histogram");
+    for (int i = 0; i < 3000; ++i) {
+        mu_assert(td_add(t, i % 5 == 0 ? 42.0 : (double)((i * 7919) % 1000), 1) == 0, "Insertion");
+    }
+    const double xs[10] = {-5.0, 0.0, 1.5, 42.0, 42.0, 100.25, 500.0, 998.0, 999.0, 2000.0};
+    const double shuffled[11] = {500.0, NAN, 42.0, -5.0, 999.0, 1.5, 2000.0, 0.0, 42.0, 998.0, 100.25};
+    double out[11];
+    double ranks[11];
+    for (int pass = 0; pass < 2; ++pass) {
+        const int cap = t->cap;
+        if (pass == 1) {
+            // without the cumulative index the cursor scans linearly
+            mu_assert_int_eq(0, td_compress(t));
+            t->cap = 2 * t->merged_nodes;
+        }
+        mu_assert_int_eq(0, td_cdfs(t, xs, out, 10));
+        mu_assert_int_eq(0, td_ranks(t, xs, ranks, 10));
+        for (int i = 0; i < 10; ++i) {
+            mu_assert_double_eq(td_cdf(t, xs[i]), out[i]);
+            mu_assert_double_eq(td_cdf(t, xs[i]) * (double)td_size(t), ranks[i]);
+        }
+        mu_assert_int_eq(0, td_cdfs(t, shuffled, out, 11));
+        for (int i = 0; i < 11; ++i) {
+            if (isnan(shuffled[i])) {
+                mu_assert_double_eq(td_cdf(t, NAN), out[i]);
+            } else {
+                mu_assert_double_eq(td_cdf(t, shuffled[i]), out[i]);
+            }
+        }
+        t->cap = cap;
+    }
+    mu_assert_int_eq(EINVAL, td_cdfs(t, NULL, out, 10));
+    mu_assert_int_eq(EINVAL, td_ranks(t, xs, NULL, 10));
+    mu_assert_int_eq(0, td_cdfs(t, xs, out, 0));
+
+    td_reset(t);
+    mu_assert_int_eq(0, td_cdfs(t, xs, out, 2));
+    mu_assert(isnan(out[0]) && isnan(out[1]), "empty cdf is NaN");
+    td_free(t);
+}
+
 MU_TEST_SUITE(test_suite) {
     MU_RUN_TEST(test_basic);
     MU_RUN_TEST(test_td_init);
@@ -817,15 +2639,38 @@ MU_TEST_SUITE(test_suite) {
     MU_RUN_TEST(test_td_init_result_untouched_on_failure);
     MU_RUN_TEST(test_td_init_cap_and_determinism);
     MU_RUN_TEST(test_td_init_large_success_is_usable);
+    MU_RUN_TEST(test_td_init_ex);
+    MU_RUN_TEST(test_init_with_allocator);
+    MU_RUN_TEST(test_init_lazy);
+    MU_RUN_TEST(test_init_in_place);
+    MU_RUN_TEST(test_compact);
+    MU_RUN_TEST(test_serialize);
+    MU_RUN_TEST(test_view);
+    MU_RUN_TEST(test_init_from_centroids);
     MU_RUN_TEST(test_compress_small);
     MU_RUN_TEST(test_compress_large);
     MU_RUN_TEST(test_nans);
     MU_RUN_TEST(test_add_nonfinite);
+    MU_RUN_TEST(test_add_batch);
+    MU_RUN_TEST(test_collapse_duplicates);
+    MU_RUN_TEST(test_exact_phase);
+    MU_RUN_TEST(test_sharded);
+    MU_RUN_TEST(test_store);
+    MU_RUN_TEST(test_window);
+    MU_RUN_TEST(test_decay);
+    MU_RUN_TEST(test_build_from_samples);
+    MU_RUN_TEST(test_const_queries);
+    MU_RUN_TEST(test_merge_const);
+    MU_RUN_TEST(test_cumulative_index);
     MU_RUN_TEST(test_negative_values);
     MU_RUN_TEST(test_negative_values_merge);
+    MU_RUN_TEST(test_merge_linear);
+    MU_RUN_TEST(test_merge_many);
+    MU_RUN_TEST(test_recompress);
     MU_RUN_TEST(test_large_outlier_test);
     MU_RUN_TEST(test_two_interp);
     MU_RUN_TEST(test_cdf);
+    MU_RUN_TEST(test_cdfs);
     MU_RUN_TEST(test_td_size);
     MU_RUN_TEST(test_td_max);
     MU_RUN_TEST(test_td_min);